@@ -1,16 +1,6 @@
 #include "RFM73.h"
 #include "spi.h"
 
-#include <util/delay.h>
-
-#define GREEN_LED		   PA0
-#define GREEN_LED_SET 	   PORTA |= (1 << GREEN_LED)
-#define GREEN_LED_CLR      PORTA &=~(1 << GREEN_LED)
-
-#define RED_LED 		   PA1
-#define RED_LED_SET        PORTA |= (1 << RED_LED)
-#define RED_LED_CLR        PORTA &=~(1 << RED_LED)
-
 /******************************************************************************
 ** INTERNAL REGISTER ADDRESSES AND STRUCTRURE                                **
 ******************************************************************************/
@@ -463,6 +453,10 @@ RX mode. 1 to 32 byte, LSB first */
 #define RFM73_CMD_R_RX_PAYLOAD        0b01100001  
 /*! \brief Used in TX mode. Transmits packet with disabled AUTOACK. */
 #define RFM73_CMD_W_TX_PAYLOAD_NOACK  0b10110000  
+/*! \brief Used in RX mode. Write payload to be transmitted together with
+ACK packet on pipe PPP (bitwise OR with pipe number). Maximum three ACK
+packet payloads can be pending, they share TX FIFO. */
+#define RFM73_CMD_W_ACK_PAYLOAD       0b10101000
 /*! \brief Flush TX FIFO, used in TX mode */
 #define RFM73_CMD_FLUSH_TX            0b11100001
 /*! \brief Flush RX FIFO, used in RX mode. Should not be executed during
@@ -481,24 +475,72 @@ register. */
 /*! @} */
 
 
-/*! \brief Bank1 register initialization value. Some magic numbers here
-duplicates data from datasheet, some of the byte reversed. DO NOT edit
-this array. */
-const unsigned long Bank1_Reg0_13[]={ 0xE2014B40, 0x00004BC0, 0x028CFCD0,
-                                      0x41390099, 0x1B8296d9, 0xA67F0224,
-                                      0x00000000, 0x00000000, 0x00000000,
-                                      0x00000000, 0x00000000, 0x00000000,
-                                      0x00127300, 0x46B48000, };
-/*! \brief Bank1 register 14 initialization value. More magic numbers,
-once again: DO NOT EDIT this array.*/
-uint8_t Bank1_Reg14[]= { 0x41,0x20,0x08,0x04,0x81,0x20,0xCF,0xF7,
-                         0xFE,0xFF,0xFF };
-
-
-//Receive address data pipe 0
-const uint8_t RX0_Address[]={0x34,0x43,0x10,0x10,0x01};
-//Receive address data pipe 1
-const uint8_t RX1_Address[]={0x39,0x38,0x37,0x36,0xc2};
+/*! \brief Wait limit for the module to answer after power on reset, ms.*/
+#define RFM73_POR_TIMEOUT_MS    200
+/*! \brief Settling time from power down to standby mode, ms.*/
+#define RFM73_PWR_UP_MS         3
+/*! \brief Settling time of PLL after CE goes high (130 us), ms.*/
+#define RFM73_LOCK_MS           1
+
+/*! \brief Bank1 initialization table (see _rfm73_write_table). Magic numbers
+from datasheet, already in the byte order the module expects: registers 0-8
+LSB first, registers 9-13 MSB first. Register 4 is written twice more with
+bits 1,2 toggled. DO NOT edit this table.*/
+static const uint8_t _rfm73_bank1_init[] PROGMEM = {
+	RFM73_CMD_W_REGISTER | 0,  4, 0x40, 0x4B, 0x01, 0xE2,
+	RFM73_CMD_W_REGISTER | 1,  4, 0xC0, 0x4B, 0x00, 0x00,
+	RFM73_CMD_W_REGISTER | 2,  4, 0xD0, 0xFC, 0x8C, 0x02,
+	RFM73_CMD_W_REGISTER | 3,  4, 0x99, 0x00, 0x39, 0x41,
+	RFM73_CMD_W_REGISTER | 4,  4, 0xD9, 0x96, 0x82, 0x1B,
+	RFM73_CMD_W_REGISTER | 5,  4, 0x24, 0x02, 0x7F, 0xA6,
+	RFM73_CMD_W_REGISTER | 6,  4, 0x00, 0x00, 0x00, 0x00,
+	RFM73_CMD_W_REGISTER | 7,  4, 0x00, 0x00, 0x00, 0x00,
+	RFM73_CMD_W_REGISTER | 8,  4, 0x00, 0x00, 0x00, 0x00,
+	RFM73_CMD_W_REGISTER | 9,  4, 0x00, 0x00, 0x00, 0x00,
+	RFM73_CMD_W_REGISTER | 10, 4, 0x00, 0x00, 0x00, 0x00,
+	RFM73_CMD_W_REGISTER | 11, 4, 0x00, 0x00, 0x00, 0x00,
+	RFM73_CMD_W_REGISTER | 12, 4, 0x00, 0x12, 0x73, 0x00,
+	RFM73_CMD_W_REGISTER | 13, 4, 0x46, 0xB4, 0x80, 0x00,
+	RFM73_CMD_W_REGISTER | 14, 11, 0x41, 0x20, 0x08, 0x04, 0x81, 0x20,
+	                               0xCF, 0xF7, 0xFE, 0xFF, 0xFF,
+	// toggle REG4<25,26>
+	RFM73_CMD_W_REGISTER | 4,  4, 0xDF, 0x96, 0x82, 0x1B,
+	RFM73_CMD_W_REGISTER | 4,  4, 0xD9, 0x96, 0x82, 0x1B,
+	0 };
+
+/*! \brief Bank0 initialization table (see _rfm73_write_table): CRC-16,
+auto-ack and dynamic payload on all pipes, payload width 32 for pipes 0-4,
+5 bytes addresses, retransmit 15 times with 4 ms delay. RX address of
+pipe 0 and TX address are 0x34,0x43,0x10,0x10,0x01, RX address of pipe 1 is
+0x39,0x38,0x37,0x36,0xC2. RF_SETUP keeps only its fixed bits, rf params are
+set by rfm73_init. FEATURE and DYNPD need activated module.*/
+static const uint8_t _rfm73_bank0_init[] PROGMEM = {
+	RFM73_CMD_W_REGISTER | RFM73_RADR_ENAA,         1, 0x3F,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_EN_RX_ADDR,   1, 0x3F,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_SETUP_AW,     1, RFM73_ADR_WID_5BYTES,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_SETUP_RETR,   1, 0xFF,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_RF_SETUP,     1, RS_PLL_LOCK_bm,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_RX_ADDR_P0,   5, 0x34, 0x43, 0x10,
+	                                                   0x10, 0x01,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_RX_ADDR_P1,   5, 0x39, 0x38, 0x37,
+	                                                   0x36, 0xC2,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_RX_ADDR_P2,   1, 0xC3,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_RX_ADDR_P3,   1, 0xC4,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_RX_ADDR_P4,   1, 0xC5,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_RX_ADDR_P5,   1, 0xC6,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_TX_ADDR,      5, 0x34, 0x43, 0x10,
+	                                                   0x10, 0x01,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_RX_PW_P0,     1, 32,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_RX_PW_P1,     1, 32,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_RX_PW_P2,     1, 32,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_RX_PW_P3,     1, 32,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_RX_PW_P4,     1, 32,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_RX_PW_P5,     1, 0,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_FEATURE,      1, FE_EN_DYN_ACK_bm |
+	                                                   FE_EN_ACK_PAY_bm |
+	                                                   FE_EN_DPL_bm,
+	RFM73_CMD_W_REGISTER | RFM73_RADR_DYNPD,        1, 0x3F,
+	0 };
 
 /*! \defgroup lowlevelfunc Low level functions
 
@@ -522,6 +564,14 @@ Low level functions include such actions as:
 	    // Flush RX buffer:
 		_rfm73_write_cmd(RFM73_CMD_FLUSH_RX, 0);
 	\endcode
+<li>start multi-byte transfer that is moved by SPI interrupt and return at
+	once: _rfm73_xfer_buf. CSN line is handled by SPI engine (see spi.h), all
+	other low level functions wait for such transfer to finish before using
+	SPI.
+<li>take and release SPI bus: _rfm73_bus_lock, _rfm73_bus_unlock. IRQ
+	interrupt is disabled while bus is taken, all functions above do it
+	themselves.
+<li>read and clear STATUS flags in one transaction: _rfm73_clear_status.
 <li>toggle internal register bank of RFM73 module: _rfm73_toggle_reg_bank.
 	There are 2 register banks in RFM73 module and there is no necessity in
 	switching to bank 2 in any time except initialization.
@@ -534,6 +584,29 @@ Low level functions include such actions as:
 \addtogroup lowlevelfunc
  @{ */
 
+/*! \brief Nesting counter of SPI bus users. IRQ interrupt is disabled while
+it is not zero, so interrupt handler never breaks other SPI transaction.*/
+static volatile uint8_t _rfm73_bus_cnt = 0;
+/*! \brief Set to 1 by rfm73_irq_enable.*/
+static volatile uint8_t _rfm73_irq_on = 0;
+
+/*! \brief Takes SPI bus: disables IRQ interrupt until _rfm73_bus_unlock is
+called. Calls could be nested.*/
+void _rfm73_bus_lock() {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		_rfm73_bus_cnt++;
+		RFM73_IRQ_INT_DISABLE;
+	}
+}
+
+/*! \brief Releases SPI bus taken by _rfm73_bus_lock.*/
+void _rfm73_bus_unlock() {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (_rfm73_bus_cnt) _rfm73_bus_cnt--;
+		if ((_rfm73_bus_cnt==0) && _rfm73_irq_on) RFM73_IRQ_INT_ENABLE;
+	}
+}
+
 /*! \brief Writes some value to some internal register or send specific command
 to module.
 
@@ -543,6 +616,9 @@ to module.
 \param value - some value, that would be written if this function is used to
                write data to register.*/
 void _rfm73_write_cmd(uint8_t reg, uint8_t value) {
+	// take the bus, wait for interrupt-driven transfer to finish
+	_rfm73_bus_lock();
+	spi_wait();
 	// CSN low, init SPI transaction
 	RFM73_CSN_LOW;
 	// select register
@@ -551,6 +627,7 @@ void _rfm73_write_cmd(uint8_t reg, uint8_t value) {
 	spi_read(value);
 	// CSN high again
 	RFM73_CSN_HIGH;
+	_rfm73_bus_unlock();
 }
 
 /*! \brief Read data from internal register of the RFM73 module.
@@ -564,6 +641,9 @@ void _rfm73_write_cmd(uint8_t reg, uint8_t value) {
 \return Value that was stored in this register.*/
 uint8_t _rfm73_read_cmd(uint8_t reg) {        
 	uint8_t value;
+	// take the bus, wait for interrupt-driven transfer to finish
+	_rfm73_bus_lock();
+	spi_wait();
 	// CSN low, initialize SPI communication...
 	RFM73_CSN_LOW;
 	// Select register to read from..
@@ -572,6 +652,7 @@ uint8_t _rfm73_read_cmd(uint8_t reg) {
 	value = spi_read(0);
 	// CSN high, terminate SPI communication
 	RFM73_CSN_HIGH;
+	_rfm73_bus_unlock();
     // return register value
 	return(value);
 }
@@ -584,18 +665,19 @@ buffer, get RX address of pipeline 0 or 1, etc.
 \param pBuf - RAM-buffer, where data would be stored.
 \param length - number of bytes to be read.*/
 void _rfm73_read_buf(uint8_t reg, uint8_t *pBuf, uint8_t length) {
-	uint8_t status,byte_ctr;
+	// take the bus, wait for interrupt-driven transfer to finish
+	_rfm73_bus_lock();
+	spi_wait();
 	// Set CSN low
 	RFM73_CSN_LOW;
-	// Select register to write, and read status UINT8
-	status = spi_read(reg);
-	      
-	for(byte_ctr=0;byte_ctr<length;byte_ctr++)
-		// Perform SPI_RW to read UINT8 from RFM73 
-		pBuf[byte_ctr] = spi_read(0);
+	// Select register to read from
+	spi_read(reg);
+	// read all UINT8 at full bus speed
+	spi_transfer(0, pBuf, length);
 	
 	// Set CSN high again
 	RFM73_CSN_HIGH;
+	_rfm73_bus_unlock();
 }
                                              
 /*! \brief Write multi-byte data to the RFM73 module.
@@ -605,17 +687,118 @@ void _rfm73_read_buf(uint8_t reg, uint8_t *pBuf, uint8_t length) {
 \param pBuf - RAM-buffer, where data is stored.
 \param length - number of bytes to write.*/
 void _rfm73_write_buf(uint8_t reg, uint8_t *pBuf, uint8_t length) {
-	uint8_t byte_ctr;
-	
+	// take the bus, wait for interrupt-driven transfer to finish
+	_rfm73_bus_lock();
+	spi_wait();
 	// Set CSN low, init SPI tranaction
 	RFM73_CSN_LOW;
 	// Select register to write to and read status UINT8
 	spi_read(reg);
-	// then write all UINT8 in buffer(*pBuf) 
-	for(byte_ctr=0; byte_ctr<length; byte_ctr++)
-		spi_read(*(pBuf++));
+	// then write all UINT8 in buffer(*pBuf) at full bus speed
+	spi_transfer(pBuf, 0, length);
 	// Set CSN high again
 	RFM73_CSN_HIGH;
+	_rfm73_bus_unlock();
+}
+
+/*! \brief Reads STATUS register and clears its RX_DR, TX_DS and MAX_RT flags
+in one SPI transaction. Only flags that were read as set are cleared, so
+events that happen during this transaction are not lost.
+
+\return STATUS register value before clearing.*/
+uint8_t _rfm73_clear_status() {
+	uint8_t status;
+	_rfm73_bus_lock();
+	spi_wait();
+	RFM73_CSN_LOW;
+	// STATUS is shifted out while command byte is sent
+	status = spi_read(RFM73_CMD_W_REGISTER | RFM73_RADR_STATUS);
+	spi_read(status & (ST_RX_DR_bm | ST_TX_DS_bm | ST_MAX_RT_bm));
+	RFM73_CSN_HIGH;
+	_rfm73_bus_unlock();
+	return status;
+}
+
+/*! \brief Descriptor of the interrupt-driven payload transfer.*/
+static spi_xfer_t _rfm73_xfer;
+/*! \brief User function called at the end of interrupt-driven transfer.*/
+static void (*_rfm73_xfer_cb)(uint8_t status);
+
+/*! \brief Completion handler of interrupt-driven transfer, called from
+SPI_STC interrupt.*/
+static void _rfm73_xfer_done(spi_xfer_t* xfer) {
+	_rfm73_bus_unlock();
+	if (_rfm73_xfer_cb) _rfm73_xfer_cb(xfer->status);
+}
+
+/*! \brief Starts interrupt-driven multi-byte transfer and returns at once.
+CSN line is handled by the SPI engine.
+
+\param reg - bitwise OR between command and address of a register for
+             which this command is being applied.
+\param tx - RAM-buffer with data to write (NULL to write zeros). Must stay
+            valid until transfer is finished.
+\param rx - RAM-buffer for read data (NULL if data is not needed).
+\param length - number of bytes after command byte.
+\param done - function called from interrupt when transfer is finished, its
+              argument is value of STATUS register (may be NULL).
+
+\return 0 if transfer started, 1 if previous transfer is still running.*/
+uint8_t _rfm73_xfer_buf(uint8_t reg, const uint8_t* tx, uint8_t* rx,
+                        uint8_t length, void (*done)(uint8_t status)) {
+	_rfm73_bus_lock();
+	if (spi_busy()) {
+		_rfm73_bus_unlock();
+		return 1;
+	}
+	_rfm73_xfer.cmd = reg;
+	_rfm73_xfer.tx = tx;
+	_rfm73_xfer.rx = rx;
+	_rfm73_xfer.len = length;
+	_rfm73_xfer.done = _rfm73_xfer_done;
+	_rfm73_xfer_cb = done;
+	// the bus is released by _rfm73_xfer_done
+	return spi_xfer_start(&_rfm73_xfer);
+}
+
+/*! \brief Number of bank0 registers covered by RAM shadow (CONFIG..FEATURE).*/
+#define RFM73_SHADOW_SIZE       (RFM73_RADR_FEATURE+1)
+/*! \brief Bit-mask of bank0 registers which are kept in RAM shadow. STATUS,
+OBSERVE_TX, CD and FIFO_STATUS are changed by the module itself, multi-byte
+address registers are kept in separate arrays.*/
+#define RFM73_SHADOW_MASK       (0x307EF07FUL)
+
+/*! \brief RAM copy of single-byte bank0 registers. Setters update it, getters
+return values from it without SPI communication.*/
+static uint8_t _rfm73_shadow[RFM73_SHADOW_SIZE];
+/*! \brief RAM copy of RX_ADDR_P0 register.*/
+static uint8_t _rfm73_shadow_rx_addr_p0[5];
+/*! \brief RAM copy of RX_ADDR_P1 register.*/
+static uint8_t _rfm73_shadow_rx_addr_p1[5];
+/*! \brief RAM copy of TX_ADDR register.*/
+static uint8_t _rfm73_shadow_tx_addr[5];
+
+/*! \brief Writes value to bank0 register and to its RAM shadow.
+
+\param reg - register address, e.g. #RFM73_RADR_CONFIG;
+\param value - new register value.*/
+void _rfm73_write_reg(uint8_t reg, uint8_t value) {
+	_rfm73_shadow[reg] = value;
+	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | reg, value);
+}
+
+/*! \brief Writes multi-byte address register and its RAM shadow. Number of
+bytes is determined by shadow of SETUP_AW register.
+
+\param reg - register address: #RFM73_RADR_RX_ADDR_P0, #RFM73_RADR_RX_ADDR_P1
+             or #RFM73_RADR_TX_ADDR;
+\param shadow - RAM shadow of this register;
+\param addr - new address value.*/
+void _rfm73_write_addr(uint8_t reg, uint8_t* shadow, uint8_t* addr) {
+	uint8_t i, len = _rfm73_shadow[RFM73_RADR_SETUP_AW] + 2;
+	for (i=0; i<len; i++)
+		shadow[i] = addr[i];
+	_rfm73_write_buf(RFM73_CMD_W_REGISTER | reg, addr, len);
 }
 
 uint8_t rfm73_get_power_state();
@@ -631,8 +814,9 @@ void _rfm73_activate() {
 	uint8_t r = _rfm73_read_cmd(RFM73_CMD_R_REGISTER|RFM73_RADR_FEATURE);
 	// if there are ones in answer then module is activated
 	if (r==0) {
-		// check activation by writing 1 to LSB
-		_rfm73_write_cmd(RFM73_CMD_W_REGISTER|RFM73_RADR_FEATURE, 0x01);
+		// check activation by writing 1 to LSB; shadow is not touched, so
+		// rfm73_restore writes FEATURE back as it was
+		_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_FEATURE, 0x01);
 		r = _rfm73_read_cmd(RFM73_CMD_R_REGISTER|RFM73_RADR_FEATURE);
 		if (r!=1) {
 			// module is not activated. activation sequence
@@ -658,6 +842,62 @@ void _rfm73_toggle_reg_bank(uint8_t rbank) {
 	}
 }
 
+/*! \brief Writes configuration table from flash to the module. Every record
+is sent in one SPI burst, records follow each other without delays.
+
+\param table - records of command byte, data length (up to 11) and data
+               bytes, terminated by zero command byte, e.g.
+			   #_rfm73_bank0_init;
+\param shadow - if not zero, RAM shadow of written bank0 registers is
+                updated.*/
+void _rfm73_write_table(const uint8_t* table, uint8_t shadow) {
+	uint8_t cmd, len, reg, i;
+	uint8_t buf[11];
+	uint8_t* addr;
+	while ((cmd = pgm_read_byte(table++)) != 0) {
+		len = pgm_read_byte(table++);
+		for (i=0; i<len; i++)
+			buf[i] = pgm_read_byte(table++);
+		reg = cmd & 0x1F;
+		if (shadow) {
+			// multi-byte address registers have separate shadows
+			addr = 0;
+			if (reg == RFM73_RADR_RX_ADDR_P0) addr = _rfm73_shadow_rx_addr_p0;
+			if (reg == RFM73_RADR_RX_ADDR_P1) addr = _rfm73_shadow_rx_addr_p1;
+			if (reg == RFM73_RADR_TX_ADDR) addr = _rfm73_shadow_tx_addr;
+			if (addr)
+				for (i=0; i<len; i++)
+					addr[i] = buf[i];
+			else if (reg < RFM73_SHADOW_SIZE)
+				_rfm73_shadow[reg] = buf[0];
+		}
+		_rfm73_write_buf(cmd, buf, len);
+	}
+}
+
+/*! \brief Writes bank1 registers from #_rfm73_bank1_init table. Register bank
+is left switched to bank1.*/
+void _rfm73_init_bank1() {
+	_rfm73_toggle_reg_bank(1);
+	_rfm73_write_table(_rfm73_bank1_init, 0);
+}
+
+/*! \brief Waits until the module answers on SPI after power on reset, instead
+of fixed delay. STATUS register never reads as 0xFF, and 0x00 only with
+packet in RX FIFO, while MISO line of not ready module gives one of them.
+
+\return 0 if module is ready, 1 if it didn't answer in
+        #RFM73_POR_TIMEOUT_MS.*/
+uint8_t _rfm73_wait_ready() {
+	uint8_t t, st;
+	for (t=0; t<RFM73_POR_TIMEOUT_MS; t++) {
+		st = _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_STATUS);
+		if ((st != 0x00) && (st != 0xFF)) return 0;
+		RFM73_DELAY_MS(1);
+	}
+	return 1;
+}
+
 /*! @}*/
 
 /*! \defgroup highlevelfunc High-level functions
@@ -671,39 +911,110 @@ These functions could be roughly divided in following groups:
 <li>various configuration functions, all having rfm73_set_ prefix:
 rfm73_set_en_pipelines, rfm73_set_crc_len, etc.
 <li>various read functions, all having rfm73_get_ prefix: rfm73_get_channel,
-rfm73_get_power_state, etc.
+rfm73_get_power_state, etc. Configuration registers are kept in RAM shadow,
+so setters don't read registers before writing them and getters don't use
+SPI at all. Functions rfm73_verify, rfm73_restore and rfm73_resync are used
+to check and recover this shadow.
 <li>various specific functions: rfm73_power_up, rfm73_power_down,
-rfm73_rx_mode, etc.
+rfm73_rx_mode, etc. Settling after power up and PLL lock after entering RX or
+TX mode could be waited without blocking: rfm73_init_async and
+rfm73_power_up_async return at once, rfm73_poll reports when driver state
+is reached (timers are counted by rfm73_tick).
 <li>communication functions: rfm73_send_packet, rfm73_receive_packet.
+Received packets are moved from RX FIFO to software RX queue, which is read
+by rfm73_rx_get and rfm73_rx_get_batch.
+Sending could also be done without waiting: rfm73_send_async starts it,
+rfm73_send_status and rfm73_send_callback report the result. Packets are
+kept in software TX queue, which keeps TX FIFO of the module filled. rfm73_tick
+should be called every millisecond to get timeouts.
+<li>zero-copy communication: payloads of both queues are kept in a pool of
+packet slots (#RFM73_SLOTS), SPI interrupt reads RX FIFO to a slot and writes
+TX FIFO from a slot. rfm73_rx_take and rfm73_receive_slot lend slot of
+received packet to application, rfm73_slot_alloc lends a free one;
+rfm73_send_slot passes slot back to TX queue, rfm73_slot_free to the pool.
+<li>request/response in one packet exchange: receiver preloads response with
+rfm73_ack_payload, it is sent back in acknowledge and returned to transmitter
+by rfm73_send_request.
 <li>high-level function rfm73_find_receiver, which performs scan of air using
 auto-ack packet and returns channel and datarate at which response had been
-received.
+received. The same scan could be done step by step with rfm73_scan_start and
+rfm73_scan_step, progress is returned by rfm73_scan_state.
+<li>rfm73_survey, which samples carrier detect bit on every channel and
+returns occupancy histogram to choose quiet channel.
+<li>rfm73_stats, which returns 32-bit counters of the link (packets sent,
+acknowledged and failed, retransmits, packets per pipe, RX queue stalls and
+flushes, time in TX and RX). They are counted by interrupts and queues of the
+library, so no SPI transfers are added except one OBSERVE_TX read per
+acknowledged packet which was the last one in TX FIFO.
 </ul>
 
 \addtogroup highlevelfunc
  @{ */
 
+/*! \brief Function called on RX_DR event.*/
+static rfm73_event_cb_t _rfm73_on_rx_dr = 0;
+/*! \brief Function called on TX_DS event.*/
+static rfm73_event_cb_t _rfm73_on_tx_ds = 0;
+/*! \brief Function called on MAX_RT event.*/
+static rfm73_event_cb_t _rfm73_on_max_rt = 0;
+/*! \brief Nesting counter of event handling (IRQ interrupt, RX_DR callback).
+Queued packets are not written to TX FIFO while it is not zero, so SPI stays
+free for synchronous transfers of the handler and callbacks, which can't wait
+for interrupt-driven transfer there.*/
+static volatile uint8_t _rfm73_in_event = 0;
+
+/*! \brief State of the driver (see rfm73_poll).*/
+static volatile uint8_t _rfm73_state = RFM73_STATE_OFF;
+/*! \brief Milliseconds left in current state, counted by rfm73_tick.*/
+static volatile uint8_t _rfm73_state_timer = 0;
+/*! \brief State entered when power up settling is over.*/
+static uint8_t _rfm73_state_next = RFM73_STATE_STANDBY;
+/*! \brief Parameters of rfm73_init_async.*/
+static uint8_t _rfm73_init_params[4];
+/*! \brief Counters of the link (see rfm73_stats).*/
+static rfm73_stats_t _rfm73_stat;
+
+/*! \brief Sets state of the driver which lasts ms milliseconds of rfm73_tick
+(0 - until changed). One tick is added, as the first one comes at any
+moment.*/
+static void _rfm73_set_state(uint8_t state, uint8_t ms) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		_rfm73_state = state;
+		_rfm73_state_timer = ms ? ms + 1 : 0;
+	}
+}
+
+/*! \brief Sets state of the driver after CE goes high in RX or TX mode. If
+module is still powering up, it is entered after settling.*/
+static void _rfm73_set_lock_state(uint8_t state) {
+	if ((_rfm73_state == RFM73_STATE_POWER_UP) ||
+	    (_rfm73_state == RFM73_STATE_POR))
+		_rfm73_state_next = state;
+	else if (_rfm73_state != RFM73_STATE_OFF)
+		_rfm73_set_state(state, RFM73_LOCK_MS);
+}
+
 /*! \brief This function sets RFM73 module in RX mode (this mode is
-characterized with high energy drain).*/
+characterized with high energy drain). Packets in RX FIFO are kept: they are
+already acknowledged to transmitter, so they are moved to RX queue as usual.*/
 void rfm73_rx_mode()
 {
 	uint8_t value;
-	//flush Rx
-	_rfm73_write_cmd(RFM73_CMD_FLUSH_RX,0);
-	// read register STATUS's value
-	value=_rfm73_read_cmd(RFM73_RADR_STATUS);
-	// clear RX_DR or TX_DS or MAX_RT interrupt flag
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER|RFM73_RADR_STATUS,value);
+	// clear TX_DS or MAX_RT interrupt flag (writing 1 to a flag that is not
+	// set does nothing), RX_DR is left for packets in RX FIFO
+	_rfm73_write_cmd(RFM73_CMD_W_REGISTER|RFM73_RADR_STATUS,
+	                 ST_TX_DS_bm | ST_MAX_RT_bm);
 
 	RFM73_CE_LOW;
-	// read register CONFIG's value
-	value=_rfm73_read_cmd(RFM73_RADR_CONFIG);
+	// take CONFIG's value from shadow
+	value=_rfm73_shadow[RFM73_RADR_CONFIG];
 	//PRX set bit 1
 	value=value|0x01;
 	// Set PWR_UP bit, enable CRC(2 length) & Prim:RX. RX_DR enabled..
-  	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_CONFIG, value); 
+  	_rfm73_write_reg(RFM73_RADR_CONFIG, value); 
 
 	RFM73_CE_HIGH;
+	_rfm73_set_lock_state(RFM73_STATE_RX_LOCK);
 }
 
 /*! \brief Set RFM73 module to transmit-state. In this state module will
@@ -718,14 +1029,15 @@ void rfm73_tx_mode()
 	_rfm73_write_cmd(RFM73_CMD_FLUSH_TX,0);
 
 	RFM73_CE_LOW;
-	// read register CONFIG's value
-	value=_rfm73_read_cmd(RFM73_RADR_CONFIG);	
+	// take CONFIG's value from shadow
+	value=_rfm73_shadow[RFM73_RADR_CONFIG];	
     //PTX set bit 0
 	value=value&0xfe;
 	// Set PWR_UP bit, enable CRC(2 length) & Prim:RX. RX_DR enabled.
-  	_rfm73_write_cmd(RFM73_CMD_W_REGISTER|RFM73_RADR_CONFIG, value); 
+  	_rfm73_write_reg(RFM73_RADR_CONFIG, value); 
 	
 	RFM73_CE_HIGH;
+	_rfm73_set_lock_state(RFM73_STATE_TX_LOCK);
 }
 
 /*! \brief This function setup length of CRC field that is added by module to
@@ -738,7 +1050,7 @@ sending data.
 			 - 2 - protect with CRC-16 code (the polynomia is
 			       X^16 + X^12 + X^5 + 1, initial value is 0xFFFF).*/
 void rfm73_set_crc_len(uint8_t crc_len) {
-	uint8_t conf = _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_CONFIG);
+	uint8_t conf = _rfm73_shadow[RFM73_RADR_CONFIG];
 	switch (crc_len) {
 		case 0:
 			// no crc
@@ -752,7 +1064,7 @@ void rfm73_set_crc_len(uint8_t crc_len) {
 		default:
 			conf |= (CF_EN_CRC_bm | CF_CRCO_bm);
 	}	
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_CONFIG, conf);
+	_rfm73_write_reg(RFM73_RADR_CONFIG, conf);
 }
 
 /*! \brief This function setup current RF channel within 2.4 GHz frequency
@@ -761,8 +1073,7 @@ window.
 \param ch - channel number between 0-127.*/
 void rfm73_set_channel(uint8_t ch)
 {
-	_rfm73_write_cmd((uint8_t)(RFM73_CMD_W_REGISTER|RFM73_RADR_RF_CH),
-	                (uint8_t)(ch));
+	_rfm73_write_reg(RFM73_RADR_RF_CH, ch & 0x7F);
 }
 
 /*! \brief This function sets main RF params of the module.
@@ -778,9 +1089,9 @@ void rfm73_set_channel(uint8_t ch)
 				   #RFM73_DATA_RATE_250KBPS.*/
 void rfm73_set_rf_params(uint8_t out_pwr, uint8_t lna_gain,
                          uint8_t data_rate) {
-	volatile uint8_t c;
-	// read config
-	c = _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_RF_SETUP);
+	uint8_t c;
+	// take config from shadow
+	c = _rfm73_shadow[RFM73_RADR_RF_SETUP];
 	// clear all used bits
 	c &=~(RS_RF_DR_bm | RS_LNA_HCURR_bm | RS_RF_PWR_bm);
 	// set appropriate bits
@@ -789,7 +1100,7 @@ void rfm73_set_rf_params(uint8_t out_pwr, uint8_t lna_gain,
     c |= (((data_rate & 2) >> 1) << RS_RF_DR_HIGH_bf) |
 	     ((data_rate & 1) << RS_RF_DR_LOW_bf);
 	// write config
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_RF_SETUP, c);	
+	_rfm73_write_reg(RFM73_RADR_RF_SETUP, c);	
 }
 
 /*! \brief This function enables auto-acknowledge feature of specified receive
@@ -801,8 +1112,7 @@ pipelines.
 					   value of 0x13 would lead to enabling auto-acknowledge to
 					   pipelines 0, 1, and 4.*/
 void rfm73_set_autoack(uint8_t pipeline_mask) {
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_ENAA,
-	                 pipeline_mask & 0x3F);
+	_rfm73_write_reg(RFM73_RADR_ENAA, pipeline_mask & 0x3F);
 }
 
 /*! \brief This function enables specified receive pipelines therefore
@@ -813,8 +1123,7 @@ enabling communication with addresses connected to these pipelines.
 					   sending to this function a value of 0x13 would lead to
 					   enabling pipelines 0, 1, and 4.*/
 void rfm73_set_en_pipelines(uint8_t pipeline_mask) {
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_EN_RX_ADDR,
-	                 pipeline_mask & 0x3F);
+	_rfm73_write_reg(RFM73_RADR_EN_RX_ADDR, pipeline_mask & 0x3F);
 }
 
 /*! \brief This function sets address width of all data pipelines.
@@ -826,7 +1135,7 @@ void rfm73_set_address_width(uint8_t aw) {
 	uint8_t c = aw & 3;
 	// '00' is illegal
 	if (c==0) c = 1;
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER|RFM73_RADR_SETUP_AW, c);
+	_rfm73_write_reg(RFM73_RADR_SETUP_AW, c);
 }
 
 /*! \brief This function sets auto re-trnasmition parameters.
@@ -844,47 +1153,31 @@ void rfm73_set_autort(uint16_t rt_time, uint8_t rt_count) {
 	if (rt_time<250) time = 0;
 	if (rt_time>4000) time = 15;
 	if (rt_count>15) count = 15;
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_SETUP_RETR,
-	                 (time << 4) | count);
+	_rfm73_write_reg(RFM73_RADR_SETUP_RETR, (time << 4) | count);
 }
 
 /*! \brief This function sets all bytes of the TX address. Number of bytes to
-set is determined by reading SETUP_AW register.
+set is determined by shadow of SETUP_AW register.
 
 \param addr - address value array with sufficient length.*/
 void rfm73_set_tx_addr(uint8_t* addr) {
-	// get address lenght
-	uint8_t addr_len = 
-	    _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_SETUP_AW);
-	// set new addr
-	_rfm73_write_buf((RFM73_CMD_W_REGISTER | RFM73_RADR_TX_ADDR),
-	                 addr, addr_len+2);
+	_rfm73_write_addr(RFM73_RADR_TX_ADDR, _rfm73_shadow_tx_addr, addr);
 }
 
 /*! \brief This function sets all bytes of the RX pipeline 0 address. Number of
-bytes to set is determined by reading SETUP_AW register.
+bytes to set is determined by shadow of SETUP_AW register.
 
 \param addr - address value array with sufficient length.*/
 void rfm73_set_rx_addr_p0(uint8_t* addr) {
-	// get address lenght
-	uint8_t addr_len = 
-	    _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_SETUP_AW);
-	// set new addr
-	_rfm73_write_buf((RFM73_CMD_W_REGISTER | RFM73_RADR_RX_ADDR_P0),
-	                 addr, addr_len+2);
+	_rfm73_write_addr(RFM73_RADR_RX_ADDR_P0, _rfm73_shadow_rx_addr_p0, addr);
 }
 
 /*! \brief This function sets all bytes of the RX pipeline 1 address. Number of
-bytes to set is determined by reading SETUP_AW register.
+bytes to set is determined by shadow of SETUP_AW register.
 
 \param addr - address value array with sufficient length.*/
 void rfm73_set_rx_addr_p1(uint8_t* addr) {
-	// get address lenght
-	uint8_t addr_len = 
-	    _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_SETUP_AW);
-	// set new addr
-	_rfm73_write_buf((RFM73_CMD_W_REGISTER | RFM73_RADR_RX_ADDR_P1),
-	                 addr, addr_len+2);
+	_rfm73_write_addr(RFM73_RADR_RX_ADDR_P1, _rfm73_shadow_rx_addr_p1, addr);
 }
 
 /*! \brief This function sets LSB byte of the RX pipeline2 address (other
@@ -892,7 +1185,7 @@ bytes are equal to MSB bytes of RX pipeline1.
 
 \param addr - address value (any uint8_t).*/
 void rfm73_set_rx_addr_p2(uint8_t addr) {
-	_rfm73_write_cmd((RFM73_CMD_W_REGISTER | RFM73_RADR_RX_ADDR_P2), addr);
+	_rfm73_write_reg(RFM73_RADR_RX_ADDR_P2, addr);
 }
 
 /*! \brief This function sets LSB byte of the RX pipeline3 address (other
@@ -900,7 +1193,7 @@ bytes are equal to MSB bytes of RX pipeline1.
 
 \param addr - address value (any uint8_t).*/
 void rfm73_set_rx_addr_p3(uint8_t addr) {
-	_rfm73_write_cmd((RFM73_CMD_W_REGISTER | RFM73_RADR_RX_ADDR_P3), addr);
+	_rfm73_write_reg(RFM73_RADR_RX_ADDR_P3, addr);
 }
 
 /*! \brief This function sets LSB byte of the RX pipeline4 address (other
@@ -908,7 +1201,7 @@ bytes are equal to MSB bytes of RX pipeline1.
 
 \param addr - address value (any uint8_t).*/
 void rfm73_set_rx_addr_p4(uint8_t addr) {
-	_rfm73_write_cmd((RFM73_CMD_W_REGISTER | RFM73_RADR_RX_ADDR_P4), addr);
+	_rfm73_write_reg(RFM73_RADR_RX_ADDR_P4, addr);
 }
 
 /*! \brief This function sets LSB byte of the RX pipeline5 address (other
@@ -916,7 +1209,7 @@ bytes are equal to MSB bytes of RX pipeline1.
 
 \param addr - address value (any uint8_t).*/
 void rfm73_set_rx_addr_p5(uint8_t addr) {
-	_rfm73_write_cmd((RFM73_CMD_W_REGISTER | RFM73_RADR_RX_ADDR_P5), addr);
+	_rfm73_write_reg(RFM73_RADR_RX_ADDR_P5, addr);
 }
 
 /*! \brief This function sets payload width of the specified receiving
@@ -927,8 +1220,7 @@ pipeline.
 void rfm73_set_rx_payload_width(uint8_t pipeline, uint8_t wid) {
 	if (pipeline>5) pipeline = 5;
 	if (wid>32) wid = 32;
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | (RFM73_RADR_RX_PW_P0 + pipeline),
-	                 wid);
+	_rfm73_write_reg(RFM73_RADR_RX_PW_P0 + pipeline, wid);
 }
 
 /*! \brief This function enables dynamic payload feature for specific
@@ -941,7 +1233,7 @@ pipeline0.
 */
 void rfm73_set_dyn_payload(uint8_t pipeline_mask) {
 	pipeline_mask &= 0x3f;
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_DYNPD, pipeline_mask);
+	_rfm73_write_reg(RFM73_RADR_DYNPD, pipeline_mask);
 }
 
 /*! \brief This function enables and disables features that described in
@@ -958,7 +1250,7 @@ void rfm73_set_features(uint8_t en_dyn_payload_len, uint8_t en_payload_ack,
 		 ((en_payload_ack & 1) << FE_EN_ACK_PAY_bf) |
 		 ((en_dyn_payload_len& 1) << FE_EN_DPL_bf);
 	// write them to register
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_FEATURE, c);
+	_rfm73_write_reg(RFM73_RADR_FEATURE, c);
 }
 
 /*! \brief This function returns whether dynamic payload feature is enabled.
@@ -967,7 +1259,7 @@ void rfm73_set_features(uint8_t en_dyn_payload_len, uint8_t en_payload_ack,
 feature is enabled for respective pipeline. E.g: result = 0x13 means that this
 feature is enabled for pipelines 0, 1 and 4.*/
 uint8_t rfm73_get_dyn_payload() {
-	return _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_DYNPD);
+	return _rfm73_shadow[RFM73_RADR_DYNPD];
 }
 
 /*! \brief This function returns length of specified pipeline in bytes.
@@ -977,8 +1269,7 @@ uint8_t rfm73_get_dyn_payload() {
 \return Length (0-32) of specified pipeline.*/
 uint8_t rfm73_get_rx_payload_width(uint8_t pipeline) {
 	if (pipeline>5) pipeline = 5;
-	return _rfm73_read_cmd(RFM73_CMD_R_REGISTER | 
-	                       (RFM73_RADR_RX_PW_P0 + pipeline));
+	return _rfm73_shadow[RFM73_RADR_RX_PW_P0 + pipeline];
 }
 
 /*! \brief This function returns current power up state of the module.
@@ -988,36 +1279,127 @@ uint8_t rfm73_get_rx_payload_width(uint8_t pipeline) {
       - 1 if module is powered up.*/
 uint8_t rfm73_get_power_state() {
 	// return value of PWR_UP bit in CONFIG register
-	return ((_rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_CONFIG)
-	       & CF_PWR_UP_bm) >> CF_PWR_UP_bf);
+	return ((_rfm73_shadow[RFM73_RADR_CONFIG] & CF_PWR_UP_bm) >> CF_PWR_UP_bf);
 }
 /*! \brief This function returns current rf channel of the module.
 
 \return 0-127 - channel number.*/
 uint8_t rfm73_get_channel() {
-	uint8_t res = _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_RF_CH);
-	return (res & 0x7F);
+	return (_rfm73_shadow[RFM73_RADR_RF_CH] & 0x7F);
+}
+
+/*! \brief This function reads all bank0 configuration registers of the module
+to RAM shadow, which is used by all setters and getters of this library. It is
+called by rfm73_init, so it's needed only if module registers were changed
+bypassing this library.*/
+void rfm73_resync() {
+	uint8_t reg, len;
+	for (reg=0; reg<RFM73_SHADOW_SIZE; reg++)
+		if (RFM73_SHADOW_MASK & (1UL << reg))
+			_rfm73_shadow[reg] = _rfm73_read_cmd(RFM73_CMD_R_REGISTER | reg);
+	len = _rfm73_shadow[RFM73_RADR_SETUP_AW] + 2;
+	_rfm73_read_buf(RFM73_CMD_R_REGISTER | RFM73_RADR_RX_ADDR_P0,
+	                _rfm73_shadow_rx_addr_p0, len);
+	_rfm73_read_buf(RFM73_CMD_R_REGISTER | RFM73_RADR_RX_ADDR_P1,
+	                _rfm73_shadow_rx_addr_p1, len);
+	_rfm73_read_buf(RFM73_CMD_R_REGISTER | RFM73_RADR_TX_ADDR,
+	                _rfm73_shadow_tx_addr, len);
+}
+
+/*! \brief Compares multi-byte address register of the module with its RAM
+shadow.
+
+\return 1 if they differ, 0 otherwise.*/
+static uint8_t _rfm73_verify_addr(uint8_t reg, const uint8_t* shadow,
+                                  uint8_t len) {
+	uint8_t i, addr[5];
+	_rfm73_read_buf(RFM73_CMD_R_REGISTER | reg, addr, len);
+	for (i=0; i<len; i++)
+		if (addr[i] != shadow[i]) return 1;
+	return 0;
+}
+
+/*! \brief This function compares bank0 configuration registers of the module
+with RAM shadow. Could be used to detect reset of the module caused by
+power glitch.
+
+\return Number of registers (0 if module configuration is intact) which
+differ from RAM shadow.*/
+uint8_t rfm73_verify() {
+	uint8_t reg, len, res = 0;
+	for (reg=0; reg<RFM73_SHADOW_SIZE; reg++)
+		if (RFM73_SHADOW_MASK & (1UL << reg))
+			if (_rfm73_read_cmd(RFM73_CMD_R_REGISTER | reg) !=
+			    _rfm73_shadow[reg]) res++;
+	len = _rfm73_shadow[RFM73_RADR_SETUP_AW] + 2;
+	res += _rfm73_verify_addr(RFM73_RADR_RX_ADDR_P0, _rfm73_shadow_rx_addr_p0,
+	                          len);
+	res += _rfm73_verify_addr(RFM73_RADR_RX_ADDR_P1, _rfm73_shadow_rx_addr_p1,
+	                          len);
+	res += _rfm73_verify_addr(RFM73_RADR_TX_ADDR, _rfm73_shadow_tx_addr, len);
+	return res;
+}
+
+/*! \brief This function writes RAM shadow back to the module if it differs
+from module registers, e.g. after module was reset. In this case activation
+command and bank1 initialization are repeated too.
+
+\return Number of bank0 registers that differed (0 if nothing was written).*/
+uint8_t rfm73_restore() {
+	uint8_t reg;
+	uint8_t res = rfm73_verify();
+	if (res==0) return 0;
+	RFM73_CE_LOW;
+	_rfm73_activate();
+	_rfm73_init_bank1();
+	_rfm73_toggle_reg_bank(0);
+	// CONFIG is written last, so module is powered up with all settings done
+	for (reg=RFM73_SHADOW_SIZE-1; reg>0; reg--)
+		if (RFM73_SHADOW_MASK & (1UL << reg))
+			_rfm73_write_reg(reg, _rfm73_shadow[reg]);
+	_rfm73_write_addr(RFM73_RADR_RX_ADDR_P0, _rfm73_shadow_rx_addr_p0,
+	                  _rfm73_shadow_rx_addr_p0);
+	_rfm73_write_addr(RFM73_RADR_RX_ADDR_P1, _rfm73_shadow_rx_addr_p1,
+	                  _rfm73_shadow_rx_addr_p1);
+	_rfm73_write_addr(RFM73_RADR_TX_ADDR, _rfm73_shadow_tx_addr,
+	                  _rfm73_shadow_tx_addr);
+	_rfm73_write_reg(RFM73_RADR_CONFIG, _rfm73_shadow[RFM73_RADR_CONFIG]);
+	if (_rfm73_shadow[RFM73_RADR_CONFIG] & CF_PRIM_RX_bm) RFM73_CE_HIGH;
+	return res;
 }
 
 /*! \brief Set the RFM73 module to power up state. Module will go to standby-1
 mode and after that to TX, RX or standby-2 mode depending on current
 configuration.*/
 void rfm73_power_up() {
-	uint8_t conf = _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_CONFIG);
+	uint8_t conf = _rfm73_shadow[RFM73_RADR_CONFIG];
 	// set CF_PWR_UP bit high
 	conf |= CF_PWR_UP_bm;
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_CONFIG, conf);
+	_rfm73_write_reg(RFM73_RADR_CONFIG, conf);
 	// power up delay
-	_delay_ms(3);
+	RFM73_DELAY_MS(RFM73_PWR_UP_MS);
+	_rfm73_set_state(RFM73_STATE_STANDBY, 0);
+}
+
+/*! \brief Powers the module up and returns without waiting. Driver is in
+#RFM73_STATE_POWER_UP state for #RFM73_PWR_UP_MS milliseconds of rfm73_tick,
+then rfm73_poll switches it to #RFM73_STATE_STANDBY (or to RX or TX mode, if
+it was set while settling).*/
+void rfm73_power_up_async() {
+	_rfm73_write_reg(RFM73_RADR_CONFIG,
+	                 _rfm73_shadow[RFM73_RADR_CONFIG] | CF_PWR_UP_bm);
+	_rfm73_state_next = RFM73_STATE_STANDBY;
+	_rfm73_set_state(RFM73_STATE_POWER_UP, RFM73_PWR_UP_MS);
 }
 
 /*! \brief Set the RFM73 module to power down state, minimizing it power
 consumption. Receiver and transmitter are disabled.*/
 void rfm73_power_down() {
-	uint8_t conf = _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_CONFIG);
+	uint8_t conf = _rfm73_shadow[RFM73_RADR_CONFIG];
 	// set CF_PWR_UP bit low
 	conf &=~CF_PWR_UP_bm;
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_CONFIG, conf);
+	_rfm73_write_reg(RFM73_RADR_CONFIG, conf);
+	_rfm73_set_state(RFM73_STATE_OFF, 0);
 }
 
 /*! \brief Masking interrupts, preventing events from affecting IRQ pin of the
@@ -1032,8 +1414,8 @@ RFM73 module.
 				   pin.*/
 void rfm73_mask_int(uint8_t mask_rx_dr, uint8_t mask_tx_ds, 
                     uint8_t mask_max_rt) {
-	// read current state
-	uint8_t c = _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_CONFIG);
+	// take current state from shadow
+	uint8_t c = _rfm73_shadow[RFM73_RADR_CONFIG];
 	// clear mask bits
 	c &=~(CF_MASK_MAX_RT_bm | CF_MASK_RX_DR_bm | CF_MASK_TX_DS_bm);
 	// set appropriate mask bits
@@ -1041,10 +1423,387 @@ void rfm73_mask_int(uint8_t mask_rx_dr, uint8_t mask_tx_ds,
 	      ((mask_tx_ds & 1) << CF_MASK_TX_DS_bf) |
 		  ((mask_max_rt& 1) << CF_MASK_MAX_RT_bf));
 	// write new config
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_CONFIG, c);
+	_rfm73_write_reg(RFM73_RADR_CONFIG, c);
 }
 
-/*! \brief This function is used to get new packet from FIFO buffer.
+/*! \brief Number of slot returned by _rfm73_slot_get when no slot is free.*/
+#define RFM73_NO_SLOT           0xFF
+
+/*! \brief Pool of packet slots. Payloads are read from RX FIFO and written to
+TX FIFO directly from slots, queues keep only slot numbers, so ownership of
+packet is passed between SPI interrupt and application without copying.*/
+static rfm73_packet_t _rfm73_slots[RFM73_SLOTS];
+/*! \brief Bit n is set if slot n is free.*/
+static volatile uint16_t _rfm73_slots_free =
+	(uint16_t)((1UL << RFM73_SLOTS) - 1);
+
+/*! \brief Takes free slot from the pool.
+
+\return Number of slot or #RFM73_NO_SLOT.*/
+static uint8_t _rfm73_slot_get() {
+	uint8_t n = RFM73_NO_SLOT, i;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for (i = 0; i < RFM73_SLOTS; i++)
+			if (_rfm73_slots_free & (1U << i)) {
+				_rfm73_slots_free &= ~(1U << i);
+				n = i;
+				break;
+			}
+	}
+	return n;
+}
+
+/*! \brief Returns slot n to the pool.*/
+static void _rfm73_slot_put(uint8_t n) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		_rfm73_slots_free |= 1U << n;
+	}
+}
+
+/*! \brief This function lends free packet slot to application. Slot is
+filled in place and passed to rfm73_send_slot, or returned by
+rfm73_slot_free. Slots taken by application are not available to RX queue,
+so packets wait in RX FIFO of the module while all slots are lent.
+
+\return Pointer to slot or NULL if no slot is free.*/
+rfm73_packet_t* rfm73_slot_alloc() {
+	uint8_t n = _rfm73_slot_get();
+	return (n == RFM73_NO_SLOT) ? 0 : &_rfm73_slots[n];
+}
+
+/*! \brief This function returns packet slot taken by rfm73_slot_alloc or
+rfm73_rx_take to the pool.
+
+\param slot - pointer to slot.*/
+void rfm73_slot_free(rfm73_packet_t* slot) {
+	_rfm73_slot_put(slot - _rfm73_slots);
+}
+
+/*! \brief Mask of RX queue indexes.*/
+#define RFM73_RXQ_MASK          (RFM73_RXQ_SIZE-1)
+
+/*! \brief Software RX queue (ring buffer) of slot numbers. Indexes below are
+free running, entry is selected by masking them with #RFM73_RXQ_MASK.*/
+static uint8_t _rfm73_rxq[RFM73_RXQ_SIZE];
+/*! \brief Index of the oldest received packet.*/
+static volatile uint8_t _rfm73_rxq_head = 0;
+/*! \brief Index of the entry where next packet is read.*/
+static volatile uint8_t _rfm73_rxq_tail = 0;
+/*! \brief Set while RX FIFO is being drained by SPI interrupt.*/
+static volatile uint8_t _rfm73_rxq_reading = 0;
+/*! \brief Set when queue was full and RX FIFO was left not empty.*/
+static volatile uint8_t _rfm73_rxq_stalled = 0;
+/*! \brief Set when RX FIFO was flushed because of wrong payload width.*/
+static volatile uint8_t _rfm73_rxq_flushed = 0;
+/*! \brief Set when payload couldn't be read because TX FIFO was being
+written, draining is repeated when writing is over.*/
+static volatile uint8_t _rfm73_rxq_retry = 0;
+
+static void _rfm73_rxq_next();
+static void _rfm73_txq_fill();
+
+/*! \brief SPI interrupt: payload is read to RX queue, next one could be
+read.*/
+static void _rfm73_rxq_loaded(uint8_t status) {
+	rfm73_packet_t* e = &_rfm73_slots[_rfm73_rxq[_rfm73_rxq_tail &
+	                                             RFM73_RXQ_MASK]];
+	e->status = status;
+	_rfm73_stat.rx_pipe[e->pipe]++;
+	_rfm73_rxq_tail++;
+	_rfm73_in_event++;
+	if (_rfm73_on_rx_dr) _rfm73_on_rx_dr(status);
+	_rfm73_in_event--;
+	_rfm73_rxq_next();
+}
+
+/*! \brief Ends draining of RX FIFO. SPI is free now, so packets queued
+meanwhile are written to TX FIFO.*/
+static void _rfm73_rxq_end() {
+	_rfm73_rxq_reading = 0;
+	_rfm73_txq_fill();
+}
+
+/*! \brief Reads width and pipe number of the top packet of RX FIFO and
+starts reading its payload to RX queue. Called for every packet until FIFO
+is empty.*/
+static void _rfm73_rxq_next() {
+	uint8_t status, wid, n;
+	rfm73_packet_t* e;
+	// STATUS is shifted out with R_RX_PL_WID command, so one transaction
+	// gives both pipe number and width
+	_rfm73_bus_lock();
+	spi_wait();
+	RFM73_CSN_LOW;
+	status = spi_read(RFM73_CMD_R_RX_PL_WID);
+	wid = spi_read(0);
+	RFM73_CSN_HIGH;
+	_rfm73_bus_unlock();
+
+	if ((status & ST_RX_P_NO_bm) == ST_RX_P_NO_bm) {
+		// FIFO is empty
+		_rfm73_rxq_stalled = 0;
+		_rfm73_rxq_end();
+		return;
+	}
+	if (wid > RFM73_MAX_PACKET_LEN) {
+		// broken packet, the only way to get rid of it is flushing
+		_rfm73_write_cmd(RFM73_CMD_FLUSH_RX, 0);
+		_rfm73_rxq_stalled = 0;
+		_rfm73_rxq_flushed = 1;
+		_rfm73_stat.rx_flushed++;
+		_rfm73_rxq_end();
+		return;
+	}
+	if (((uint8_t)(_rfm73_rxq_tail - _rfm73_rxq_head) >= RFM73_RXQ_SIZE) ||
+	    ((n = _rfm73_slot_get()) == RFM73_NO_SLOT)) {
+		// queue is full or all slots are taken, packets wait in RX FIFO
+		if (!_rfm73_rxq_stalled) _rfm73_stat.rx_stalled++;
+		_rfm73_rxq_stalled = 1;
+		_rfm73_rxq_end();
+		return;
+	}
+	_rfm73_rxq_stalled = 0;
+	_rfm73_rxq[_rfm73_rxq_tail & RFM73_RXQ_MASK] = n;
+	e = &_rfm73_slots[n];
+	e->pipe = (status & ST_RX_P_NO_bm) >> ST_RX_P_NO_bf;
+	e->len = wid;
+	// time and channel of reception are taken here, not when application
+	// gets the packet
+	e->ms = rfm73_millis();
+	e->ch = _rfm73_shadow[RFM73_RADR_RF_CH];
+	// payload is read straight to slot; if SPI engine is busy, reading is
+	// repeated when its transfer is over (flag is set before that transfer
+	// could end)
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (rfm73_read_payload_async(e->data, wid, _rfm73_rxq_loaded)) {
+			_rfm73_slot_put(n);
+			_rfm73_rxq_retry = 1;
+			_rfm73_rxq_reading = 0;
+		}
+	}
+}
+
+/*! \brief Starts draining RX FIFO to RX queue, if it is not being drained
+already. Called from IRQ interrupt on RX_DR event, and from main program if
+IRQ pin is not used.*/
+static void _rfm73_rxq_drain() {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (_rfm73_rxq_reading) return;
+		_rfm73_rxq_reading = 1;
+	}
+	// stalled flag is kept until a packet is moved, so a long stall is
+	// counted once
+	_rfm73_rxq_next();
+}
+
+/*! \brief Moves RX FIFO to RX queue when IRQ pin is not used, or when queue
+was full. Waits until draining is finished, except in RX_DR callback, which
+is called by draining itself.*/
+static void _rfm73_rxq_poll() {
+	if (!_rfm73_irq_on) {
+		// new packets will set RX_DR again
+		_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_STATUS,
+		                 ST_RX_DR_bm);
+		_rfm73_rxq_drain();
+	}
+	else if (_rfm73_rxq_stalled)
+		_rfm73_rxq_drain();
+	if (!_rfm73_in_event)
+		while (_rfm73_rxq_reading) spi_wait();
+}
+
+/*! \brief Takes the oldest packet from RX queue.
+
+\param pkt - packet structure to be filled.
+
+\return 0 if packet was taken, 1 if queue is empty.*/
+static uint8_t _rfm73_rxq_pop(rfm73_packet_t* pkt) {
+	uint8_t i, n;
+	rfm73_packet_t* e;
+	if (_rfm73_rxq_head == _rfm73_rxq_tail) return 1;
+	n = _rfm73_rxq[_rfm73_rxq_head & RFM73_RXQ_MASK];
+	e = &_rfm73_slots[n];
+	pkt->pipe = e->pipe;
+	pkt->len = e->len;
+	pkt->ms = e->ms;
+	pkt->ch = e->ch;
+	pkt->status = e->status;
+	for (i=0; i<e->len; i++)
+		pkt->data[i] = e->data[i];
+	_rfm73_rxq_head++;
+	_rfm73_slot_put(n);
+	return 0;
+}
+
+/*! \brief Takes slot of the oldest packet from RX queue.
+
+\return Pointer to slot or NULL if queue is empty.*/
+static rfm73_packet_t* _rfm73_rxq_take() {
+	rfm73_packet_t* e;
+	if (_rfm73_rxq_head == _rfm73_rxq_tail) return 0;
+	e = &_rfm73_slots[_rfm73_rxq[_rfm73_rxq_head & RFM73_RXQ_MASK]];
+	_rfm73_rxq_head++;
+	return e;
+}
+
+/*! \brief This function takes the oldest packet from software RX queue.
+
+All packets of RX FIFO of the module are moved to RX queue by IRQ interrupt
+on RX_DR event (see rfm73_irq_enable), or by this function if IRQ pin is not
+used. So no packet is lost while RX queue has free space, and the module
+itself keeps up to 3 more packets in its FIFO.
+
+\param pkt - packet structure to be filled.
+
+\return 
+        - 0 - packet is taken;
+        - 1 - no packets received.*/
+uint8_t rfm73_rx_get(rfm73_packet_t* pkt) {
+	if (_rfm73_rxq_head == _rfm73_rxq_tail) _rfm73_rxq_poll();
+	return _rfm73_rxq_pop(pkt);
+}
+
+/*! \brief This function takes up to max packets from software RX queue at
+once (see rfm73_rx_get).
+
+\param pkts - array of packet structures to be filled;
+\param max  - length of pkts array.
+
+\return Number of packets taken.*/
+uint8_t rfm73_rx_get_batch(rfm73_packet_t* pkts, uint8_t max) {
+	uint8_t n = 0;
+	_rfm73_rxq_poll();
+	while ((n < max) &&
+	       !_rfm73_rxq_pop(&pkts[n]))
+		n++;
+	if (_rfm73_rxq_stalled) _rfm73_rxq_poll();
+	return n;
+}
+
+/*! \brief This function returns number of packets in software RX queue. It
+doesn't use SPI.*/
+uint8_t rfm73_rx_available() {
+	return (uint8_t)(_rfm73_rxq_tail - _rfm73_rxq_head);
+}
+
+/*! \brief This function takes the oldest packet from software RX queue
+without copying: slot into which payload was read by SPI interrupt is lent
+to application (see rfm73_rx_get). It must be returned by rfm73_slot_free,
+or sent by rfm73_send_slot.
+
+\return Pointer to slot of the packet or NULL if no packets received.*/
+rfm73_packet_t* rfm73_rx_take() {
+	if (_rfm73_rxq_head == _rfm73_rxq_tail) _rfm73_rxq_poll();
+	return _rfm73_rxq_take();
+}
+
+/*! \brief This function loads payload which receiver (PRX) sends back with
+acknowledge of the next packet received on pipe, so request and response
+take one packet exchange without switching to TX mode. Payloads wait in TX
+FIFO (up to 3 for all pipes) until transmitter sends a packet to their pipe.
+
+\param pipe - number of pipe (0-5);
+\param pbuf - pointer to data;
+\param len  - length of data, mustn't exceed 32.
+
+\return 
+        - 0 - payload is loaded;
+        - 1 - TX FIFO is full, nothing done.*/
+uint8_t rfm73_ack_payload(uint8_t pipe, const uint8_t* pbuf, uint8_t len) {
+	if (len>RFM73_MAX_PACKET_LEN) len = RFM73_MAX_PACKET_LEN;
+	if (_rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_FIFO_STATUS) &
+	    FS_TX_FULL_bm)
+		return 1;
+	_rfm73_write_buf(RFM73_CMD_W_ACK_PAYLOAD | (pipe & 7), (uint8_t*)pbuf,
+	                 len);
+	return 0;
+}
+
+/*! \brief This function drops acknowledge payloads that are not sent yet
+(flushes TX FIFO).*/
+void rfm73_ack_payload_flush() {
+	_rfm73_write_cmd(RFM73_CMD_FLUSH_TX, 0);
+}
+
+/*! \brief This function sends packet with acknowledge and returns payload
+of the acknowledge, loaded by receiver with rfm73_ack_payload. Acknowledge
+payloads are put to RX queue (pipe 0) by the module, so request is not sent
+while RX queue holds packets (they must be taken by rfm73_rx_get first) or TX
+queue holds packets of rfm73_send_async.
+
+\param pbuf - pointer to data;
+\param len  - length of data, mustn't exceed 32;
+\param resp - packet structure to be filled with acknowledge payload.
+
+\return 
+        - #RFM73_TX_DELIVERED - acknowledge with payload received;
+        - #RFM73_TX_NO_PAYLOAD - acknowledge without payload received;
+        - #RFM73_TX_MAX_RT, #RFM73_TX_TIMEOUT, #RFM73_TX_NO_SLOT - see
+          rfm73_send_packet;
+        - #RFM73_TX_PENDING - RX or TX queue is not empty, nothing is sent.*/
+uint8_t rfm73_send_request(const uint8_t* pbuf, uint8_t len,
+                           rfm73_packet_t* resp) {
+	uint8_t res;
+	// packets received before the request are not dropped silently
+	_rfm73_rxq_poll();
+	if (rfm73_rx_available() || rfm73_send_queued()) return RFM73_TX_PENDING;
+	res = rfm73_send_packet(RFM73_TX_WITH_ACK, (uint8_t*)pbuf, len);
+	if (res != RFM73_TX_DELIVERED) return res;
+	return rfm73_rx_get(resp) ? RFM73_TX_NO_PAYLOAD : RFM73_TX_DELIVERED;
+}
+
+/*! \brief Switches module back to RX mode without flushing RX FIFO.*/
+static void _rfm73_rx_resume() {
+	RFM73_CE_LOW;
+	_rfm73_write_reg(RFM73_RADR_CONFIG,
+	                 _rfm73_shadow[RFM73_RADR_CONFIG] | CF_PRIM_RX_bm);
+	RFM73_CE_HIGH;
+	_rfm73_set_lock_state(RFM73_STATE_RX_LOCK);
+}
+
+/*! \brief This function is used to get new packet from software RX queue
+without copying (see rfm73_rx_take): slot of the packet is lent to
+application and must be returned by rfm73_slot_free. Otherwise it works as
+rfm73_receive_packet.
+
+\param type - #RFM73_RX_WITH_ACK if explicit acknowledge of the packet is
+              needed;
+			  #RFM73_RX_WITH_NOACK to only take packet.
+\param slot - returned pointer to slot of the packet (NULL if result is not
+              0).
+
+\return 
+        - 0 - if received data is correct;
+        - 1 - if #RFM73_MAX_PACKET_LEN is exceeded, input FIFO buffer is 
+		      flushed;
+	    - 2 - if no packet is received.*/
+uint8_t rfm73_receive_slot(uint8_t type, rfm73_packet_t** slot) {
+	*slot = 0;
+	if (_rfm73_rxq_head == _rfm73_rxq_tail) _rfm73_rxq_poll();
+	if (_rfm73_rxq_flushed) {
+		_rfm73_rxq_flushed = 0;
+		// return "data was flushed"
+		return 1;
+	}
+	if (!(*slot = _rfm73_rxq_take())) {
+		// return "no data received"
+		return 2;
+	}
+	if (_rfm73_rxq_stalled) _rfm73_rxq_poll();
+
+	if (type == RFM73_RX_WITH_ACK) {
+		GREEN_LED_SET;
+		rfm73_send_packet(RFM73_TX_WITH_NOACK, (*slot)->data, (*slot)->len);
+		GREEN_LED_CLR;
+		// switch back to RX mode, packets in RX FIFO are kept
+		_rfm73_rx_resume();
+	}
+	// return "some data received"
+	return 0;
+}
+
+/*! \brief This function is used to get new packet from software RX queue
+(see rfm73_rx_get).
 
 \param type - #RFM73_RX_WITH_ACK if explicit acknowledge of the packet is
               needed;
@@ -1057,62 +1816,409 @@ void rfm73_mask_int(uint8_t mask_rx_dr, uint8_t mask_tx_ds,
         - 0 - if received data is correct;
         - 1 - if #RFM73_MAX_PACKET_LEN is exceeded, input FIFO buffer is 
 		      flushed, data_buf unchanged;
-	    - 2 - if flag RX_DR (receive data ready) doesn't raised.
-		
-\warning Possible hangouts in certain conditions.*/
+	    - 2 - if no packet is received.*/
 uint8_t rfm73_receive_packet(uint8_t type, uint8_t* data_buf, uint8_t* len) {
-	uint8_t sta,fifo_sta;
-	uint8_t result = 0;
-	
-	// read register STATUS's value
-	sta=_rfm73_read_cmd(RFM73_CMD_R_REGISTER|RFM73_RADR_STATUS);
-	
-	// if receive data ready (RX_DR) interrupt
-	if(sta & ST_RX_DR_bm) {
-		do {
-			// read len
-			*len=_rfm73_read_cmd(RFM73_CMD_R_RX_PL_WID);	
-
-			if(*len<=RFM73_MAX_PACKET_LEN) {
-				// read receive payload from RX_FIFO buffer
-				_rfm73_read_buf(RFM73_CMD_R_RX_PAYLOAD, data_buf, *len);
-				// return "some data received"
-				result = 0;
-			}
-			else {
-				//flush Rx
-				*len = 0;
-				_rfm73_write_cmd(RFM73_CMD_FLUSH_RX,0);
-				// return "data was flushed"
-				result = 1;
-			}
-			// read register FIFO_STATUS's value
-			fifo_sta=_rfm73_read_cmd(RFM73_CMD_R_REGISTER | 
-			                         RFM73_RADR_FIFO_STATUS);			
-		} while ((fifo_sta&FS_RX_EMPTY_bm)==0); //while not empty
-		
-		GREEN_LED_SET;
-		if (type == RFM73_RX_WITH_ACK) {
-			rfm73_send_packet(RFM73_CMD_W_TX_PAYLOAD_NOACK, data_buf, *len);
+	uint8_t i, res;
+	rfm73_packet_t* e;
+	res = rfm73_receive_slot(type, &e);
+	if (res == 1) *len = 0;
+	if (res) return res;
+	*len = e->len;
+	for (i=0; i<e->len; i++)
+		data_buf[i] = e->data[i];
+	rfm73_slot_free(e);
+	return 0;
+}
+
+/*! \brief Entry of the software TX queue.*/
+typedef struct {
+	/*! \brief #RFM73_TX_WITH_ACK or #RFM73_TX_WITH_NOACK.*/
+	uint8_t type;
+	/*! \brief Number of slot with the packet.*/
+	uint8_t slot;
+} _rfm73_txq_entry_t;
+
+/*! \brief Mask of TX queue indexes.*/
+#define RFM73_TXQ_MASK          (RFM73_TXQ_SIZE-1)
+/*! \brief Number of packets kept in TX FIFO of the module (it holds 3).
+FIFO_STATUS tells only whether TX FIFO is empty or full, so with two packets
+loaded number of packets sent by merged TX_DS events is known: one if FIFO
+is not empty, both if it is. With three loaded FIFO which is neither empty
+nor full could have sent one or two of them, so the third place is left
+free; the second packet is already waiting while the first one is in the
+air, so there is no gap between packets anyway.*/
+#define RFM73_TX_FIFO_LOAD      2
+
+/*! \brief Software TX queue (ring buffer). Indexes below are free running,
+entry is selected by masking them with #RFM73_TXQ_MASK.*/
+static _rfm73_txq_entry_t _rfm73_txq[RFM73_TXQ_SIZE];
+/*! \brief Index of the oldest packet which is not finished yet.*/
+static volatile uint8_t _rfm73_txq_head = 0;
+/*! \brief Index of the next packet to be written to TX FIFO.*/
+static volatile uint8_t _rfm73_txq_load = 0;
+/*! \brief Index of the next free entry.*/
+static volatile uint8_t _rfm73_txq_tail = 0;
+/*! \brief Number of packets written to TX FIFO and not finished yet.*/
+static volatile uint8_t _rfm73_txq_fifo = 0;
+/*! \brief Set while payload is being written by SPI interrupt.*/
+static volatile uint8_t _rfm73_txq_loading = 0;
+/*! \brief Result of the last finished packet.*/
+static volatile uint8_t _rfm73_tx_result = RFM73_TX_DELIVERED;
+/*! \brief Milliseconds left until timeout of the oldest packet.*/
+static volatile uint16_t _rfm73_tx_timer = 0;
+/*! \brief Milliseconds counted by rfm73_tick.*/
+static volatile uint16_t _rfm73_ms = 0;
+/*! \brief Set by rfm73_tick when timeout expired.*/
+static volatile uint8_t _rfm73_tx_expired = 0;
+/*! \brief Function called when a packet is finished.*/
+static void (*_rfm73_tx_cb)(uint8_t result) = 0;
+
+static void _rfm73_txq_fill();
+static void _rfm73_txq_put(uint8_t type, uint8_t n);
+
+/*! \brief SPI interrupt: payload is written to TX FIFO, next one could be
+written.*/
+static void _rfm73_txq_loaded(uint8_t status) {
+	// STATUS of payload write is not needed
+	(void)status;
+	_rfm73_txq_load++;
+	_rfm73_txq_fifo++;
+	_rfm73_txq_loading = 0;
+	// RX FIFO waits for this transfer, draining fills TX FIFO when it is over
+	if (_rfm73_rxq_retry) {
+		_rfm73_rxq_retry = 0;
+		_rfm73_rxq_drain();
+	}
+	else
+		_rfm73_txq_fill();
+}
+
+/*! \brief Writes next queued packet to TX FIFO if FIFO has free space. Writing
+is done by SPI interrupt, which calls this function again, so FIFO is filled
+up without waiting.*/
+static void _rfm73_txq_fill() {
+	_rfm73_txq_entry_t* e;
+	rfm73_packet_t* p;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// event handler fills FIFO when it is over
+		if (_rfm73_in_event || _rfm73_txq_loading ||
+		    (_rfm73_txq_load == _rfm73_txq_tail) ||
+		    (_rfm73_txq_fifo >= RFM73_TX_FIFO_LOAD))
+			return;
+		_rfm73_txq_loading = 1;
+	}
+	e = &_rfm73_txq[_rfm73_txq_load & RFM73_TXQ_MASK];
+	p = &_rfm73_slots[e->slot];
+	// payload is written straight from slot; if SPI engine is busy (RX FIFO
+	// is being drained), writing is repeated when draining is over (flag is
+	// cleared before draining could end)
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (rfm73_write_payload_async(e->type, p->data, p->len,
+		                              _rfm73_txq_loaded))
+			_rfm73_txq_loading = 0;
+	}
+}
+
+/*! \brief Finishes the oldest packet with specified result.*/
+static void _rfm73_txq_done(uint8_t result) {
+	if (result != RFM73_TX_TIMEOUT)
+		_rfm73_stat.tx_sent++;
+	if (result != RFM73_TX_DELIVERED)
+		_rfm73_stat.tx_failed++;
+	else if (_rfm73_txq[_rfm73_txq_head & RFM73_TXQ_MASK].type ==
+	         RFM73_TX_WITH_ACK) {
+		_rfm73_stat.tx_acked++;
+		// retransmit counter is reset when the next packet starts, so it
+		// belongs to this one only if nothing else is in TX FIFO (nothing
+		// is written there while event is handled)
+		if (_rfm73_txq_fifo == 0)
+			_rfm73_stat.tx_retries[_rfm73_read_cmd(RFM73_CMD_R_REGISTER |
+			                       RFM73_RADR_OBSERVE_TX) & 0x0F]++;
+		else
+			_rfm73_stat.tx_retries_unknown++;
+	}
+	_rfm73_slot_put(_rfm73_txq[_rfm73_txq_head & RFM73_TXQ_MASK].slot);
+	_rfm73_txq_head++;
+	_rfm73_tx_result = result;
+	_rfm73_tx_timer = RFM73_TX_TIMEOUT_MS;
+	if (_rfm73_txq_head == _rfm73_txq_tail) RED_LED_CLR;
+	if (_rfm73_tx_cb) _rfm73_tx_cb(result);
+}
+
+/*! \brief Drops everything written to TX FIFO: the oldest packet is finished
+with specified result, the rest are written again.*/
+static void _rfm73_txq_fail(uint8_t result) {
+	// keep IRQ handler away until queue indexes are consistent
+	_rfm73_bus_lock();
+	_rfm73_write_cmd(RFM73_CMD_FLUSH_TX, 0);
+	_rfm73_txq_fifo = 0;
+	_rfm73_txq_load = _rfm73_txq_head + 1;
+	_rfm73_bus_unlock();
+	_rfm73_txq_done(result);
+}
+
+/*! \brief Handles TX_DS and MAX_RT flags of STATUS register value. Called
+from IRQ interrupt or from rfm73_send_status with SPI bus taken, while TX
+FIFO writing is put off (see #_rfm73_in_event).*/
+static void _rfm73_tx_event(uint8_t status) {
+	uint8_t n;
+	if ((status & ST_TX_DS_bm) && _rfm73_txq_fifo) {
+		// TX_DS events merge if IRQ is handled late or polled, so both
+		// loaded packets could be sent since flags were cleared
+		n = 1;
+		if ((_rfm73_txq_fifo > 1) &&
+		    (_rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_FIFO_STATUS) &
+		     FS_TX_EMPTY_bm)) {
+			n = _rfm73_txq_fifo;
+			// the last one could be sent after flags were cleared, its TX_DS
+			// is counted here and must not finish the next packet; nothing
+			// is in the air and nothing is written to TX FIFO until this
+			// event is handled, so the flag can't belong to other packet
+			_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_STATUS,
+			                 ST_TX_DS_bm);
+		}
+		while (n--) {
+			_rfm73_txq_fifo--;
+			_rfm73_txq_done(RFM73_TX_DELIVERED);
 		}
-		GREEN_LED_CLR;
-		//switch to RX mode
-		rfm73_rx_mode();
 	}
-	else {
-		// return "no data received"
-		result = 2;
+	if ((status & ST_MAX_RT_bm) && _rfm73_txq_fifo)
+		_rfm73_txq_fail(RFM73_TX_MAX_RT);
+}
+
+/*! \brief This function puts a packet to software TX queue and returns at
+once. Payload is copied, so pbuf could be reused at once. Module is switched
+to TX mode if it is not in it, and it stays there while queue is not empty:
+queued packets are written to TX FIFO of the module whenever it has free
+space, so packets are sent back-to-back (two of them are kept in TX FIFO,
+see #RFM73_TX_FIFO_LOAD).
+
+Each packet is finished when acknowledge is received (or it is sent, if no
+acknowledge is requested) (#RFM73_TX_DELIVERED), after all retransmits
+(#RFM73_TX_MAX_RT) or, if rfm73_tick is called, after #RFM73_TX_TIMEOUT_MS
+milliseconds without progress (#RFM73_TX_TIMEOUT), e.g. when module is
+powered down. Result is passed to the function set by rfm73_send_callback,
+result of the last packet is also returned by rfm73_send_status.
+
+rfm73_rx_mode must not be called while queue is not empty.
+
+\param type - #RFM73_TX_WITH_ACK send package with auto-acknowledge;
+              #RFM73_TX_WITH_NOACK - send package without autoacknowledge;
+\param pbuf - pointer to RAM-buffer to be sent;
+\param len  - length of data to be sent. Mustn't exceed 32 (FIFO buffer
+              length).
+
+\return 
+        - 0 - packet is queued;
+        - 1 - queue is full (#RFM73_TXQ_SIZE packets) or no slot is free,
+              nothing done.*/
+uint8_t rfm73_send_async(uint8_t type, const uint8_t* pbuf, uint8_t len) {
+	uint8_t i, n;
+	rfm73_packet_t* p;
+	if ((uint8_t)(_rfm73_txq_tail - _rfm73_txq_head) >= RFM73_TXQ_SIZE)
+		return 1;
+	n = _rfm73_slot_get();
+	if (n == RFM73_NO_SLOT) return 1;
+	if (len>RFM73_MAX_PACKET_LEN) len = RFM73_MAX_PACKET_LEN;
+	p = &_rfm73_slots[n];
+	p->len = len;
+	for (i=0; i<len; i++)
+		p->data[i] = pbuf[i];
+	_rfm73_txq_put(type, n);
+	return 0;
+}
+
+/*! \brief This function puts packet slot to software TX queue without
+copying (see rfm73_send_async): payload is written to TX FIFO straight from
+the slot, and slot returns to the pool when packet is finished. Slot is
+taken by rfm73_slot_alloc or rfm73_rx_take (e.g. to send received packet
+further), it mustn't be used by application after this call.
+
+\param type - #RFM73_TX_WITH_ACK or #RFM73_TX_WITH_NOACK;
+\param slot - slot with payload and its length.
+
+\return 
+        - 0 - packet is queued;
+        - 1 - queue is full (#RFM73_TXQ_SIZE packets), slot is still owned
+              by application.*/
+uint8_t rfm73_send_slot(uint8_t type, rfm73_packet_t* slot) {
+	if ((uint8_t)(_rfm73_txq_tail - _rfm73_txq_head) >= RFM73_TXQ_SIZE)
+		return 1;
+	if (slot->len>RFM73_MAX_PACKET_LEN) slot->len = RFM73_MAX_PACKET_LEN;
+	_rfm73_txq_put(type, slot - _rfm73_slots);
+	return 0;
+}
+
+/*! \brief Puts slot n to the tail of software TX queue, which has free
+entry, and starts sending if queue was empty.*/
+static void _rfm73_txq_put(uint8_t type, uint8_t n) {
+	_rfm73_txq_entry_t* e = &_rfm73_txq[_rfm73_txq_tail & RFM73_TXQ_MASK];
+	e->type = type;
+	e->slot = n;
+	if (_rfm73_txq_head == _rfm73_txq_tail) {
+		// queue was empty: switch to tx mode if module is not in it,
+		// this also flushes TX FIFO
+		if ((_rfm73_shadow[RFM73_RADR_CONFIG] & CF_PRIM_RX_bm) ||
+		    !RFM73_CE_IS_HIGH) {
+			rfm73_tx_mode();
+			_rfm73_txq_fifo = 0;
+		}
+		// clear flags of previous packets
+		_rfm73_clear_status();
+		_rfm73_tx_timer = RFM73_TX_TIMEOUT_MS;
+		RED_LED_SET;
 	}
+	_rfm73_txq_tail++;
+	_rfm73_txq_fill();
+}
 
-	// clear RX_DR or TX_DS or MAX_RT interrupt flag
-	_rfm73_write_cmd(RFM73_CMD_W_REGISTER|RFM73_RADR_STATUS,sta);
-	
-	return result;
+/*! \brief Finishes the oldest packet with timeout result and restarts
+transmission of the others.*/
+static void _rfm73_txq_timeout() {
+	// keep IRQ handler away until transmission is restarted
+	_rfm73_bus_lock();
+	RFM73_CE_LOW;
+	_rfm73_txq_fail(RFM73_TX_TIMEOUT);
+	if (_rfm73_txq_head != _rfm73_txq_tail) {
+		RFM73_CE_HIGH;
+		_rfm73_txq_fill();
+	}
+	_rfm73_bus_unlock();
 }
 
-/*! \brief This function fill up transmit buffer and sends data.
+/*! \brief This function returns state of asynchronous sending and keeps TX
+FIFO filled. If IRQ pin is not used (see rfm73_irq_enable) it reads STATUS
+register to check whether packets are sent, so it should be called
+frequently. Timeouts are handled by rfm73_tick, or by this function if SPI
+bus was taken at that tick.
 
-Data is sent only if FIFO buffer is empty.
+\return 
+        - #RFM73_TX_BUSY - some packets are being sent;
+        - #RFM73_TX_DELIVERED - last packet sent successfully (acknowledge
+          received if enabled);
+        - #RFM73_TX_MAX_RT - no reply from receiver after all retransmits;
+        - #RFM73_TX_TIMEOUT - sending took more than #RFM73_TX_TIMEOUT_MS.*/
+uint8_t rfm73_send_status() {
+	uint8_t expired;
+	// rfm73_tick may handle timeout itself
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		expired = _rfm73_tx_expired;
+		_rfm73_tx_expired = 0;
+	}
+	if (expired)
+		_rfm73_txq_timeout();
+	if ((_rfm73_txq_head != _rfm73_txq_tail) && !_rfm73_irq_on) {
+		_rfm73_bus_lock();
+		_rfm73_in_event++;
+		_rfm73_tx_event(_rfm73_clear_status());
+		_rfm73_in_event--;
+		_rfm73_bus_unlock();
+	}
+	if (_rfm73_txq_head != _rfm73_txq_tail) {
+		_rfm73_txq_fill();
+		return RFM73_TX_BUSY;
+	}
+	return _rfm73_tx_result;
+}
+
+/*! \brief This function returns number of packets in software TX queue
+which are not finished yet.*/
+uint8_t rfm73_send_queued() {
+	return (uint8_t)(_rfm73_txq_tail - _rfm73_txq_head);
+}
+
+/*! \brief This function sets function that is called when a packet from TX
+queue is finished.
+
+\param done - function called with result of the packet (see
+              rfm73_send_status) as argument. It is called from IRQ interrupt,
+              from rfm73_tick or from rfm73_send_status (may be NULL).*/
+void rfm73_send_callback(void (*done)(uint8_t result)) {
+	_rfm73_tx_cb = done;
+}
+
+/*! \brief Time base of the library. This function must be called every
+millisecond (e.g. from timer interrupt) to get timeouts of asynchronous
+operations. It uses SPI only to finish timed out packet (see
+rfm73_send_async), and only if SPI bus is free at that moment: otherwise
+timeout is handled at the next call or by rfm73_send_status.*/
+void rfm73_tick() {
+	_rfm73_ms++;
+	if (_rfm73_txq_head != _rfm73_txq_tail)
+		_rfm73_stat.tx_ms++;
+	else if ((_rfm73_shadow[RFM73_RADR_CONFIG] & CF_PRIM_RX_bm) &&
+	         RFM73_CE_IS_HIGH)
+		_rfm73_stat.rx_ms++;
+	if (_rfm73_state_timer) _rfm73_state_timer--;
+	if ((_rfm73_txq_head != _rfm73_txq_tail) && _rfm73_tx_timer) {
+		if (--_rfm73_tx_timer == 0) {
+			// stop transmission, so nothing changes until timeout is handled
+			RFM73_CE_LOW;
+			_rfm73_tx_expired = 1;
+		}
+	}
+	// bus is taken by main program or by interrupt-driven transfer, or an
+	// event is being handled: SPI can't be used from here
+	if (_rfm73_tx_expired && (_rfm73_bus_cnt == 0) && !_rfm73_in_event) {
+		_rfm73_tx_expired = 0;
+		_rfm73_txq_timeout();
+	}
+}
+
+/*! \brief This function returns milliseconds counted by rfm73_tick (overflows
+every 65.5 s).*/
+uint16_t rfm73_millis() {
+	uint16_t ms;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ms = _rfm73_ms;
+	}
+	return ms;
+}
+
+/*! \brief This function copies counters of the link at one moment (with
+interrupts disabled) and optionally clears them in the same moment, so no
+event is lost between copying and clearing. It doesn't use SPI.
+
+\param st    - structure to be filled;
+\param reset - 1 to clear counters after copying, 0 to keep them.*/
+void rfm73_stats(rfm73_stats_t* st, uint8_t reset) {
+	uint8_t i;
+	uint8_t* p = (uint8_t*)&_rfm73_stat;
+	uint8_t* d = (uint8_t*)st;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for (i = 0; i < sizeof(rfm73_stats_t); i++) {
+			d[i] = p[i];
+			if (reset) p[i] = 0;
+		}
+	}
+}
+
+/*! \brief Waits until software TX queue is empty in 100 us steps, so timeout
+doesn't depend on rfm73_tick.
+
+\return Result of the last packet (see rfm73_send_status).*/
+static uint8_t _rfm73_tx_wait() {
+	uint16_t t = RFM73_TX_TIMEOUT_MS * 10;
+	uint8_t head = _rfm73_txq_head;
+	uint8_t result;
+	while ((result = rfm73_send_status()) == RFM73_TX_BUSY) {
+		RFM73_DELAY_US(100);
+		// timeout is counted from the last finished packet
+		if (head != _rfm73_txq_head) {
+			head = _rfm73_txq_head;
+			t = RFM73_TX_TIMEOUT_MS * 10;
+		}
+		if (--t == 0) {
+			_rfm73_txq_timeout();
+			t = RFM73_TX_TIMEOUT_MS * 10;
+		}
+	}
+	return result;
+}
+
+/*! \brief This function fill up transmit buffer and sends data. It is
+blocking version of rfm73_send_async: it waits until TX queue is empty,
+queues new packet and waits for its result.
 
 \param type - #RFM73_TX_WITH_ACK send package with auto-acknowledge, guarantee
               delivery status;
@@ -1123,40 +2229,65 @@ Data is sent only if FIFO buffer is empty.
 
 \return 
         - 0 - data sent successfully (acknowledge received if enabled);
-        - 1 - no reply from receiver (delivery probably failed).
-
-\warning Potential hang if acknowledge is used. It happens when RFM73 in
-"power down" mode.*/
+        - 1 - no reply from receiver (delivery probably failed);
+        - 2 - no result in #RFM73_TX_TIMEOUT_MS milliseconds (e.g. module
+              is powered down);
+        - #RFM73_TX_NO_SLOT - no packet slot is free, nothing is sent.*/
 uint8_t rfm73_send_packet(uint8_t type, uint8_t* pbuf, uint8_t len) {
-	uint8_t fifo_sta, result = 0;
-	uint8_t stat;
-	
-	//switch to tx mode
-	rfm73_tx_mode();
-	_delay_us(200);
-	// read register FIFO_STATUS's value
-	fifo_sta=_rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_FIFO_STATUS);
-	//if not full, send data (write buff)
-	if((fifo_sta&FS_TX_FULL_bm)==0) {
-	  	RED_LED_SET;
-		// Writes data to buffer
-		if (type==RFM73_TX_WITH_ACK) {
-			_rfm73_write_buf(RFM73_CMD_W_TX_PAYLOAD, pbuf, len);
-			// wait for MAX_RT or TX_DS flags
-			do {
-				stat = _rfm73_read_cmd(RFM73_CMD_R_REGISTER |
-				                       RFM73_RADR_STATUS);
-			} while (!(stat & (ST_MAX_RT_bm | ST_TX_DS_bm)));
-			// error "no reply"
-			if (stat & ST_MAX_RT_bm) result = 1;
-		}		
-		else {
-			_rfm73_write_buf(RFM73_CMD_W_TX_PAYLOAD_NOACK, pbuf, len);
-		}		
-		RED_LED_CLR;
-	}
-	
-	return result;
+	// wait for the end of previous sending
+	_rfm73_tx_wait();
+	// queue is empty, so only slots could be missing; status of the
+	// previous packet mustn't be returned for this one
+	if (rfm73_send_async(type, pbuf, len)) return RFM73_TX_NO_SLOT;
+	return _rfm73_tx_wait();
+}
+
+/*! \brief This function starts writing of payload to TX FIFO and returns
+without waiting for SPI transfer to finish. Transmission itself starts as
+soon as payload is written and module is in TX mode.
+
+\param type - #RFM73_TX_WITH_ACK or #RFM73_TX_WITH_NOACK;
+\param pbuf - pointer to RAM-buffer to be sent. Buffer must not be changed
+              until done is called;
+\param len  - length of data to be sent. Mustn't exceed 32;
+\param done - function called from SPI interrupt when payload is written,
+              its argument is STATUS register value (may be NULL).
+
+\return 
+        - 0 - transfer started;
+        - 1 - previous interrupt-driven transfer is still running.*/
+uint8_t rfm73_write_payload_async(uint8_t type, const uint8_t* pbuf,
+                                  uint8_t len, void (*done)(uint8_t status)) {
+	if (len>RFM73_MAX_PACKET_LEN) len = RFM73_MAX_PACKET_LEN;
+	return _rfm73_xfer_buf((type==RFM73_TX_WITH_ACK) ?
+	                       RFM73_CMD_W_TX_PAYLOAD : RFM73_CMD_W_TX_PAYLOAD_NOACK,
+	                       pbuf, 0, len, done);
+}
+
+/*! \brief This function starts reading of the top payload of RX FIFO and
+returns without waiting for SPI transfer to finish.
+
+\param data_buf - pointer to start of the input buffer, it is filled when
+                  done is called;
+\param len  - length of the payload (e.g. returned by R_RX_PL_WID command),
+              mustn't exceed 32;
+\param done - function called from SPI interrupt when payload is read, its
+              argument is STATUS register value (may be NULL).
+
+\return 
+        - 0 - transfer started;
+        - 1 - previous interrupt-driven transfer is still running.*/
+uint8_t rfm73_read_payload_async(uint8_t* data_buf, uint8_t len,
+                                 void (*done)(uint8_t status)) {
+	if (len>RFM73_MAX_PACKET_LEN) len = RFM73_MAX_PACKET_LEN;
+	return _rfm73_xfer_buf(RFM73_CMD_R_RX_PAYLOAD, 0, data_buf, len, done);
+}
+
+/*! \brief This function returns state of interrupt-driven payload transfer.
+
+\return 1 if transfer is in progress, 0 otherwise.*/
+uint8_t rfm73_xfer_busy() {
+	return spi_busy();
 }
 
 /*! \brief This function returns some parameters used to observe quality of 
@@ -1181,6 +2312,14 @@ uint8_t rfm73_observe(uint8_t* packet_lost, uint8_t* retrans_count) {
 	return 0;
 }
 
+/*! \brief This function reads STATUS register of the module (RX_DR, TX_DS,
+MAX_RT flags, pipe of the packet at the head of RX FIFO and TX_FULL).
+
+\return STATUS register value.*/
+uint8_t rfm73_status() {
+	return _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_STATUS);
+}
+
 /*! \brief This function returns "carrier detect" status bit.
 
 \return 1 if rf carrier is detected;
@@ -1193,42 +2332,345 @@ uint8_t rfm73_carrier_detect() {
 	return (res & 1);
 }
 
+/*! \brief This function makes survey of air: every channel from 0 to 127 is
+listened in RX mode and its "carrier detect" bit is sampled samples times
+every #RFM73_SURVEY_PERIOD_US. Channel, CONFIG register, CE line and driver
+state are restored after the survey. Packets received during it are put to
+RX queue.
+
+Survey changes channel and mode, so it is refused while packets are in TX
+queue (see rfm73_send_async) or module is not powered up and settled (see
+rfm73_poll).
+
+Survey takes about 128*(#RFM73_SURVEY_SETTLE_US +
+samples*#RFM73_SURVEY_PERIOD_US) microseconds, e.g. 0.8 s for 50 samples.
+
+\param hist - histogram of #RFM73_SURVEY_CHANNELS bytes, number of samples
+              with carrier detected is written for every channel;
+\param samples - number of samples per channel (1-255).
+
+\return 
+        - 0 - survey is done;
+        - 1 - TX queue is not empty or driver is not ready, nothing done.*/
+uint8_t rfm73_survey(uint8_t* hist, uint8_t samples) {
+	uint8_t ch, i, n;
+	uint8_t old_ch = _rfm73_shadow[RFM73_RADR_RF_CH];
+	uint8_t old_cfg = _rfm73_shadow[RFM73_RADR_CONFIG];
+	uint8_t old_ce = RFM73_CE_IS_HIGH ? 1 : 0;
+	if ((_rfm73_txq_head != _rfm73_txq_tail) ||
+	    (_rfm73_state == RFM73_STATE_OFF) ||
+	    (_rfm73_state == RFM73_STATE_POR) ||
+	    (_rfm73_state == RFM73_STATE_POWER_UP))
+		return 1;
+	_rfm73_rx_resume();
+	for (ch = 0; ch < RFM73_SURVEY_CHANNELS; ch++) {
+		rfm73_set_channel(ch);
+		// PLL settling and first CD window
+		RFM73_DELAY_US(RFM73_SURVEY_SETTLE_US);
+		n = 0;
+		for (i = 0; i < samples; i++) {
+			n += rfm73_carrier_detect();
+			RFM73_DELAY_US(RFM73_SURVEY_PERIOD_US);
+		}
+		hist[ch] = n;
+	}
+	RFM73_CE_LOW;
+	rfm73_set_channel(old_ch);
+	_rfm73_write_reg(RFM73_RADR_CONFIG, old_cfg);
+	if (old_ce) {
+		RFM73_CE_HIGH;
+		// PLL locks to restored channel
+		_rfm73_set_lock_state((old_cfg & CF_PRIM_RX_bm) ?
+		                      RFM73_STATE_RX_LOCK : RFM73_STATE_TX_LOCK);
+	}
+	else
+		_rfm73_set_state(RFM73_STATE_STANDBY, 0);
+	return 0;
+}
+
+/*! \brief This function starts dispatching of module events from IRQ pin.
+External interrupt handler reads STATUS register once, clears its flags and
+calls registered function of each event. All events are reflected on IRQ pin
+(see rfm73_mask_int), because library handles them itself: RX_DR moves
+received packets to RX queue (see rfm73_rx_get), TX_DS and MAX_RT finish
+asynchronous sending (see rfm73_send_async).
+
+Functions are called from interrupt, so they should be short. They may use
+SPI functions of this library, e.g. to read STATUS register or take packets
+by rfm73_rx_get: interrupt-driven transfers of the library are not started
+while they run. Packets queued by them (see rfm73_send_async) are written to
+TX FIFO when event is handled, so they must not wait for results of packets,
+e.g. by rfm73_send_packet.
+
+\param rx_dr  - function called when new packet is put to RX queue (may be
+                NULL);
+\param tx_ds  - function called when packet is sent (acknowledge received if
+                enabled) (may be NULL);
+\param max_rt - function called when maximum number of retransmits is
+                reached (may be NULL). TX FIFO is not flushed.*/
+void rfm73_irq_enable(rfm73_event_cb_t rx_dr, rfm73_event_cb_t tx_ds,
+                      rfm73_event_cb_t max_rt) {
+	_rfm73_on_rx_dr = rx_dr;
+	_rfm73_on_tx_ds = tx_ds;
+	_rfm73_on_max_rt = max_rt;
+	rfm73_mask_int(0, 0, 0);
+	RFM73_IRQ_PIN_INIT;
+	RFM73_IRQ_INT_INIT;
+	_rfm73_irq_on = 1;
+	// enable interrupt if nobody uses the bus
+	_rfm73_bus_lock();
+	_rfm73_bus_unlock();
+}
+
+/*! \brief This function stops dispatching of module events from IRQ pin.
+Event masks in CONFIG register are left unchanged.*/
+void rfm73_irq_disable() {
+	_rfm73_irq_on = 0;
+	RFM73_IRQ_INT_DISABLE;
+}
+
+/*! \brief IRQ pin interrupt handler: reads and clears STATUS flags and calls
+registered functions. Interrupt is enabled only while SPI bus is free. It is
+called from IRQ pin ISR on target and from simulator on host.*/
+void rfm73_irq_handler() {
+	uint8_t status;
+	_rfm73_in_event++;
+	status = _rfm73_clear_status();
+	_rfm73_tx_event(status);
+	// SPI is free until the end of event handling, so callbacks can use it
+	if ((status & ST_TX_DS_bm) && _rfm73_on_tx_ds)
+		_rfm73_on_tx_ds(status);
+	if ((status & ST_MAX_RT_bm) && _rfm73_on_max_rt)
+		_rfm73_on_max_rt(status);
+	_rfm73_in_event--;
+	// interrupt can't wait for SPI, so RX FIFO is drained first and TX FIFO
+	// is filled when draining is over; packets are passed to rx_dr function
+	// when they are in RX queue
+	if (status & ST_RX_DR_bm)
+		_rfm73_rxq_drain();
+	else
+		_rfm73_txq_fill();
+}
+
+/* IRQ pin interrupt of target */
+RFM73_IRQ_ISR
+
+/*! \brief State of the scan (see rfm73_scan_start).*/
+static rfm73_scan_t _rfm73_scan;
+/*! \brief Flags of the scan.*/
+static uint8_t _rfm73_scan_flags;
+/*! \brief Channel and data rate the scan starts from.*/
+static uint8_t _rfm73_scan_ch0, _rfm73_scan_dr0;
+/*! \brief Step of outward walk: 0, +1, -1, +2, -2... from start channel.*/
+static uint8_t _rfm73_scan_k;
+/*! \brief Index of data rate probed at current channel (0-2).*/
+static uint8_t _rfm73_scan_j;
+/*! \brief SETUP_RETR value before the scan.*/
+static uint8_t _rfm73_scan_retr;
+/*! \brief Time of the scan start (see rfm73_millis).*/
+static uint16_t _rfm73_scan_t0;
+/*! \brief Last channel and data rate where receiver was found, kept in
+non-volatile memory (see rfm73_hal.h), so they survive power cycle. 0xFF
+means nothing was found yet.*/
+static uint8_t RFM73_NV _rfm73_scan_last_ch = 0xFF;
+static uint8_t RFM73_NV _rfm73_scan_last_dr = 0xFF;
+
+/*! \brief Sets retransmit parameters of the current scan pass: short ones
+(ARD just above acknowledge time, 2 retries) for the fast pass, 4 ms and 15
+retries for the full one.*/
+static void _rfm73_scan_autort() {
+	if (_rfm73_scan.pass == 0)
+		rfm73_set_autort((_rfm73_scan.dr == RFM73_DATA_RATE_250KBPS) ?
+		                 500 : 250, 2);
+	else
+		rfm73_set_autort(4000, 15);
+}
+
+/*! \brief This function starts step-by-step scan of air for a receiver.
+
+Channels are probed outward from ch (ch, ch+1, ch-1, ch+2...), at every
+channel data rate dr is probed first. Probe is auto-acknowledged packet of
+one byte. With #RFM73_SCAN_FAST all channels are probed first with short
+retransmit settings, so receiver near the start point is found in a few
+milliseconds; with #RFM73_SCAN_FULL they are probed (again) with maximal
+retransmits. With #RFM73_SCAN_CD_STOP scan stops at the first channel where
+carrier is detected.
+
+Scan is done by rfm73_scan_step calls, so program could do something else
+between them. Transmit power and LNA gain are not changed.
+
+\param ch - start channel (0-127), e.g. the last channel where receiver was
+            found (see rfm73_scan_last);
+\param dr - start data rate, e.g. #RFM73_DATA_RATE_2MBPS;
+\param flags - bitwise OR of #RFM73_SCAN_FAST, #RFM73_SCAN_FULL,
+               #RFM73_SCAN_CD_STOP.*/
+void rfm73_scan_start(uint8_t ch, uint8_t dr, uint8_t flags) {
+	_rfm73_scan_ch0 = ch & 0x7F;
+	_rfm73_scan_dr0 = (dr > 2) ? 0 : dr;
+	_rfm73_scan_flags = flags;
+	_rfm73_scan_k = 0;
+	_rfm73_scan_j = 0;
+	_rfm73_scan_retr = _rfm73_shadow[RFM73_RADR_SETUP_RETR];
+	_rfm73_scan_t0 = rfm73_millis();
+	_rfm73_scan.ch = _rfm73_scan_ch0;
+	_rfm73_scan.dr = _rfm73_scan_dr0;
+	_rfm73_scan.pass = (flags & RFM73_SCAN_FAST) ? 0 : 1;
+	_rfm73_scan.probes = 0;
+	_rfm73_scan.total = 0;
+	if (flags & RFM73_SCAN_FAST) _rfm73_scan.total += 128*3;
+	if (flags & RFM73_SCAN_FULL) _rfm73_scan.total += 128*3;
+	_rfm73_scan.elapsed_ms = 0;
+	_rfm73_scan.result = _rfm73_scan.total ? RFM73_SCAN_RUNNING :
+	                                         RFM73_SCAN_FAILED;
+}
+
+/*! \brief Finishes the scan with result: retransmit settings are restored,
+found channel and data rate are written to non-volatile memory.*/
+static uint8_t _rfm73_scan_finish(uint8_t result) {
+	_rfm73_write_reg(RFM73_RADR_SETUP_RETR, _rfm73_scan_retr);
+	_rfm73_scan.elapsed_ms = rfm73_millis() - _rfm73_scan_t0;
+	_rfm73_scan.result = result;
+	if (result == RFM73_SCAN_FOUND) {
+		RFM73_NV_WRITE(&_rfm73_scan_last_ch, _rfm73_scan.ch);
+		RFM73_NV_WRITE(&_rfm73_scan_last_dr, _rfm73_scan.dr);
+	}
+	return result;
+}
+
+/*! \brief Moves the scan to the next channel step, starts full pass after
+the last step of fast one.
+
+\return 0 if the scan is over.*/
+static uint8_t _rfm73_scan_advance() {
+	if (++_rfm73_scan_k) return 1;
+	// all 256 steps are done
+	if ((_rfm73_scan.pass == 1) || !(_rfm73_scan_flags & RFM73_SCAN_FULL))
+		return 0;
+	_rfm73_scan.pass = 1;
+	return 1;
+}
+
+/*! \brief This function makes one probe of the scan started by
+rfm73_scan_start. It blocks for the probe time only: less than a millisecond
+in the fast pass, up to 70 ms in the full one.
+
+\return 
+        - #RFM73_SCAN_RUNNING - nothing found yet, call it again;
+        - #RFM73_SCAN_FOUND - acknowledge received, module stays at found
+		  channel and data rate;
+        - #RFM73_SCAN_CARRIER - carrier detected (#RFM73_SCAN_CD_STOP), module
+		  stays at this channel;
+        - #RFM73_SCAN_FAILED - all passes are done, nothing found.*/
+uint8_t rfm73_scan_step() {
+	uint8_t pl = 0xAA;
+	int16_t ch;
+	if (_rfm73_scan.result != RFM73_SCAN_RUNNING) return _rfm73_scan.result;
+	// next channel within 0-127
+	for (;;) {
+		ch = _rfm73_scan_ch0 + (int16_t)((_rfm73_scan_k + 1) >> 1) *
+		     ((_rfm73_scan_k & 1) ? 1 : -1);
+		if ((ch >= 0) && (ch < 0x80)) break;
+		if (!_rfm73_scan_advance())
+			return _rfm73_scan_finish(RFM73_SCAN_FAILED);
+	}
+	_rfm73_scan.ch = ch;
+	_rfm73_scan.dr = (_rfm73_scan_dr0 + _rfm73_scan_j) % 3;
+	if (_rfm73_scan_j == 0) {
+		rfm73_set_channel(ch);
+		if (_rfm73_scan_flags & RFM73_SCAN_CD_STOP) {
+			// listen to the channel
+			rfm73_rx_mode();
+			RFM73_DELAY_US(400);
+			if (rfm73_carrier_detect())
+				return _rfm73_scan_finish(RFM73_SCAN_CARRIER);
+		}
+	}
+	// change data rate bits only
+	_rfm73_write_reg(RFM73_RADR_RF_SETUP,
+	                 (_rfm73_shadow[RFM73_RADR_RF_SETUP] & ~RS_RF_DR_bm) |
+	                 (((_rfm73_scan.dr & 2) >> 1) << RS_RF_DR_HIGH_bf) |
+	                 ((_rfm73_scan.dr & 1) << RS_RF_DR_LOW_bf));
+	_rfm73_scan_autort();
+	_rfm73_scan.probes++;
+	if (rfm73_send_packet(RFM73_TX_WITH_ACK, &pl, 1) == 0)
+		return _rfm73_scan_finish(RFM73_SCAN_FOUND);
+	_rfm73_scan.elapsed_ms = rfm73_millis() - _rfm73_scan_t0;
+	// next data rate, then next channel
+	if (++_rfm73_scan_j == 3) {
+		_rfm73_scan_j = 0;
+		if (!_rfm73_scan_advance())
+			return _rfm73_scan_finish(RFM73_SCAN_FAILED);
+	}
+	return RFM73_SCAN_RUNNING;
+}
+
+/*! \brief This function returns state of the scan: current or found channel
+and data rate, pass, number of probes done and total, elapsed time (counted
+by rfm73_tick) and result. It doesn't use SPI.*/
+const rfm73_scan_t* rfm73_scan_state() {
+	return &_rfm73_scan;
+}
+
+/*! \brief This function returns the last channel and data rate where receiver
+was found. They are kept in non-volatile memory (EEPROM on target, see
+rfm73_hal.h), so the next scan could start from them after power cycle.
+Channel 0 and 1 Mbps are returned if nothing was found yet (or EEPROM is
+erased). It doesn't use SPI.
+
+\param ch - last channel where receiver was found;
+\param dr - last data rate where receiver was found.*/
+void rfm73_scan_last(uint8_t* ch, uint8_t* dr) {
+	*ch = RFM73_NV_READ(&_rfm73_scan_last_ch);
+	*dr = RFM73_NV_READ(&_rfm73_scan_last_dr);
+	if ((*ch > 0x7F) || (*dr > 2)) {
+		*ch = 0;
+		*dr = 0;
+	}
+}
+
 /*! \brief This function scans air with auto-acknowledge message and returns
-channel and datarate of the first answer.
+channel and datarate of the first answer. It is blocking wrapper of
+rfm73_scan_start (with #RFM73_SCAN_FAST and #RFM73_SCAN_FULL) and
+rfm73_scan_step.
 
 \param *ch - starting channel of the scan; in this variable channel number
              would be returned in case of answer;
-\param *dr - in this variable would be returned datarate;
+\param *dr - starting datarate of the scan; in this variable would be
+             returned datarate;
 
 \return 1 (and change ch and dr params) if acknowledge received;
         0 if nothing received.*/
 uint8_t rfm73_find_receiver(uint8_t* ch, uint8_t* dr) {
-	uint8_t pl = 0xAA;
 	uint8_t res;
-	volatile uint8_t cur_ch = *ch;
-	volatile uint8_t cur_dr = *dr;
-	rfm73_set_autort(4000, 15);
-	// scan every channel
-	for (; cur_ch<0x80; cur_ch++) {
-		rfm73_set_channel(cur_ch);
-		// scan every data-rate
-		for (cur_dr=0; cur_dr<3; cur_dr++) {
-			rfm73_set_rf_params(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
-			                    cur_dr);
-			// clear RX_DR, TX_DS, MAX_RT
-			uint8_t stat = 
-			    _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_STATUS);
-			_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_STATUS, stat);
-			res = rfm73_send_packet(RFM73_TX_WITH_ACK, (uint8_t*)(&pl), 1);
-			// if autoack received twice then break
-			if (!res) {
-				*ch = cur_ch;
-				*dr = cur_dr;
-				return 1;
-			}
-		}		
-	}
-	return 0;
+	rfm73_scan_start(*ch, *dr, RFM73_SCAN_FAST | RFM73_SCAN_FULL);
+	while ((res = rfm73_scan_step()) == RFM73_SCAN_RUNNING) ;
+	if (res != RFM73_SCAN_FOUND) return 0;
+	*ch = _rfm73_scan.ch;
+	*dr = _rfm73_scan.dr;
+	return 1;
+}
+
+/*! \brief Writes configuration of rfm73_init to the module which has
+answered after power on reset. Module is left powered down.*/
+static void _rfm73_configure(uint8_t out_pwr, uint8_t lna_gain,
+                             uint8_t data_rate, uint8_t ch) {
+	// write bank1 registers
+	_rfm73_init_bank1();
+	_rfm73_toggle_reg_bank(0);
+
+	// power down: registers must be written in power down or standby mode
+	RFM73_CE_LOW;
+	_rfm73_write_reg(RFM73_RADR_CONFIG, CF_EN_CRC_bm | CF_CRCO_bm |
+	                                    CF_MASK_MAX_RT_bm);
+	_rfm73_activate();
+	_rfm73_write_table(_rfm73_bank0_init, 1);
+	rfm73_set_rf_params(out_pwr, lna_gain, data_rate);
+	rfm73_set_channel(ch);
+	// module kept powered during reset of MCU could hold old packets
+	_rfm73_write_cmd(RFM73_CMD_FLUSH_RX, 0);
+	_rfm73_write_cmd(RFM73_CMD_FLUSH_TX, 0);
+	_rfm73_write_cmd(RFM73_CMD_W_REGISTER | RFM73_RADR_STATUS,
+	                 ST_RX_DR_bm | ST_TX_DS_bm | ST_MAX_RT_bm);
 }
 
 /*! \brief This function is used to init RFM73 module and to set all parameters
@@ -1238,111 +2680,99 @@ Default configuration sequence includes calling all rfm73_set_functions with
 following params:
 
 <ul>
+<li>module is waited to answer after power on reset (see _rfm73_wait_ready);
+<li>bank1 is written from _rfm73_bank1_init table;
+<li>module is powered down, CRC length is set to 2, MAX_RT interrupt is
+    masked;
+<li>module is activated (see _rfm73_activate);
+<li>bank0 is written from _rfm73_bank0_init table: all pipelines are enabled,
+    got auto-ack, width of 32 and all dynamic payload features are enabled,
+	auto-ack period and re-transmition count are set to maximum, default
+	addresses are set;
 <li>out_pwr, lna_gain, data_rate are sent to rfm73_set_rf_params;
 <li>ch is sent to rfm73_set_channel;
-<li>crc length is set to 2;
-<li>all pipelines are enabled, got auto-ack, width of 32 and all dynamic
-    payload features are enabled;
-<li>auto-ack period and re-transmition count are set to maximum;
-<li>masking all interrupts except MAX_RT;
-<li>RX address of pipeline0 and TX address are set to RX0_Address array,
-	RX address of pipeline1 is set to RX1_Address array;
-<li>bank1 is being intialized by the values stored in Bank1_Reg0_13 and
-	Bank1_Reg14 arrays;
 <li>module set to power up state, RX mode.
-</ul>*/
-void rfm73_init(uint8_t out_pwr, uint8_t lna_gain, uint8_t data_rate,
-                uint8_t ch) {
-	uint8_t i,j;
- 	uint8_t WriteArr[12];
-
-	_delay_ms(200);
-	
-	_rfm73_toggle_reg_bank(0);
-
-	// set all registers at once										 
-	/*for(i=0;i<20;i++) {
-		_rfm73_write_cmd((RFM73_CMD_W_REGISTER|Bank0_Reg[i][0]),
-		                 Bank0_Reg[i][1]);
-	}*/
-	
-	rfm73_set_rf_params(out_pwr, lna_gain, data_rate);
-	rfm73_set_crc_len(2);
-	rfm73_set_autoack(0x3F);
-	rfm73_set_en_pipelines(0x3F);
-	rfm73_set_address_width(RFM73_ADR_WID_5BYTES);
-	rfm73_set_autort(4000, 15);
-	rfm73_mask_int(0, 0, 1);
-	rfm73_set_channel(ch);
-	
-	
-	// Rx0 addr
-	rfm73_set_rx_addr_p0((uint8_t*)(&RX0_Address));
-	
-	// Rx1 addr
-	rfm73_set_rx_addr_p1((uint8_t*)(&RX1_Address));
-
-	// TX addr
-	rfm73_set_tx_addr((uint8_t*)(&RX0_Address));
-	
-	// set pipelines width
-	for (i = 0; i<5; i++)
-		rfm73_set_rx_payload_width(i, 32);
+</ul>
 
-	_rfm73_activate();
-	/*read Feature Register Payload With ACK ACTIVATE
-	  Payload With ACK (REG28,REG29).
-		i = _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_FEATURE);
-		if (i==0) 
-			_rfm73_write_cmd(RFM73_CMD_ACTIVATE, 0x73); // Active
-		// i!=0 showed that chip has been actived.so do not active again.*/
-	rfm73_set_features(1, 1, 1);
-	rfm73_set_dyn_payload(0x3F);
-	/*for(i=22;i>=21;i--) {
-		_rfm73_write_cmd((RFM73_CMD_W_REGISTER|Bank0_Reg[i][0]),
-		                 Bank0_Reg[i][1]);
-	}*/
-	
-	// write bank1 registers
-	_rfm73_toggle_reg_bank(1);
-	
-	// reversed order of bytes
-	for(i=0;i<=8;i++){
-		for(j=0;j<4;j++)
-			WriteArr[j]=(Bank1_Reg0_13[i]>>(8*(j) ) )&0xff;
+Tables are written in SPI bursts and RAM shadow is filled from them, so no
+register is read back.
 
-		_rfm73_write_buf((RFM73_CMD_W_REGISTER|i),&(WriteArr[0]),4);
-	}
+\return 
+        - 0 - module is initialized;
+        - 1 - module didn't answer in #RFM73_POR_TIMEOUT_MS milliseconds
+              (not connected or not powered), nothing is written.*/
+uint8_t rfm73_init(uint8_t out_pwr, uint8_t lna_gain, uint8_t data_rate,
+                   uint8_t ch) {
+	// wait for the end of power on reset
+	if (_rfm73_wait_ready()) return 1;
+	_rfm73_configure(out_pwr, lna_gain, data_rate, ch);
+	rfm73_power_up();
+	rfm73_rx_mode();
+	return 0;
+}
 
-	for(i=9;i<=13;i++) {
-		for(j=0;j<4;j++)
-			WriteArr[j]=(Bank1_Reg0_13[i]>>(8*(3-j) ) )&0xff;
+/*! \brief This function starts initialization of the module (see rfm73_init)
+and returns at once. rfm73_poll waits for the module after power on reset,
+writes configuration and powers module up, driver comes to RX mode in a few
+milliseconds of rfm73_tick without blocking.*/
+void rfm73_init_async(uint8_t out_pwr, uint8_t lna_gain, uint8_t data_rate,
+                      uint8_t ch) {
+	_rfm73_init_params[0] = out_pwr;
+	_rfm73_init_params[1] = lna_gain;
+	_rfm73_init_params[2] = data_rate;
+	_rfm73_init_params[3] = ch;
+	_rfm73_set_state(RFM73_STATE_POR, RFM73_POR_TIMEOUT_MS);
+}
 
-		_rfm73_write_buf((RFM73_CMD_W_REGISTER|i),&(WriteArr[0]),4);
+/*! \brief This function advances driver state when settling time is over:
+module answer after power on reset (rfm73_init_async), power up settling and
+PLL lock after entering RX or TX mode. Timers are counted by rfm73_tick, so
+this function never waits, it should be called from main loop until needed
+state is reached.
+
+\return State of the driver:
+        - #RFM73_STATE_OFF - not initialized or powered down;
+        - #RFM73_STATE_POR - waiting for the module after power on reset;
+        - #RFM73_STATE_POWER_UP - power up settling;
+        - #RFM73_STATE_STANDBY - powered up, CE is low;
+        - #RFM73_STATE_RX_LOCK, #RFM73_STATE_TX_LOCK - PLL lock after
+          entering RX or TX mode;
+        - #RFM73_STATE_RX - receiving, carrier detect is valid;
+        - #RFM73_STATE_TX - transmitting.*/
+uint8_t rfm73_poll() {
+	uint8_t state, t, st;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		state = _rfm73_state;
+		t = _rfm73_state_timer;
 	}
-
-	//_rfm73_write_buf((RFM73_CMD_W_REGISTER|14),&(Bank1_Reg14[0]),11);
-	for(j=0;j<11;j++) {
-		WriteArr[j]=Bank1_Reg14[j];
+	switch (state) {
+		case RFM73_STATE_POR:
+			st = _rfm73_read_cmd(RFM73_CMD_R_REGISTER | RFM73_RADR_STATUS);
+			// module answers or timeout: configure it anyway
+			if (((st != 0x00) && (st != 0xFF)) || (t == 0)) {
+				_rfm73_configure(_rfm73_init_params[0],
+				                 _rfm73_init_params[1],
+				                 _rfm73_init_params[2],
+				                 _rfm73_init_params[3]);
+				rfm73_power_up_async();
+				rfm73_rx_mode();
+			}
+			break;
+		case RFM73_STATE_POWER_UP:
+			if (t) break;
+			if (_rfm73_state_next == RFM73_STATE_STANDBY)
+				_rfm73_set_state(RFM73_STATE_STANDBY, 0);
+			else
+				_rfm73_set_state(_rfm73_state_next, RFM73_LOCK_MS);
+			break;
+		case RFM73_STATE_RX_LOCK:
+			if (!t) _rfm73_set_state(RFM73_STATE_RX, 0);
+			break;
+		case RFM73_STATE_TX_LOCK:
+			if (!t) _rfm73_set_state(RFM73_STATE_TX, 0);
+			break;
 	}
-	_rfm73_write_buf((RFM73_CMD_W_REGISTER|14),&(WriteArr[0]),11);
-
-	//toggle REG4<25,26>
-	for(j=0;j<4;j++)
-		//WriteArr[j]=(RegArrFSKAnalog[4]>>(8*(j) ) )&0xff;
-		WriteArr[j]=(Bank1_Reg0_13[4]>>(8*(j) ) )&0xff;
-
-	WriteArr[0]=WriteArr[0]|0x06;
-	_rfm73_write_buf((RFM73_CMD_W_REGISTER|4),&(WriteArr[0]),4);
-
-	WriteArr[0]=WriteArr[0]&0xf9;
-	_rfm73_write_buf((RFM73_CMD_W_REGISTER|4),&(WriteArr[0]),4);
-
-	_delay_ms(50);
-	
-	_rfm73_toggle_reg_bank(0);
-	rfm73_power_up();
-	rfm73_rx_mode();
+	return _rfm73_state;
 }
 
 /*! @}*/
\ No newline at end of file
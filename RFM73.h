@@ -1,8 +1,8 @@
 #ifndef _RFM73_H_
 #define _RFM73_H_
 
-#include <avr/io.h>
 #include <inttypes.h>
+#include "rfm73_hal.h"
 
 /*! \mainpage RFM73 C-library documentation
 
@@ -30,14 +30,28 @@ In open air a distance of 50 .. 100 m is possible, but this is strictly
 line-of-sight: even the leaves of a single tree can obstruct the signal.
 
 The two main files in this library, rfm73.h and rfm73.c, are almost target
-independent. However, rfm73.c included by a file that must be provided by the
-user.  This file must provide macro's for initializing and accessing the I/O
-pins that connect to the RFM73 module, and for delays of a specified number of
-milliseconds and microseconds. A template for this file is provided.
+independent. Macro's for initializing and accessing the I/O pins that connect
+to the RFM73 module, for delays of a specified number of milliseconds and
+microseconds and for IRQ interrupt are provided by rfm73_hal.h, SPI access by
+spi.h. Both have a host variant (RFM73_HOST defined): then library is compiled
+with gcc on PC and works with simulated modules from sim/rfm73_sim.h, see
+sim/sim_example.c for build command.
 
 \par Files
  - rfm73.h
  - rfm73.c
+ - rfm73_hal.h (pins, delays and interrupts of target or host);
+ - hop.h, hop.c (frequency hopping link layer over this library);
+ - arq.h, arq.c (retransmissions with random exponential backoff);
+ - wor.h, wor.c (duty-cycled receiver with wake-on-radio);
+ - hub.h, hub.c (star network coordinator using all six pipes);
+ - frag.h, frag.c (fragmentation and reassembly of long messages);
+ - stream.h, stream.c (sliding window reliable stream for bulk transfer);
+ - cap.h, cap.c (capture of received packets to binary records);
+ - sim/rfm73_sim.h, sim/rfm73_sim.c (simulated modules for host build);
+ - sim/sim_test.h, sim/sim_*.c (host examples, benchmark and tests, test
+   program exits with 1 if some check fails);
+ - tools/cap2pcap.c (host decoder of packet capture to pcap file);
  - main.c (some rough avr example of using this module).
 
 \par ToDo: bugs, notes, pitfalls, todo, known problems, etc
@@ -96,7 +110,7 @@ milliseconds and microseconds. A template for this file is provided.
 //! is a standard 4-PIN SPI interface (MISO, MOSI, CLCK, CSN) plus a CE
 //! (Chip Enable) pin. The module also provides an IRQ pin that could be used
 //! to speed up the detection of certain events within the module. 
-//! The library does not used this pin. 
+//! The library uses this pin only after rfm73_irq_enable is called. 
 //! The datasheet seems to claim that the SPI input pins are 5V-tolerant, 
 //! but experiments have shown that this is not the case. 
 //!
@@ -179,7 +193,11 @@ milliseconds and microseconds. A template for this file is provided.
 //!
 //! The RFM73 uses a standard 4-wire SPI interface.
 //! It also provides an active low interrupt pin, which could be used to
-//! avoid polling. This library does not use the interrupt pin.
+//! avoid polling. This library uses the interrupt pin after rfm73_irq_enable
+//! is called: external interrupt handler reads STATUS register once, clears
+//! its flags and calls functions registered for RX_DR, TX_DS and MAX_RT
+//! events. The pin must be connected to an external interrupt input of the
+//! micro controller (INT4 by default, see #RFM73_IRQ_vect).
 //! The RFM73 also has a CE (chip enable) input, which must be de-asserted
 //! to put the chip in standby or power-down mode, and must be cycled
 //! to switch between receive and transmit mode. Hence the interface
@@ -191,7 +209,7 @@ milliseconds and microseconds. A template for this file is provided.
 //! - SCK : Serial ClocK, micro controller output
 //! - MOSI : Master Out Slave In, micro controller output
 //! - MISO : Master In Slave Out, micro controller input
-//! - IRQ : Interrupt ReQuest, not used
+//! - IRQ : Interrupt ReQuest, active low, micro controller input (optional)
 //!
 //! When the micro controller operates at 3.3 Volt (or lower, 
 //! the RFM73 datasheet claims operation down to 1.9 Volt) all lines, 
@@ -252,42 +270,7 @@ milliseconds and microseconds. A template for this file is provided.
 //
 //***************************************************************************//
 
-/*! \brief Pin number of IRQ contact on RFM73 module.*/
-#define RFM73_IRQ_PIN     PB5
-/*! \brief PORT register to IRQ contact on RFM73 module.*/
-#define RFM73_IRQ_PORT    PORTB
-/*! \brief PIN register of IRQ contact on RFM73 module.*/
-#define RFM73_IRQ_IN      PINB
-/*! \brief DDR register of IRQ contact on RFM73 module.*/
-#define RFM73_IRQ_DIR     DDRB
-/*! \brief Pin number of CE contact on RFM73 module.*/
-#define RFM73_CE_PIN      PB4
-/*! \brief PORT register to CE contact on RFM73 module.*/
-#define RFM73_CE_PORT     PORTB
-/*! \brief PIN register of CE contact on RFM73 module.*/
-#define RFM73_CE_IN       PINB
-/*! \brief DDR register of CE contact on RFM73 module.*/
-#define RFM73_CE_DIR      DDRB
-/*! \brief Pin number of CSN contact on RFM73 module.*/
-#define RFM73_CSN_PIN     PB0
-/*! \brief PORT register to CSN contact on RFM73 module.*/
-#define RFM73_CSN_PORT    PORTB
-/*! \brief PIN register of CSN contact on RFM73 module.*/
-#define RFM73_CSN_IN      PINB
-/*! \brief DDR register of CSN contact on RFM73 module.*/
-#define RFM73_CSN_DIR     DDRB
-
-/*! \brief Setting high level on CE line.*/
-#define RFM73_CE_HIGH     RFM73_CE_PORT |= (1 << RFM73_CE_PIN)
-/*! \brief Setting low level on CE line.*/
-#define RFM73_CE_LOW      RFM73_CE_PORT &=~(1 << RFM73_CE_PIN)
-/* It is important to never stay in TX mode for more than 4ms at one time. */
-//#define RFM73_CE_TX_PULSE RFM73_CE_HIGH; _delay_us(20); RFM73_CE_LOW
-/*! \brief Setting high level on CSN line.*/
-#define RFM73_CSN_HIGH    RFM73_CSN_PORT |= (1 << RFM73_CSN_PIN)
-/*! \brief Setting low level on CSN line.*/
-#define RFM73_CSN_LOW     RFM73_CSN_PORT &=~(1 << RFM73_CSN_PIN)
-//#define RFM73_CSN_PULSE   RFM73_CSN_HIGH; _delay_us(10); RFM73_CSN_LOW
+/* pins, SPI, delays and interrupts of target are defined in rfm73_hal.h */
 
 /*! \brief Value sent to first argument of rfm73_set_rf_params function. Set
 output power to -10 dBm.*/
@@ -328,15 +311,114 @@ auto-acknowledge of sending packet.*/
 #define RFM73_TX_WITH_NOACK        0
 
 /*! \brief Value sent to first argument of rfm73_receive_packet function. In
-this case function will automatically transmit received message back.*/
+this case function will automatically transmit received message back (as a
+separate packet, see rfm73_ack_payload for faster way).*/
 #define RFM73_RX_WITH_ACK          1
 /*! \brief Value sent to first argument of rfm73_receive_packet function. In
 this case function will only receive new message.*/
 #define RFM73_RX_WITH_NOACK        0
 
+/*! \brief Result of rfm73_send_status: packet is sent, acknowledge is
+received if it was requested.*/
+#define RFM73_TX_DELIVERED         0
+/*! \brief Result of rfm73_send_status: no acknowledge after all
+retransmits.*/
+#define RFM73_TX_MAX_RT            1
+/*! \brief Result of rfm73_send_status: no result in #RFM73_TX_TIMEOUT_MS.*/
+#define RFM73_TX_TIMEOUT           2
+/*! \brief Result of rfm73_send_status: packet is being sent.*/
+#define RFM73_TX_BUSY              3
+/*! \brief Result of rfm73_send_request: acknowledge received without
+payload.*/
+#define RFM73_TX_NO_PAYLOAD        4
+/*! \brief Result of rfm73_send_request: RX or TX queue is not empty, nothing
+is sent.*/
+#define RFM73_TX_PENDING           5
+/*! \brief Result of rfm73_send_packet: no packet slot is free (they are held
+by RX queue or application), nothing is sent.*/
+#define RFM73_TX_NO_SLOT           6
+
+/*! \brief Timeout of sending in milliseconds. It must be longer than
+auto-retransmit time (4000 us x 15 tries set by rfm73_init).*/
+#ifndef RFM73_TX_TIMEOUT_MS
+	#define RFM73_TX_TIMEOUT_MS    100
+#endif
+
+/*! \brief Number of packets in software TX queue of rfm73_send_async. Must be
+a power of 2, each entry takes 2 bytes of RAM (payloads are kept in slots, see
+#RFM73_SLOTS).*/
+#ifndef RFM73_TXQ_SIZE
+	#define RFM73_TXQ_SIZE         4
+#endif
+
 /*! \brief Maximum data size that could be sent in one packet.*/
 #define RFM73_MAX_PACKET_LEN       32
 
+/*! \brief Number of packets in software RX queue. Must be a power of 2, each
+entry takes 1 byte of RAM (payloads are kept in slots, see #RFM73_SLOTS).*/
+#ifndef RFM73_RXQ_SIZE
+	#define RFM73_RXQ_SIZE         4
+#endif
+
+/*! \brief Number of packet slots shared by RX queue, TX queue and
+application (up to 16), each slot takes 38 bytes of RAM. Slots lent to
+application (see rfm73_slot_alloc and rfm73_rx_take) are not available to
+the queues until they are freed or sent.*/
+#ifndef RFM73_SLOTS
+	#define RFM73_SLOTS            (RFM73_RXQ_SIZE + RFM73_TXQ_SIZE)
+#endif
+
+#if (RFM73_SLOTS < 2) || (RFM73_SLOTS > 16)
+	#error "RFM73_SLOTS must be from 2 to 16"
+#endif
+
+/*! \brief State of the driver (see rfm73_poll): not initialized or powered
+down.*/
+#define RFM73_STATE_OFF            0
+/*! \brief State of the driver: waiting for the module after power on reset.*/
+#define RFM73_STATE_POR            1
+/*! \brief State of the driver: power up settling.*/
+#define RFM73_STATE_POWER_UP       2
+/*! \brief State of the driver: powered up, CE is low.*/
+#define RFM73_STATE_STANDBY        3
+/*! \brief State of the driver: PLL lock after entering RX mode.*/
+#define RFM73_STATE_RX_LOCK        4
+/*! \brief State of the driver: receiving.*/
+#define RFM73_STATE_RX             5
+/*! \brief State of the driver: PLL lock after entering TX mode.*/
+#define RFM73_STATE_TX_LOCK        6
+/*! \brief State of the driver: transmitting.*/
+#define RFM73_STATE_TX             7
+
+/*! \brief Number of channels in histogram of rfm73_survey.*/
+#define RFM73_SURVEY_CHANNELS      128
+/*! \brief Time from channel change to the first sample of rfm73_survey, us.*/
+#ifndef RFM73_SURVEY_SETTLE_US
+	#define RFM73_SURVEY_SETTLE_US 400
+#endif
+/*! \brief Time between samples of rfm73_survey, us.*/
+#ifndef RFM73_SURVEY_PERIOD_US
+	#define RFM73_SURVEY_PERIOD_US 120
+#endif
+
+/*! \brief Flag of rfm73_scan_start: probe all channels with short retransmit
+settings first.*/
+#define RFM73_SCAN_FAST            0x01
+/*! \brief Flag of rfm73_scan_start: probe all channels with 4 ms retransmit
+delay and 15 retransmits.*/
+#define RFM73_SCAN_FULL            0x02
+/*! \brief Flag of rfm73_scan_start: stop at channel with carrier detected.*/
+#define RFM73_SCAN_CD_STOP         0x04
+
+/*! \brief Result of rfm73_scan_step: scan is not finished.*/
+#define RFM73_SCAN_RUNNING         0
+/*! \brief Result of rfm73_scan_step: acknowledge received.*/
+#define RFM73_SCAN_FOUND           1
+/*! \brief Result of rfm73_scan_step: carrier detected.*/
+#define RFM73_SCAN_CARRIER         2
+/*! \brief Result of rfm73_scan_step: nothing found.*/
+#define RFM73_SCAN_FAILED          3
+
 /*! \brief Value sent to rfm73_set_address_width function and determine address
 field width of 3 bytes of all modules in network.*/
 #define RFM73_ADR_WID_3BYTES       0b01
@@ -347,6 +429,81 @@ field width of 4 bytes of all modules in network.*/
 field width of 5 bytes of all modules in network.*/
 #define RFM73_ADR_WID_5BYTES       0b11
 
+/*! \brief Function called from IRQ interrupt on RX_DR, TX_DS or MAX_RT event.
+Its argument is STATUS register value read in the interrupt.*/
+typedef void (*rfm73_event_cb_t)(uint8_t status);
+
+/*! \brief Received packet, also packet slot (see rfm73_slot_alloc).*/
+typedef struct {
+	/*! \brief Number of pipe (0-5) at which packet was received.*/
+	uint8_t pipe;
+	/*! \brief Payload length.*/
+	uint8_t len;
+	/*! \brief Time when received packet was moved from RX FIFO to RX queue
+	(see rfm73_millis), ms. While RX queue is full, packets wait in RX FIFO
+	and get later time.*/
+	uint16_t ms;
+	/*! \brief Channel at which received packet was moved from RX FIFO.*/
+	uint8_t ch;
+	/*! \brief STATUS register shifted out while payload of received packet
+	was read from RX FIFO.*/
+	uint8_t status;
+	/*! \brief Payload.*/
+	uint8_t data[RFM73_MAX_PACKET_LEN];
+} rfm73_packet_t;
+
+/*! \brief State of the scan (see rfm73_scan_start).*/
+typedef struct {
+	/*! \brief Channel probed last (found channel if scan is finished).*/
+	uint8_t ch;
+	/*! \brief Data rate probed last (found data rate if scan is finished).*/
+	uint8_t dr;
+	/*! \brief Pass of the scan: 0 - fast, 1 - full.*/
+	uint8_t pass;
+	/*! \brief Number of probes done.*/
+	uint16_t probes;
+	/*! \brief Maximal number of probes of the scan.*/
+	uint16_t total;
+	/*! \brief Time since scan start, ms (counted by rfm73_tick).*/
+	uint16_t elapsed_ms;
+	/*! \brief Result of the last rfm73_scan_step.*/
+	uint8_t result;
+} rfm73_scan_t;
+
+/*! \brief Counters of the link (see rfm73_stats).*/
+typedef struct {
+	/*! \brief Packets finished by the module: delivered, or failed after all
+	retransmits (packets finished by timeout are not counted).*/
+	uint32_t tx_sent;
+	/*! \brief Packets sent with acknowledge request and acknowledged.*/
+	uint32_t tx_acked;
+	/*! \brief Packets failed: no acknowledge after all retransmits or
+	timeout.*/
+	uint32_t tx_failed;
+	/*! \brief Histogram of retransmits of acknowledged packets: element n
+	counts packets acknowledged after n retransmits. Retransmit counter of
+	the module is read when packet is finished; it is reset when the next
+	packet starts, so packets followed by another one in TX FIFO are counted
+	in tx_retries_unknown instead.*/
+	uint32_t tx_retries[16];
+	/*! \brief Acknowledged packets whose retransmits are unknown (next
+	packet was already being sent when they were finished).*/
+	uint32_t tx_retries_unknown;
+	/*! \brief Packets received at every pipe.*/
+	uint32_t rx_pipe[6];
+	/*! \brief Times RX queue was full or no slot was free, so packets were
+	left in RX FIFO of the module (packets coming when RX FIFO is full are
+	lost, this is not counted).*/
+	uint32_t rx_stalled;
+	/*! \brief Times RX FIFO was flushed because of wrong payload width (see
+	rfm73_receive_packet).*/
+	uint32_t rx_flushed;
+	/*! \brief Time with packets in TX queue, ms (counted by rfm73_tick).*/
+	uint32_t tx_ms;
+	/*! \brief Time in RX mode, ms (counted by rfm73_tick).*/
+	uint32_t rx_ms;
+} rfm73_stats_t;
+
 /* set tx mode */
 void rfm73_tx_mode();
 /* set rx mode (high energy drain if power up) */
@@ -355,10 +512,18 @@ void rfm73_rx_mode();
 void rfm73_power_up();
 /* power down module */
 void rfm73_power_down();
+/* power up module without waiting for settling */
+void rfm73_power_up_async();
 
-/* initilize module ith some default settings */
-void rfm73_init(uint8_t out_pwr, uint8_t lna_gain, uint8_t data_rate,
-                uint8_t ch);
+/* initilize module ith some default settings, returns 1 if it doesn't
+   answer */
+uint8_t rfm73_init(uint8_t out_pwr, uint8_t lna_gain, uint8_t data_rate,
+                   uint8_t ch);
+/* starts initialization, it is finished by rfm73_poll */
+void rfm73_init_async(uint8_t out_pwr, uint8_t lna_gain, uint8_t data_rate,
+                      uint8_t ch);
+/* advances driver state when settling is over, returns state */
+uint8_t rfm73_poll();
 /* masking events that affects IRQ pin */
 void rfm73_mask_int(uint8_t mask_rx_dr, uint8_t mask_tx_ds,
                     uint8_t mask_max_rt);
@@ -368,6 +533,19 @@ void rfm73_set_rf_params(uint8_t out_pwr, uint8_t lna_gain, uint8_t data_rate);
 void rfm73_set_address_width(uint8_t aw);
 /* set autoretransmit params: time and number of tries */
 void rfm73_set_autort(uint16_t rt_time, uint8_t rt_count);
+/* set TX address */
+void rfm73_set_tx_addr(uint8_t* addr);
+/* set RX address of pipeline 0 */
+void rfm73_set_rx_addr_p0(uint8_t* addr);
+/* set RX address of pipeline 1 */
+void rfm73_set_rx_addr_p1(uint8_t* addr);
+/* set LSB of RX address of pipelines 2-5 */
+void rfm73_set_rx_addr_p2(uint8_t addr);
+void rfm73_set_rx_addr_p3(uint8_t addr);
+void rfm73_set_rx_addr_p4(uint8_t addr);
+void rfm73_set_rx_addr_p5(uint8_t addr);
+/* enables receive pipelines */
+void rfm73_set_en_pipelines(uint8_t pipeline_mask);
 /* set rf channel from 0 to 127 */
 void rfm73_set_channel(uint8_t _cfg);
 /* set receiver payload width of specified pipeline */
@@ -376,20 +554,90 @@ void rfm73_set_rx_payload_width(uint8_t pipeline, uint8_t wid);
 void rfm73_set_dyn_payload(uint8_t pipeline_mask);
 /* returns selected channel */
 uint8_t rfm73_get_channel();
+/* returns power up state of the module */
+uint8_t rfm73_get_power_state();
 /* returns receiver's payload width of specified pipeline */
 uint8_t rfm73_get_rx_payload_width(uint8_t pipeline);
 /* returns enabled state of dynamic payload feature of specified pipelines */
 uint8_t rfm73_get_dyn_payload();
+/* reads all configuration registers to RAM shadow */
+void rfm73_resync();
+/* returns number of registers that differ from RAM shadow */
+uint8_t rfm73_verify();
+/* writes RAM shadow back to module if it was reset */
+uint8_t rfm73_restore();
 /* returns rf quality characteristics: number of packets lost since channel
 change and number of times last packet was retransmitted */
 uint8_t rfm73_observe(uint8_t* packet_lost, uint8_t* retrans_count);
+/* reads STATUS register */
+uint8_t rfm73_status();
 /* returns carrier detect status bit */
 uint8_t rfm73_carrier_detect();
+/* samples carrier detect on every channel to histogram */
+uint8_t rfm73_survey(uint8_t* hist, uint8_t samples);
 /* checks and receives new packet */
 uint8_t rfm73_receive_packet(uint8_t type, uint8_t* data_buf, uint8_t* len);
+/* checks and receives new packet without copying */
+uint8_t rfm73_receive_slot(uint8_t type, rfm73_packet_t** slot);
+/* takes the oldest packet from RX queue */
+uint8_t rfm73_rx_get(rfm73_packet_t* pkt);
+/* takes up to max packets from RX queue */
+uint8_t rfm73_rx_get_batch(rfm73_packet_t* pkts, uint8_t max);
+/* returns number of packets in RX queue */
+uint8_t rfm73_rx_available();
+/* takes slot of the oldest packet from RX queue without copying */
+rfm73_packet_t* rfm73_rx_take();
+/* lends free packet slot to application */
+rfm73_packet_t* rfm73_slot_alloc();
+/* returns packet slot to the pool */
+void rfm73_slot_free(rfm73_packet_t* slot);
+/* loads payload sent with the next acknowledge on pipe (receiver) */
+uint8_t rfm73_ack_payload(uint8_t pipe, const uint8_t* pbuf, uint8_t len);
+/* drops acknowledge payloads not sent yet (receiver) */
+void rfm73_ack_payload_flush();
+/* sends packet and returns payload of its acknowledge (transmitter) */
+uint8_t rfm73_send_request(const uint8_t* pbuf, uint8_t len,
+                           rfm73_packet_t* resp);
 /* sends data */
 uint8_t rfm73_send_packet(uint8_t type, uint8_t* pbuf, uint8_t len);
-/* find receivers within all datarates and all channels from ch to 127 */
+/* puts data to TX queue and returns at once */
+uint8_t rfm73_send_async(uint8_t type, const uint8_t* pbuf, uint8_t len);
+/* puts packet slot to TX queue without copying */
+uint8_t rfm73_send_slot(uint8_t type, rfm73_packet_t* slot);
+/* returns state of asynchronous sending */
+uint8_t rfm73_send_status();
+/* returns number of packets in TX queue */
+uint8_t rfm73_send_queued();
+/* sets function called when asynchronous sending is finished */
+void rfm73_send_callback(void (*done)(uint8_t result));
+/* time base of the library, must be called every millisecond */
+void rfm73_tick();
+/* returns milliseconds counted by rfm73_tick */
+uint16_t rfm73_millis();
+/* copies counters of the link, clears them if reset is set */
+void rfm73_stats(rfm73_stats_t* st, uint8_t reset);
+/* starts writing payload to TX FIFO in background */
+uint8_t rfm73_write_payload_async(uint8_t type, const uint8_t* pbuf,
+                                  uint8_t len, void (*done)(uint8_t status));
+/* starts reading top payload of RX FIFO in background */
+uint8_t rfm73_read_payload_async(uint8_t* data_buf, uint8_t len,
+                                 void (*done)(uint8_t status));
+/* returns 1 while background payload transfer is in progress */
+uint8_t rfm73_xfer_busy();
+/* starts event dispatch from IRQ pin */
+void rfm73_irq_enable(rfm73_event_cb_t rx_dr, rfm73_event_cb_t tx_ds,
+                      rfm73_event_cb_t max_rt);
+/* stops event dispatch from IRQ pin */
+void rfm73_irq_disable();
+/* starts scan of air from channel ch and datarate dr outward */
+void rfm73_scan_start(uint8_t ch, uint8_t dr, uint8_t flags);
+/* makes one probe of the scan */
+uint8_t rfm73_scan_step();
+/* returns progress of the scan */
+const rfm73_scan_t* rfm73_scan_state();
+/* returns last channel and datarate where receiver was found */
+void rfm73_scan_last(uint8_t* ch, uint8_t* dr);
+/* find receivers within all datarates and all channels from ch outward */
 uint8_t rfm73_find_receiver(uint8_t* ch, uint8_t* dr);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,136 @@
+/*
+ * arq.c
+ *
+ * Software retransmission scheme over RFM73 library (see arq.h).
+ */
+
+#include "arq.h"
+
+/* statistics of destinations */
+static arq_stats_t arq_dest[ARQ_MAX_DEST];
+/* number of used entries of arq_dest and the next one to reuse */
+static uint8_t arq_used, arq_next;
+/* address written to TX_ADDR and RX_ADDR_P0 */
+static uint8_t arq_cur[5];
+/* arq_cur is valid */
+static uint8_t arq_cur_valid;
+/* state of random generator */
+static uint16_t arq_rnd = 1;
+
+/* returns next pseudo-random number (xorshift) */
+static uint16_t arq_random() {
+	arq_rnd ^= arq_rnd << 7;
+	arq_rnd ^= arq_rnd >> 9;
+	arq_rnd ^= arq_rnd << 8;
+	return arq_rnd;
+}
+
+/* returns 1 if addresses are equal */
+static uint8_t arq_addr_eq(const uint8_t* a, const uint8_t* b) {
+	uint8_t i;
+	for (i = 0; i < 5; i++)
+		if (a[i] != b[i]) return 0;
+	return 1;
+}
+
+/* finds statistics of destination, creates it if create is set */
+static arq_stats_t* arq_find(const uint8_t* addr, uint8_t create) {
+	uint8_t i;
+	arq_stats_t* s;
+	for (i = 0; i < arq_used; i++)
+		if (arq_addr_eq(arq_dest[i].addr, addr)) return &arq_dest[i];
+	if (!create) return 0;
+	if (arq_used < ARQ_MAX_DEST) s = &arq_dest[arq_used++];
+	else {
+		s = &arq_dest[arq_next];
+		if (++arq_next == ARQ_MAX_DEST) arq_next = 0;
+		// entry of the cached address is retired with it
+		if (arq_addr_eq(s->addr, arq_cur)) arq_cur_valid = 0;
+	}
+	for (i = 0; i < 5; i++) s->addr[i] = addr[i];
+	s->sent = 0;
+	s->delivered = 0;
+	s->failed = 0;
+	s->attempts = 0;
+	s->hw_retries = 0;
+	s->backoff_ms = 0;
+	return s;
+}
+
+/*! \brief This function seeds random generator of backoff. Seed should
+differ between nodes, e.g. it could be taken from node address or ADC noise.
+
+\param seed - any value (0 is replaced by 1).*/
+void arq_init(uint16_t seed) {
+	arq_rnd = seed ? seed : 1;
+	arq_cur_valid = 0;
+}
+
+/*! \brief This function sends packet with acknowledge to destination addr.
+Every attempt uses #ARQ_HW_ARC hardware retransmits #ARQ_HW_ARD_US apart.
+After failed attempt n (from 0) it waits random time from 0 to
+#ARQ_BACKOFF_MIN_MS*2^n (up to #ARQ_BACKOFF_MAX_MS) milliseconds and tries
+again, up to #ARQ_MAX_TRIES attempts.
+
+TX address and RX address of pipeline 0 (used for acknowledge) are set to
+addr, they are written only when destination changes or its statistics are
+retired (see arq_reset_stats). Retransmit settings are left as set by this
+function.
+
+\param addr - destination address, 5 bytes;
+\param pbuf - pointer to data;
+\param len  - length of data, mustn't exceed 32.
+
+\return
+        - 0 - packet acknowledged;
+        - 1 - packet is dropped after all attempts.*/
+uint8_t arq_send(const uint8_t* addr, const uint8_t* pbuf, uint8_t len) {
+	uint8_t i, lost, rc;
+	uint16_t window = ARQ_BACKOFF_MIN_MS, wait;
+	arq_stats_t* s = arq_find(addr, 1);
+
+	if (!arq_cur_valid || !arq_addr_eq(arq_cur, addr)) {
+		for (i = 0; i < 5; i++) arq_cur[i] = addr[i];
+		rfm73_set_tx_addr(arq_cur);
+		rfm73_set_rx_addr_p0(arq_cur);
+		arq_cur_valid = 1;
+	}
+	rfm73_set_autort(ARQ_HW_ARD_US, ARQ_HW_ARC);
+	s->sent++;
+	for (i = 0; i < ARQ_MAX_TRIES; i++) {
+		s->attempts++;
+		if (rfm73_send_packet(RFM73_TX_WITH_ACK, (uint8_t*)pbuf, len) == 0) {
+			rfm73_observe(&lost, &rc);
+			s->hw_retries += rc;
+			s->delivered++;
+			return 0;
+		}
+		s->hw_retries += ARQ_HW_ARC;
+		if (i == ARQ_MAX_TRIES - 1) break;
+		// random timeout from growing window
+		wait = arq_random() % window;
+		s->backoff_ms += wait;
+		while (wait--) RFM73_DELAY_MS(1);
+		if (window < ARQ_BACKOFF_MAX_MS) window <<= 1;
+	}
+	s->failed++;
+	return 1;
+}
+
+/*! \brief This function returns statistics of destination.
+
+\param addr - destination address, 5 bytes.
+
+\return Pointer to statistics or 0 if nothing was sent to addr.*/
+const arq_stats_t* arq_stats(const uint8_t* addr) {
+	return arq_find(addr, 0);
+}
+
+/*! \brief This function clears statistics of all destinations. Cached
+destination is forgotten too, so the next arq_send writes TX address again
+(call it after TX address was changed outside of this module).*/
+void arq_reset_stats() {
+	arq_used = 0;
+	arq_next = 0;
+	arq_cur_valid = 0;
+}
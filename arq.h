@@ -0,0 +1,73 @@
+/*
+ * arq.h
+ *
+ * Software retransmission scheme over RFM73 library, as suggested in the
+ * overview of RFM73.h: every attempt uses a few short hardware retransmits,
+ * failed attempts are repeated after random timeout from exponentially
+ * growing window, so transmitters that collided once don't collide again.
+ * Statistics are kept for every destination address.
+ */
+
+
+#ifndef ARQ_H_
+#define ARQ_H_
+
+#include <inttypes.h>
+#include "RFM73.h"
+
+/*! \brief Number of destinations with statistics. When table is full, the
+oldest entry is reused.*/
+#ifndef ARQ_MAX_DEST
+	#define ARQ_MAX_DEST           4
+#endif
+/*! \brief Hardware retransmit delay of one attempt, us (250-4000).*/
+#ifndef ARQ_HW_ARD_US
+	#define ARQ_HW_ARD_US          500
+#endif
+/*! \brief Hardware retransmits of one attempt (0-15).*/
+#ifndef ARQ_HW_ARC
+	#define ARQ_HW_ARC             3
+#endif
+/*! \brief Maximum number of attempts of one packet.*/
+#ifndef ARQ_MAX_TRIES
+	#define ARQ_MAX_TRIES          6
+#endif
+/*! \brief Backoff window after the first failed attempt, ms. Window doubles
+after every next failure.*/
+#ifndef ARQ_BACKOFF_MIN_MS
+	#define ARQ_BACKOFF_MIN_MS     4
+#endif
+/*! \brief Maximum backoff window, ms.*/
+#ifndef ARQ_BACKOFF_MAX_MS
+	#define ARQ_BACKOFF_MAX_MS     128
+#endif
+
+/*! \brief Statistics of one destination.*/
+typedef struct {
+	/*! \brief Destination address (5 bytes, only address width bytes are
+	used by module).*/
+	uint8_t addr[5];
+	/*! \brief Packets given to arq_send.*/
+	uint16_t sent;
+	/*! \brief Packets acknowledged.*/
+	uint16_t delivered;
+	/*! \brief Packets dropped after #ARQ_MAX_TRIES attempts.*/
+	uint16_t failed;
+	/*! \brief Attempts (software retransmits are attempts - sent).*/
+	uint16_t attempts;
+	/*! \brief Hardware retransmits of all attempts.*/
+	uint16_t hw_retries;
+	/*! \brief Total time spent in backoff, ms.*/
+	uint32_t backoff_ms;
+} arq_stats_t;
+
+/* seeds random backoff, seed should differ between nodes */
+void arq_init(uint16_t seed);
+/* sends packet to addr with retransmissions and backoff */
+uint8_t arq_send(const uint8_t* addr, const uint8_t* pbuf, uint8_t len);
+/* returns statistics of destination or 0 */
+const arq_stats_t* arq_stats(const uint8_t* addr);
+/* clears statistics of all destinations */
+void arq_reset_stats();
+
+#endif /* ARQ_H_ */
@@ -0,0 +1,95 @@
+/*
+ * cap.c
+ *
+ * Capture of received packets to binary records (see cap.h).
+ */
+
+#include "cap.h"
+
+/* output of records */
+static cap_out_t cap_out = 0;
+/* statistics */
+static cap_stats_t cap_stat;
+/* records dropped since the last written one */
+static uint8_t cap_lost;
+/* time since cap_init extended to 32 bits and its 16-bit value (see
+   rfm73_millis) */
+static uint32_t cap_ms;
+static uint16_t cap_last_ms;
+
+/* advances time of capture to ms; packet moved from RX FIFO before the last
+   advance gets time of it */
+static void cap_time(uint16_t ms) {
+	uint16_t d = ms - cap_last_ms;
+	if ((int16_t)d <= 0) return;
+	cap_ms += d;
+	cap_last_ms = ms;
+}
+
+/* frames packet to record, returns its length */
+static uint8_t cap_record(uint8_t* rec, const rfm73_packet_t* pkt) {
+	uint8_t i, pl, rc, n, sum = 0;
+	cap_time(pkt->ms);
+	rfm73_observe(&pl, &rc);
+	rec[0] = CAP_SYNC0;
+	rec[1] = CAP_SYNC1;
+	rec[2] = cap_ms;
+	rec[3] = cap_ms >> 8;
+	rec[4] = cap_ms >> 16;
+	rec[5] = cap_ms >> 24;
+	rec[6] = pkt->ch;
+	rec[7] = pkt->pipe;
+	rec[8] = pkt->status;
+	rec[9] = (pl << 4) | rc;
+	rec[10] = cap_lost;
+	rec[11] = pkt->len;
+	for (i = 0; i < pkt->len; i++) rec[CAP_HEADER_LEN + i] = pkt->data[i];
+	n = CAP_HEADER_LEN + pkt->len;
+	for (i = 2; i < n; i++) sum += rec[i];
+	rec[n] = sum;
+	return n + 1;
+}
+
+/*! \brief This function sets function which writes records and clears
+statistics. Time of records is counted from this call.
+
+\param out - output function (e.g. uart_try_write).*/
+void cap_init(cap_out_t out) {
+	cap_out = out;
+	cap_stat.records = 0;
+	cap_stat.dropped = 0;
+	cap_stat.bytes = 0;
+	cap_lost = 0;
+	cap_ms = 0;
+	cap_last_ms = rfm73_millis();
+}
+
+/*! \brief This function takes all packets from RX queue (see rfm73_rx_get)
+and writes a record of every packet. It must be called from main loop often
+enough to keep RX queue from filling up (at least every 30 s to keep time).
+
+\return Number of packets taken.*/
+uint8_t cap_poll() {
+	rfm73_packet_t pkt;
+	uint8_t rec[CAP_MAX_RECORD], len, n = 0;
+	while (rfm73_rx_get(&pkt) == 0) {
+		n++;
+		len = cap_record(rec, &pkt);
+		if (!cap_out || cap_out(rec, len)) {
+			cap_stat.dropped++;
+			if (cap_lost < 0xFF) cap_lost++;
+			continue;
+		}
+		cap_stat.records++;
+		cap_stat.bytes += len;
+		cap_lost = 0;
+	}
+	// packets moved after this moment are not older than it
+	cap_time(rfm73_millis());
+	return n;
+}
+
+/*! \brief This function returns statistics of capture since cap_init.*/
+const cap_stats_t* cap_stats() {
+	return &cap_stat;
+}
@@ -0,0 +1,65 @@
+/*
+ * cap.h
+ *
+ * Capture of received packets (sniffer mode) over RFM73 library. Every packet
+ * taken from RX queue is framed in a compact binary record and passed to
+ * output function (e.g. uart_try_write), so traffic is recorded with binary
+ * payloads and analysed offline: tools/cap2pcap.c converts recording to pcap
+ * file. Record is:
+ *
+ *   0xA5 0x5A  - sync;
+ *   ms[4]      - time of reception since cap_init, ms, LSB first;
+ *   ch         - channel of reception;
+ *   pipe       - pipe of the packet;
+ *   status     - STATUS register read with payload of the packet;
+ *   observe    - OBSERVE_TX register read when record is written;
+ *   dropped    - records dropped before this one (up to 255);
+ *   len        - payload length;
+ *   data[len]  - payload;
+ *   sum        - sum of all bytes after sync (mod 256).
+ *
+ * Output function takes record whole or drops it whole, so when output is
+ * slower than air, stream stays in sync and lost records are counted in the
+ * next one. Time, channel and STATUS are taken when packet is moved from RX
+ * FIFO (see rfm73_packet_t), not when record is written. rfm73_tick must be called
+ * every millisecond.
+ */
+
+
+#ifndef CAP_H_
+#define CAP_H_
+
+#include <inttypes.h>
+#include "RFM73.h"
+
+/*! \brief First byte of record.*/
+#define CAP_SYNC0                  0xA5
+/*! \brief Second byte of record.*/
+#define CAP_SYNC1                  0x5A
+/*! \brief Bytes of record before payload.*/
+#define CAP_HEADER_LEN             12
+/*! \brief Maximum length of record (header, payload and sum).*/
+#define CAP_MAX_RECORD             (CAP_HEADER_LEN + RFM73_MAX_PACKET_LEN + 1)
+
+/*! \brief Function writing record: pointer to record and its length. Returns
+0 if record is written, 1 if it is dropped.*/
+typedef uint8_t (*cap_out_t)(const uint8_t* buf, uint8_t len);
+
+/*! \brief Statistics of capture.*/
+typedef struct {
+	/*! \brief Records written.*/
+	uint32_t records;
+	/*! \brief Records dropped by output function.*/
+	uint32_t dropped;
+	/*! \brief Bytes of written records.*/
+	uint32_t bytes;
+} cap_stats_t;
+
+/* sets output function and clears statistics */
+void cap_init(cap_out_t out);
+/* writes records of packets from RX queue, returns their number */
+uint8_t cap_poll();
+/* returns statistics of capture */
+const cap_stats_t* cap_stats();
+
+#endif /* CAP_H_ */
@@ -0,0 +1,190 @@
+/*
+ * frag.c
+ *
+ * Fragmentation and reassembly of messages over RFM73 library (see frag.h).
+ */
+
+#include "frag.h"
+
+/* id of the last sent message */
+static uint8_t frag_tx_id;
+/* bit of every fragment of the message: acknowledged, in TX queue */
+static volatile uint8_t frag_acked[32], frag_queued[32];
+/* fragments in TX queue in order of sending, they are finished in the same
+   order */
+static volatile uint8_t frag_ring[16];
+static volatile uint8_t frag_ring_head, frag_ring_tail;
+/* failed fragments in a row */
+static volatile uint8_t frag_fails;
+
+/* id of the received message */
+static uint8_t frag_rx_id;
+/* receiving is in progress */
+static uint8_t frag_rx_busy;
+/* number of the last fragment and the next fragment to pass to sink */
+static uint8_t frag_rx_last, frag_rx_next;
+/* fragment buffers: fragment n is kept in buffer n % FRAG_WINDOW */
+static uint8_t frag_buf[FRAG_WINDOW][FRAG_DATA_LEN];
+static uint8_t frag_buf_len[FRAG_WINDOW];
+/* bit n is set if buffer n is filled */
+static uint16_t frag_buf_full;
+/* receiver of data */
+static frag_sink_t frag_rx_sink = 0;
+
+/* returns bit of fragment n in map */
+static uint8_t frag_bit(const volatile uint8_t* map, uint8_t n) {
+	return map[n >> 3] & (1 << (n & 7));
+}
+
+/* called when fragment is finished in TX queue (from IRQ interrupt or
+   rfm73_send_status) */
+static void frag_done(uint8_t result) {
+	uint8_t n = frag_ring[frag_ring_head++ & 15];
+	if (result == RFM73_TX_DELIVERED) {
+		frag_acked[n >> 3] |= 1 << (n & 7);
+		frag_fails = 0;
+	}
+	else {
+		// fragment will be sent again
+		frag_queued[n >> 3] &= ~(1 << (n & 7));
+		if (frag_fails < 0xFF) frag_fails++;
+	}
+}
+
+/* puts fragment n to TX queue, returns 1 if queue is full */
+static uint8_t frag_queue(const uint8_t* pbuf, uint16_t len, uint8_t n,
+                          uint8_t last) {
+	uint8_t buf[RFM73_MAX_PACKET_LEN], i, cnt;
+	uint16_t offset = (uint16_t)n * FRAG_DATA_LEN;
+	cnt = (len - offset > FRAG_DATA_LEN) ? FRAG_DATA_LEN : len - offset;
+	buf[0] = frag_tx_id;
+	buf[1] = n;
+	buf[2] = last;
+	for (i = 0; i < cnt; i++) buf[FRAG_HEADER_LEN + i] = pbuf[offset + i];
+	// fragment is in ring before it could be finished
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		frag_queued[n >> 3] |= 1 << (n & 7);
+		frag_ring[frag_ring_tail & 15] = n;
+	}
+	if (rfm73_send_async(RFM73_TX_WITH_ACK, buf, FRAG_HEADER_LEN + cnt)) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			frag_queued[n >> 3] &= ~(1 << (n & 7));
+		}
+		return 1;
+	}
+	frag_ring_tail++;
+	return 0;
+}
+
+/*! \brief This function sends message to receiver running frag_receive and
+returns when all fragments are acknowledged or sending failed. Fragments
+are sent by rfm73_send_async (with auto acknowledge and retransmit settings
+of the module), function set by rfm73_send_callback is replaced and cleared
+at the end. rfm73_tick must be called every millisecond to get timeouts.
+Module is left in TX mode.
+
+\param pbuf - pointer to message;
+\param len  - length of message (1-#FRAG_MAX_LEN).
+
+\return
+        - 0 - message delivered;
+        - 1 - #FRAG_MAX_FAILS fragments in a row were not acknowledged or
+              length is wrong.*/
+uint8_t frag_send(const uint8_t* pbuf, uint16_t len) {
+	uint8_t i, base = 0, last, res = 0, queued;
+	uint16_t n;
+	if ((len == 0) || (len > FRAG_MAX_LEN)) return 1;
+	last = (len - 1) / FRAG_DATA_LEN;
+	for (i = 0; i < 32; i++) {
+		frag_acked[i] = 0;
+		frag_queued[i] = 0;
+	}
+	frag_ring_head = 0;
+	frag_ring_tail = 0;
+	frag_fails = 0;
+	frag_tx_id++;
+	rfm73_send_callback(frag_done);
+	for (;;) {
+		while ((base < last) && frag_bit(frag_acked, base)) base++;
+		// the last fragment is the base only when all before it are done
+		if (frag_bit(frag_acked, base)) break;
+		if (frag_fails >= FRAG_MAX_FAILS) {
+			res = 1;
+			break;
+		}
+		// window is counted from the oldest unacknowledged fragment
+		queued = 0;
+		for (n = base; (n < base + FRAG_WINDOW) && (n <= last); n++) {
+			if (frag_bit(frag_acked, n) || frag_bit(frag_queued, n)) continue;
+			if (frag_queue(pbuf, len, n, last)) break;
+			queued = 1;
+		}
+		if ((rfm73_send_status() == RFM73_TX_BUSY) && !queued)
+			RFM73_DELAY_US(50);
+	}
+	// fragments left in queue are finished before callback is cleared
+	while (rfm73_send_status() == RFM73_TX_BUSY) RFM73_DELAY_US(50);
+	rfm73_send_callback(0);
+	return res;
+}
+
+/*! \brief This function sets function which receives data of messages in
+order. It is called by frag_receive.
+
+\param sink - function receiving data (may be NULL).*/
+void frag_sink(frag_sink_t sink) {
+	frag_rx_sink = sink;
+}
+
+/*! \brief This function takes packets from RX queue (see rfm73_rx_get) and
+passes data of message to sink function (see frag_sink) in order. Fragment
+of new message (other id) drops the message received before. It must be
+called from main loop often enough to keep RX queue from filling up.
+
+\param len - length of message, set when message is complete.
+
+\return
+        - 0 - message is complete (the last data was passed to sink);
+        - 1 - no complete message yet.*/
+uint8_t frag_receive(uint16_t* len) {
+	rfm73_packet_t pkt;
+	uint8_t i, n, b, cnt;
+	while (rfm73_rx_get(&pkt) == 0) {
+		if (pkt.len <= FRAG_HEADER_LEN) continue;
+		if (pkt.data[0] != frag_rx_id) {
+			frag_rx_id = pkt.data[0];
+			frag_rx_busy = 1;
+			frag_rx_last = pkt.data[2];
+			frag_rx_next = 0;
+			frag_buf_full = 0;
+		}
+		n = pkt.data[1];
+		// duplicates, fragments of finished message and fragments out of
+		// window are dropped
+		if (!frag_rx_busy || (n > frag_rx_last) ||
+		    ((uint8_t)(n - frag_rx_next) >= FRAG_WINDOW))
+			continue;
+		b = n % FRAG_WINDOW;
+		cnt = pkt.len - FRAG_HEADER_LEN;
+		for (i = 0; i < cnt; i++) frag_buf[b][i] = pkt.data[FRAG_HEADER_LEN + i];
+		frag_buf_len[b] = cnt;
+		frag_buf_full |= 1 << b;
+		// passes fragments in order
+		for (;;) {
+			b = frag_rx_next % FRAG_WINDOW;
+			if (!(frag_buf_full & (1 << b))) break;
+			frag_buf_full &= ~(1 << b);
+			if (frag_rx_sink)
+				frag_rx_sink((uint16_t)frag_rx_next * FRAG_DATA_LEN,
+				             frag_buf[b], frag_buf_len[b]);
+			if (frag_rx_next == frag_rx_last) {
+				frag_rx_busy = 0;
+				*len = (uint16_t)frag_rx_last * FRAG_DATA_LEN +
+				       frag_buf_len[b];
+				return 0;
+			}
+			frag_rx_next++;
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,66 @@
+/*
+ * frag.h
+ *
+ * Fragmentation and reassembly of messages longer than one packet over RFM73
+ * library. frag_send splits message to numbered fragments with a short header
+ * (message id, fragment number, number of the last fragment) and streams them
+ * by rfm73_send_async, so TX FIFO of the module is kept filled and fragments
+ * go back-to-back with auto acknowledge. Only fragments that finished without
+ * acknowledge are sent again. At most FRAG_WINDOW fragments after the oldest
+ * unacknowledged one are sent, so receiver needs only FRAG_WINDOW fragment
+ * buffers: frag_receive puts fragments to them and passes data in order to
+ * sink function (e.g. writing to flash), whole message is never kept in RAM.
+ *
+ * Module of receiver acknowledges every fragment it has room for in its RX
+ * FIFO (3 packets), also when RX queue is full and fragments wait in the
+ * FIFO. Library doesn't flush RX FIFO on mode switches (see rfm73_rx_mode),
+ * so acknowledged fragment reaches RX queue and acknowledge of all fragments
+ * means the whole message is delivered. It is lost only if RX FIFO is
+ * flushed: by rfm73_init, by broken payload width (see rfm73_stats) or by
+ * power loss of receiver module. Message ids are counted from 1 after reset
+ * of transmitter, so receiver should be reset with it.
+ */
+
+
+#ifndef FRAG_H_
+#define FRAG_H_
+
+#include <inttypes.h>
+#include "RFM73.h"
+
+/*! \brief Number of fragments sent ahead of the oldest unacknowledged one,
+also number of fragment buffers of receiver (2-16).*/
+#ifndef FRAG_WINDOW
+	#define FRAG_WINDOW            8
+#endif
+/*! \brief Number of failed fragments in a row after which sending is
+aborted.*/
+#ifndef FRAG_MAX_FAILS
+	#define FRAG_MAX_FAILS         16
+#endif
+
+#if (FRAG_WINDOW < 2) || (FRAG_WINDOW > 16)
+	#error "FRAG_WINDOW must be from 2 to 16"
+#endif
+
+/*! \brief Bytes of header at the start of every fragment: message id,
+fragment number and number of the last fragment of message.*/
+#define FRAG_HEADER_LEN            3
+/*! \brief Data bytes in one fragment.*/
+#define FRAG_DATA_LEN              (RFM73_MAX_PACKET_LEN - FRAG_HEADER_LEN)
+/*! \brief Maximum length of message (256 fragments).*/
+#define FRAG_MAX_LEN               (256 * FRAG_DATA_LEN)
+
+/*! \brief Function receiving data of message in order: offset of data from
+the start of message, pointer to data and its length.*/
+typedef void (*frag_sink_t)(uint16_t offset, const uint8_t* data,
+                            uint8_t len);
+
+/* sends message of up to FRAG_MAX_LEN bytes */
+uint8_t frag_send(const uint8_t* pbuf, uint16_t len);
+/* sets function receiving data of messages */
+void frag_sink(frag_sink_t sink);
+/* takes fragments from RX queue, returns 0 when message is complete */
+uint8_t frag_receive(uint16_t* len);
+
+#endif /* FRAG_H_ */
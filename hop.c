@@ -0,0 +1,246 @@
+/*
+ * hop.c
+ *
+ * Frequency hopping link layer over RFM73 library (see hop.h).
+ */
+
+#include "hop.h"
+
+/* role of the node */
+static uint8_t hop_role;
+/* hopping sequence: channel of every slot */
+static uint8_t hop_seq[HOP_MAX_CHANNELS];
+/* length of sequence */
+static uint8_t hop_n;
+/* loss level of every sequence entry (moving average, 0-255) */
+static uint8_t hop_loss[HOP_MAX_CHANNELS];
+/* bit i is set if entry i is blacklisted */
+static uint32_t hop_bl;
+/* slot number and time within it, counted by hop_tick */
+static volatile uint8_t hop_slot, hop_ms;
+/* slots since the last packet of master (slave only) */
+static volatile uint8_t hop_missed;
+/* slot applied by the last hop_poll */
+static uint8_t hop_cur = 0xFF;
+/* slave follows master */
+static uint8_t hop_sync;
+/* blacklist entry sent in the next packet (master only) */
+static uint8_t hop_map_idx;
+
+/* returns sequence entry used in slot: blacklisted entry is replaced by the
+   next one that is not blacklisted */
+static uint8_t hop_slot_entry(uint8_t slot) {
+	uint8_t i, j = slot;
+	for (i = 0; i < hop_n; i++) {
+		if (!(hop_bl & (1UL << j))) return j;
+		if (++j == hop_n) j = 0;
+	}
+	return slot;
+}
+
+/* returns channel used in slot */
+static uint8_t hop_slot_channel(uint8_t slot) {
+	return hop_seq[hop_slot_entry(slot)];
+}
+
+/* changes channel keeping CE line, so RX mode continues at new channel */
+static void hop_set_channel(uint8_t ch) {
+	uint8_t ce = RFM73_CE_IS_HIGH ? 1 : 0;
+	RFM73_CE_LOW;
+	rfm73_set_channel(ch);
+	if (ce) RFM73_CE_HIGH;
+}
+
+/* returns number of entries that are not blacklisted */
+static uint8_t hop_active() {
+	uint8_t i, n = 0;
+	for (i = 0; i < hop_n; i++)
+		if (!(hop_bl & (1UL << i))) n++;
+	return n;
+}
+
+/* decays loss level of blacklisted entries once per sequence cycle and
+   returns them to sequence when channel had time to get quiet */
+static void hop_decay() {
+	uint8_t i;
+	for (i = 0; i < hop_n; i++) {
+		if (!(hop_bl & (1UL << i))) continue;
+		hop_loss[i] -= hop_loss[i] >> 5;
+		if (hop_loss[i] < HOP_BLACKLIST_LEVEL/2) hop_bl &= ~(1UL << i);
+	}
+}
+
+/* adds result of sending at sequence entry i to its loss level: lost packet
+   counts as 255, retransmits as 16 each */
+static void hop_account(uint8_t i, uint8_t result) {
+	uint8_t lost, rc, q;
+	rfm73_observe(&lost, &rc);
+	q = result ? 255 : rc*16;
+	hop_loss[i] = hop_loss[i] - (hop_loss[i] >> 2) + (q >> 2);
+	// at least half of channels are always kept
+	if ((hop_loss[i] >= HOP_BLACKLIST_LEVEL) && !(hop_bl & (1UL << i)) &&
+	    (hop_active() > hop_n/2))
+		hop_bl |= 1UL << i;
+}
+
+/*! \brief This function builds hopping sequence and starts hopping. Sequence
+is a pseudo-random permutation of channels first_ch, first_ch+step, ...,
+first_ch+(n-1)*step, the same on all nodes with the same seed. Slave waits at
+the first channel of sequence until it receives a packet from master.
+
+\param role - #HOP_MASTER or #HOP_SLAVE;
+\param seed - seed of sequence, must be the same on paired nodes;
+\param first_ch - the lowest channel;
+\param step - distance between channels, e.g. 3 to keep 2 MHz channels of
+              2 Mbps apart;
+\param n - number of channels (2-#HOP_MAX_CHANNELS, other values are
+           clamped), first_ch+(n-1)*step must not exceed 127.*/
+void hop_init(uint8_t role, uint16_t seed, uint8_t first_ch, uint8_t step,
+              uint8_t n) {
+	uint8_t i, j, t;
+	uint16_t x = seed ? seed : 1;
+	if (n < 2) n = 2;
+	if (n > HOP_MAX_CHANNELS) n = HOP_MAX_CHANNELS;
+	for (i = 0; i < n; i++) {
+		hop_seq[i] = (first_ch + i*step) & 0x7F;
+		hop_loss[i] = 0;
+	}
+	// Fisher-Yates shuffle with xorshift generator
+	for (i = n - 1; i > 0; i--) {
+		x ^= x << 7;
+		x ^= x >> 9;
+		x ^= x << 8;
+		j = x % (i + 1);
+		t = hop_seq[i];
+		hop_seq[i] = hop_seq[j];
+		hop_seq[j] = t;
+	}
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		hop_role = role;
+		hop_n = n;
+		hop_bl = 0;
+		hop_slot = 0;
+		hop_ms = 0;
+		hop_missed = 0;
+		hop_sync = (role == HOP_MASTER);
+	}
+	hop_map_idx = 0;
+	hop_cur = 0xFF;
+	hop_poll();
+}
+
+/*! \brief Time base of hopping. This function must be called every
+millisecond (e.g. from timer interrupt). It doesn't use SPI.*/
+void hop_tick() {
+	if (hop_n == 0) return;
+	if (++hop_ms >= HOP_SLOT_MS) {
+		hop_ms = 0;
+		if (++hop_slot >= hop_n) hop_slot = 0;
+		if (hop_missed < 0xFF) hop_missed++;
+	}
+}
+
+/*! \brief This function changes channel when slot is over. It must be called
+often enough from main loop, hop_send and hop_receive call it too.*/
+void hop_poll() {
+	uint8_t slot, missed;
+	if (hop_n == 0) return;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		slot = hop_slot;
+		missed = hop_missed;
+	}
+	if ((hop_role == HOP_SLAVE) && (missed >= HOP_SYNC_LOST_SLOTS))
+		hop_sync = 0;
+	// slave without master waits at the first channel
+	if (!hop_sync) slot = 0;
+	if (slot == hop_cur) return;
+	if ((hop_role == HOP_MASTER) && (slot == 0)) hop_decay();
+	hop_cur = slot;
+	hop_set_channel(hop_slot_channel(slot));
+}
+
+/*! \brief This function sends data at the current channel with hopping header
+(see rfm73_send_packet). With #RFM73_TX_WITH_ACK master measures quality of
+the channel.
+
+\param type - #RFM73_TX_WITH_ACK or #RFM73_TX_WITH_NOACK;
+\param pbuf - pointer to data;
+\param len  - length of data, mustn't exceed #HOP_MAX_PAYLOAD.
+
+\return Result of rfm73_send_packet.*/
+uint8_t hop_send(uint8_t type, const uint8_t* pbuf, uint8_t len) {
+	uint8_t buf[RFM73_MAX_PACKET_LEN], i, entry, res;
+	if (len > HOP_MAX_PAYLOAD) len = HOP_MAX_PAYLOAD;
+	hop_poll();
+	// loss is charged to entry whose channel is used, not to blacklisted
+	// entry of the slot
+	entry = hop_slot_entry(hop_cur);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		buf[0] = hop_slot;
+		buf[1] = hop_ms;
+	}
+	buf[2] = hop_map_idx | ((hop_bl & (1UL << hop_map_idx)) ? 0x80 : 0);
+	if (++hop_map_idx >= hop_n) hop_map_idx = 0;
+	for (i = 0; i < len; i++) buf[HOP_HEADER_LEN + i] = pbuf[i];
+	res = rfm73_send_packet(type, buf, HOP_HEADER_LEN + len);
+	// packet which was not sent tells nothing about the channel
+	if ((hop_role == HOP_MASTER) && (type == RFM73_TX_WITH_ACK) &&
+	    (res != RFM73_TX_NO_SLOT))
+		hop_account(entry, res);
+	return res;
+}
+
+/*! \brief This function takes received packet from RX queue (see
+rfm73_rx_get) and removes hopping header. Slave takes slot time and blacklist
+entry of master from it.
+
+\param data_buf - pointer to start of the input buffer (#HOP_MAX_PAYLOAD
+                  bytes);
+\param len  - length of received data.
+
+\return
+        - 0 - some data received;
+        - 1 - no packets received.*/
+uint8_t hop_receive(uint8_t* data_buf, uint8_t* len) {
+	rfm73_packet_t pkt;
+	uint8_t i, idx;
+	hop_poll();
+	if (rfm73_rx_get(&pkt)) return 1;
+	if (pkt.len < HOP_HEADER_LEN) return 1;
+	if ((hop_role == HOP_SLAVE) && (pkt.data[0] < hop_n) &&
+	    (pkt.data[1] < HOP_SLOT_MS)) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			hop_slot = pkt.data[0];
+			hop_ms = pkt.data[1];
+			hop_missed = 0;
+		}
+		idx = pkt.data[2] & 0x7F;
+		if (idx < hop_n) {
+			if (pkt.data[2] & 0x80) hop_bl |= 1UL << idx;
+			else                    hop_bl &= ~(1UL << idx);
+		}
+		hop_sync = 1;
+		hop_cur = 0xFF;
+		hop_poll();
+	}
+	*len = pkt.len - HOP_HEADER_LEN;
+	for (i = 0; i < *len; i++) data_buf[i] = pkt.data[HOP_HEADER_LEN + i];
+	return 0;
+}
+
+/*! \brief This function returns 1 if slave follows master. Master is always
+synchronized.*/
+uint8_t hop_synced() {
+	return hop_sync;
+}
+
+/*! \brief This function returns channel of the current slot.*/
+uint8_t hop_channel() {
+	return hop_cur == 0xFF ? rfm73_get_channel() : hop_slot_channel(hop_cur);
+}
+
+/*! \brief This function returns blacklist: bit i is set if channel i of
+sequence is replaced by the next one.*/
+uint32_t hop_blacklist() {
+	return hop_bl;
+}
@@ -0,0 +1,72 @@
+/*
+ * hop.h
+ *
+ * Frequency hopping link layer over RFM73 library. Paired nodes change
+ * channel every HOP_SLOT_MS following the same pseudo-random sequence built
+ * from a shared seed. Master keeps the time: every its packet carries slot
+ * number and time within the slot, slave adjusts its own slot timer on every
+ * received packet. Channels where packets of master are lost or retransmitted
+ * too often are blacklisted, blacklist is sent to slave one entry per packet.
+ *
+ * hop_tick must be called every millisecond (e.g. from the same timer as
+ * rfm73_tick), channel itself is changed by hop_poll, hop_send and
+ * hop_receive, so SPI is never used from the timer interrupt.
+ */
+
+
+#ifndef HOP_H_
+#define HOP_H_
+
+#include <inttypes.h>
+#include "RFM73.h"
+
+/*! \brief Maximum length of hopping sequence, one bit of blacklist each.*/
+#define HOP_MAX_CHANNELS           32
+/*! \brief Bytes of hopping header at the start of every packet: slot number,
+time within the slot in ms and blacklist entry (bit 7 - blacklisted, bits 0-6 -
+index in sequence).*/
+#define HOP_HEADER_LEN             3
+/*! \brief Maximum data size that could be sent in one hopping packet.*/
+#define HOP_MAX_PAYLOAD            (RFM73_MAX_PACKET_LEN - HOP_HEADER_LEN)
+
+/*! \brief Duration of one slot (time at one channel), ms. Must be the same on
+all nodes.*/
+#ifndef HOP_SLOT_MS
+	#define HOP_SLOT_MS            20
+#endif
+/*! \brief Loss level (0-255, moving average of packet quality) at which
+channel is blacklisted. Blacklisted channel returns to sequence when its level
+decays below half of this value.*/
+#ifndef HOP_BLACKLIST_LEVEL
+	#define HOP_BLACKLIST_LEVEL    128
+#endif
+/*! \brief Number of slots without packets from master after which slave
+stops hopping and waits at the first channel of sequence.*/
+#ifndef HOP_SYNC_LOST_SLOTS
+	#define HOP_SYNC_LOST_SLOTS    (2 * HOP_MAX_CHANNELS)
+#endif
+
+/*! \brief Role of the node: keeps the time and the blacklist.*/
+#define HOP_MASTER                 0
+/*! \brief Role of the node: follows the master.*/
+#define HOP_SLAVE                  1
+
+/* builds hopping sequence of n channels first_ch, first_ch+step... */
+void hop_init(uint8_t role, uint16_t seed, uint8_t first_ch, uint8_t step,
+              uint8_t n);
+/* time base of hopping, must be called every millisecond */
+void hop_tick();
+/* changes channel if slot is over */
+void hop_poll();
+/* sends data with hopping header at the current channel */
+uint8_t hop_send(uint8_t type, const uint8_t* pbuf, uint8_t len);
+/* receives packet and synchronizes slave with master */
+uint8_t hop_receive(uint8_t* data_buf, uint8_t* len);
+/* returns 1 if slave follows master (always 1 for master) */
+uint8_t hop_synced();
+/* returns channel of the current slot */
+uint8_t hop_channel();
+/* returns blacklist, bit i is set if sequence entry i is not used */
+uint32_t hop_blacklist();
+
+#endif /* HOP_H_ */
@@ -0,0 +1,283 @@
+/*
+ * hub.c
+ *
+ * Star network coordinator over RFM73 library (see hub.h).
+ */
+
+#include "hub.h"
+
+/* base address of the network */
+static uint8_t hub_base[5];
+/* leaf nodes */
+static hub_node_t hub_nodes[HUB_MAX_NODES];
+/* number of nodes */
+static uint8_t hub_n;
+/* node listened by every pipe or HUB_NONE */
+static uint8_t hub_pipe_node[HUB_PIPES];
+/* time of binding or of the last packet of every pipe */
+static uint16_t hub_pipe_ms[HUB_PIPES];
+/* time of the last rotation */
+static uint16_t hub_rotate_ms;
+/* nodes checked first by downlink loading and by rotation */
+static uint8_t hub_next_dl, hub_next_bind;
+/* sequence number of the next packet (leaf only) */
+static uint8_t hub_leaf_seq;
+
+/* makes address of node from base address */
+static void hub_addr(uint8_t* addr, const uint8_t* base, uint8_t id) {
+	uint8_t i;
+	addr[0] = id;
+	for (i = 1; i < 5; i++) addr[i] = base[i];
+}
+
+/* sets address of pipe to address of node and enables bound pipes */
+static void hub_bind(uint8_t pipe, uint8_t node) {
+	uint8_t addr[5], i, mask = 0;
+	uint8_t old = hub_pipe_node[pipe];
+	hub_node_t* nd = &hub_nodes[node];
+	if (old != HUB_NONE) hub_nodes[old].pipe = HUB_NONE;
+	hub_addr(addr, hub_base, nd->id);
+	switch (pipe) {
+		case 0: rfm73_set_rx_addr_p0(addr); break;
+		case 1: rfm73_set_rx_addr_p1(addr); break;
+		case 2: rfm73_set_rx_addr_p2(nd->id); break;
+		case 3: rfm73_set_rx_addr_p3(nd->id); break;
+		case 4: rfm73_set_rx_addr_p4(nd->id); break;
+		case 5: rfm73_set_rx_addr_p5(nd->id); break;
+	}
+	nd->pipe = pipe;
+	hub_pipe_node[pipe] = node;
+	hub_pipe_ms[pipe] = rfm73_millis();
+	for (i = 0; i < HUB_PIPES; i++)
+		if (hub_pipe_node[i] != HUB_NONE) mask |= 1 << i;
+	rfm73_set_en_pipelines(mask);
+}
+
+/* gives free pipe or pipe of the node idle for the longest time to the next
+   node without pipe; node with downlink data in TX FIFO keeps its pipe */
+static void hub_rotate(uint16_t now) {
+	uint8_t i, node = HUB_NONE, pipe = HUB_NONE;
+	uint16_t idle, max_idle = 0;
+	if (hub_n == 0) return;
+	for (i = 0; i < hub_n; i++) {
+		node = (hub_next_bind + i) % hub_n;
+		if (hub_nodes[node].pipe == HUB_NONE) break;
+	}
+	if (i == hub_n) return;
+	for (i = 0; i < HUB_PIPES; i++) {
+		if (hub_pipe_node[i] == HUB_NONE) {
+			pipe = i;
+			break;
+		}
+		if (hub_nodes[hub_pipe_node[i]].dl_loaded) continue;
+		idle = now - hub_pipe_ms[i];
+		if ((pipe == HUB_NONE) || (idle > max_idle)) {
+			max_idle = idle;
+			pipe = i;
+		}
+	}
+	if (pipe == HUB_NONE) return;
+	hub_bind(pipe, node);
+	hub_next_bind = node + 1;
+}
+
+/*! \brief This function sets base address of the star network and removes
+all nodes. All pipes are disabled until nodes are added, pending acknowledge
+payloads are dropped. Address width must be 5 bytes.
+
+\param base - base address, 5 bytes (the first byte is replaced by id of
+              node).*/
+void hub_init(const uint8_t* base) {
+	uint8_t i;
+	for (i = 0; i < 5; i++) hub_base[i] = base[i];
+	for (i = 0; i < HUB_PIPES; i++) hub_pipe_node[i] = HUB_NONE;
+	hub_n = 0;
+	hub_next_dl = 0;
+	hub_next_bind = 0;
+	hub_rotate_ms = rfm73_millis();
+	rfm73_ack_payload_flush();
+	rfm73_set_en_pipelines(0);
+}
+
+/*! \brief This function adds leaf node to the hub. Node gets free pipe if
+there is one, otherwise it waits for pipe rotation.
+
+\param id - id of the node (LSB of its address), must differ from id of
+            other nodes in all pipes.
+
+\return Index of the node (the same index if node was already added) or
+        #HUB_NONE if table is full.*/
+uint8_t hub_add(uint8_t id) {
+	uint8_t i;
+	hub_node_t* nd;
+	for (i = 0; i < hub_n; i++)
+		if (hub_nodes[i].id == id) return i;
+	if (hub_n == HUB_MAX_NODES) return HUB_NONE;
+	nd = &hub_nodes[hub_n];
+	nd->id = id;
+	nd->pipe = HUB_NONE;
+	nd->seq = 0;
+	nd->quality = 255;
+	nd->rx = 0;
+	nd->dup = 0;
+	nd->lost = 0;
+	nd->last_ms = rfm73_millis();
+	nd->tx = 0;
+	nd->dl_len = 0;
+	nd->dl_loaded = 0;
+	for (i = 0; i < HUB_PIPES; i++) {
+		if (hub_pipe_node[i] == HUB_NONE) {
+			hub_bind(i, hub_n);
+			break;
+		}
+	}
+	return hub_n++;
+}
+
+/*! \brief This function stores downlink data of the node. It is sent in
+acknowledge of the next packet of the node, after hub_poll loads it.
+
+\param node - index of the node (see hub_add);
+\param pbuf - pointer to data;
+\param len  - length of data, mustn't exceed 32.
+
+\return
+        - 0 - data stored;
+        - 1 - previous data of the node is not sent yet or there is no such
+              node, nothing done.*/
+uint8_t hub_send(uint8_t node, const uint8_t* pbuf, uint8_t len) {
+	uint8_t i;
+	hub_node_t* nd;
+	if (node >= hub_n) return 1;
+	nd = &hub_nodes[node];
+	if (nd->dl_len) return 1;
+	if (len > RFM73_MAX_PACKET_LEN) len = RFM73_MAX_PACKET_LEN;
+	for (i = 0; i < len; i++) nd->dl[i] = pbuf[i];
+	nd->dl_loaded = 0;
+	nd->dl_len = len;
+	return 0;
+}
+
+/*! \brief This function loads downlink data of nodes with pipes to TX FIFO
+(up to 3 nodes at once, see rfm73_ack_payload) and rotates pipes every
+#HUB_ROTATE_MS if there are more nodes than pipes. It must be called from
+main loop after received packets are taken by hub_receive.*/
+void hub_poll() {
+	uint8_t i, k;
+	uint16_t now = rfm73_millis();
+	hub_node_t* nd;
+	if (hub_n == 0) return;
+	// packet in RX queue could be acknowledged before loading, so it would be
+	// taken as acknowledge of loaded data
+	if (!rfm73_rx_available()) {
+		for (k = 0; k < hub_n; k++) {
+			i = (hub_next_dl + k) % hub_n;
+			nd = &hub_nodes[i];
+			if (!nd->dl_len || nd->dl_loaded || (nd->pipe == HUB_NONE))
+				continue;
+			if (rfm73_ack_payload(nd->pipe, nd->dl, nd->dl_len)) break;
+			nd->dl_loaded = 1;
+		}
+		if (++hub_next_dl >= hub_n) hub_next_dl = 0;
+	}
+	if ((hub_n > HUB_PIPES) &&
+	    ((uint16_t)(now - hub_rotate_ms) >= HUB_ROTATE_MS)) {
+		hub_rotate_ms = now;
+		hub_rotate(now);
+	}
+}
+
+/*! \brief This function takes received packet from RX queue (see
+rfm73_rx_get), finds its sender by pipe number and removes header. Duplicates
+and packets of pipes without node are dropped. Downlink data loaded for the
+sender is taken as sent.
+
+\param node - index of sender (see hub_add);
+\param data_buf - pointer to start of the input buffer (#HUB_MAX_PAYLOAD
+                  bytes);
+\param len  - length of received data.
+
+\return
+        - 0 - some data received;
+        - 1 - no packets received.*/
+uint8_t hub_receive(uint8_t* node, uint8_t* data_buf, uint8_t* len) {
+	rfm73_packet_t pkt;
+	uint8_t i, gap;
+	hub_node_t* nd;
+	while (rfm73_rx_get(&pkt) == 0) {
+		if (pkt.pipe >= HUB_PIPES) continue;
+		i = hub_pipe_node[pkt.pipe];
+		if ((i == HUB_NONE) || (pkt.len < HUB_HEADER_LEN)) continue;
+		nd = &hub_nodes[i];
+		nd->last_ms = rfm73_millis();
+		hub_pipe_ms[pkt.pipe] = nd->last_ms;
+		if (nd->dl_loaded) {
+			nd->dl_loaded = 0;
+			nd->dl_len = 0;
+			nd->tx++;
+		}
+		if (nd->rx && (pkt.data[0] == nd->seq)) {
+			nd->dup++;
+			continue;
+		}
+		// the first packet and restart of leaf (gap over half of range) don't
+		// count as losses
+		gap = pkt.data[0] - nd->seq - 1;
+		if (!nd->rx || (gap >= 128)) gap = 0;
+		nd->lost += gap;
+		if (gap > 8) gap = 8;
+		while (gap--) nd->quality -= (nd->quality + 7) >> 3;
+		nd->quality += (255 - nd->quality + 7) >> 3;
+		nd->seq = pkt.data[0];
+		nd->rx++;
+		*node = i;
+		*len = pkt.len - HUB_HEADER_LEN;
+		for (i = 0; i < *len; i++) data_buf[i] = pkt.data[HUB_HEADER_LEN + i];
+		return 0;
+	}
+	return 1;
+}
+
+/*! \brief This function returns state and statistics of the node.
+
+\param node - index of the node (see hub_add).
+
+\return Pointer to state or 0 if there is no such node.*/
+const hub_node_t* hub_node(uint8_t node) {
+	return node < hub_n ? &hub_nodes[node] : 0;
+}
+
+/*! \brief This function sets TX address and RX address of pipeline 0 (used
+for acknowledge) of leaf node to its address in the star network. Sequence
+numbers start from 0.
+
+\param base - base address of the hub, 5 bytes;
+\param id - id of the node.*/
+void hub_leaf_init(const uint8_t* base, uint8_t id) {
+	uint8_t addr[5];
+	hub_addr(addr, base, id);
+	rfm73_set_tx_addr(addr);
+	rfm73_set_rx_addr_p0(addr);
+	hub_leaf_seq = 0;
+}
+
+/*! \brief This function sends packet from leaf node to the hub with sequence
+number and returns downlink data received in acknowledge (see
+rfm73_send_request). Sequence number is advanced only when packet is
+acknowledged, so after failure the same data should be sent again.
+
+\param pbuf - pointer to data;
+\param len  - length of data, mustn't exceed #HUB_MAX_PAYLOAD;
+\param resp - packet structure to be filled with downlink data.
+
+\return Result of rfm73_send_request.*/
+uint8_t hub_leaf_send(const uint8_t* pbuf, uint8_t len, rfm73_packet_t* resp) {
+	uint8_t buf[RFM73_MAX_PACKET_LEN], i, res;
+	if (len > HUB_MAX_PAYLOAD) len = HUB_MAX_PAYLOAD;
+	buf[0] = hub_leaf_seq;
+	for (i = 0; i < len; i++) buf[HUB_HEADER_LEN + i] = pbuf[i];
+	res = rfm73_send_request(buf, HUB_HEADER_LEN + len, resp);
+	if ((res == RFM73_TX_DELIVERED) || (res == RFM73_TX_NO_PAYLOAD))
+		hub_leaf_seq++;
+	return res;
+}
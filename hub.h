@@ -0,0 +1,99 @@
+/*
+ * hub.h
+ *
+ * Star network coordinator over RFM73 library. Hub stays in RX mode and
+ * serves up to HUB_MAX_NODES leaf nodes. Node is identified by one byte id:
+ * its address is the base address of the hub with the first (LSB) byte
+ * replaced by id, so all nodes fit the six pipes of the module (pipes 2-5
+ * differ from pipe 1 only by LSB). When there are more nodes than pipes,
+ * pipes are rotated between nodes every HUB_ROTATE_MS: the node idle for the
+ * longest time gives its pipe to the next node without pipe. Leaf nodes must
+ * retry sending (e.g. with arq_send) until their address is listened.
+ *
+ * Every uplink packet starts with one byte sequence number of the leaf, so
+ * the hub drops duplicates of software retries and counts lost packets and
+ * link quality of every node. Downlink data is sent in acknowledge payloads
+ * (see rfm73_ack_payload): hub_send stores it, hub_poll loads it for the pipe
+ * of the node and the node gets it with the acknowledge of its next packet
+ * (see hub_leaf_send).
+ *
+ * Received packets are taken from RX queue (see rfm73_rx_get), time is taken
+ * from rfm73_millis, so rfm73_tick must be called every millisecond.
+ */
+
+
+#ifndef HUB_H_
+#define HUB_H_
+
+#include <inttypes.h>
+#include "RFM73.h"
+
+/*! \brief Maximum number of leaf nodes.*/
+#ifndef HUB_MAX_NODES
+	#define HUB_MAX_NODES          12
+#endif
+/*! \brief Period of pipe rotation, ms. Node without pipe waits for it up to
+(number of nodes - 6) periods, node with pipe should send a packet in this
+time to keep it.*/
+#ifndef HUB_ROTATE_MS
+	#define HUB_ROTATE_MS          50
+#endif
+
+/*! \brief Number of receive pipes of the module.*/
+#define HUB_PIPES                  6
+/*! \brief Bytes of header at the start of every uplink packet: sequence
+number.*/
+#define HUB_HEADER_LEN             1
+/*! \brief Maximum data size that could be sent in one uplink packet.*/
+#define HUB_MAX_PAYLOAD            (RFM73_MAX_PACKET_LEN - HUB_HEADER_LEN)
+/*! \brief Value of hub_node_t::pipe and result of hub_add: no pipe or no
+node.*/
+#define HUB_NONE                   0xFF
+
+/*! \brief State and statistics of one leaf node.*/
+typedef struct {
+	/*! \brief Id of the node (LSB of its address).*/
+	uint8_t id;
+	/*! \brief Pipe listening to the node or #HUB_NONE.*/
+	uint8_t pipe;
+	/*! \brief Sequence number of the last packet.*/
+	uint8_t seq;
+	/*! \brief Link quality (moving average, 255 - no losses, 0 - all packets
+	lost), counted from gaps of sequence numbers.*/
+	uint8_t quality;
+	/*! \brief Packets received.*/
+	uint16_t rx;
+	/*! \brief Duplicates dropped.*/
+	uint16_t dup;
+	/*! \brief Packets lost (gaps of sequence numbers).*/
+	uint16_t lost;
+	/*! \brief Time of the last packet (see rfm73_millis), ms.*/
+	uint16_t last_ms;
+	/*! \brief Downlink packets sent in acknowledge.*/
+	uint16_t tx;
+	/*! \brief Length of downlink data waiting for the node, 0 if none.*/
+	uint8_t dl_len;
+	/*! \brief Downlink data is loaded to TX FIFO.*/
+	uint8_t dl_loaded;
+	/*! \brief Downlink data.*/
+	uint8_t dl[RFM73_MAX_PACKET_LEN];
+} hub_node_t;
+
+/* sets base address of the star network, removes all nodes */
+void hub_init(const uint8_t* base);
+/* adds leaf node, returns its index */
+uint8_t hub_add(uint8_t id);
+/* stores downlink data sent in acknowledge to the node */
+uint8_t hub_send(uint8_t node, const uint8_t* pbuf, uint8_t len);
+/* loads downlink data to acknowledges and rotates pipes */
+void hub_poll();
+/* takes received packet, returns index of sender */
+uint8_t hub_receive(uint8_t* node, uint8_t* data_buf, uint8_t* len);
+/* returns state of the node */
+const hub_node_t* hub_node(uint8_t node);
+/* sets addresses of leaf node */
+void hub_leaf_init(const uint8_t* base, uint8_t id);
+/* sends packet from leaf node to the hub, returns downlink data */
+uint8_t hub_leaf_send(const uint8_t* pbuf, uint8_t len, rfm73_packet_t* resp);
+
+#endif /* HUB_H_ */
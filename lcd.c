@@ -12,9 +12,20 @@
 #include <util/delay.h>
 #include <avr/pgmspace.h>
 #include <avr/io.h>
+#include <inttypes.h>
 
 
-#define lcd_putc(x)  lcd_putbyte(x, LCD_DATA)
+#define LCD_CELLS    (LCD_ROWS*LCD_COLS)
+
+/* framebuffer: cell n is character of row n/LCD_COLS, column n%LCD_COLS;
+   bit n of lcd_dirty is set when cell n is changed and not sent yet */
+static char lcd_fb[LCD_CELLS];
+static volatile uint8_t lcd_dirty[(LCD_CELLS+7)/8];
+/* cell written by lcd_puts */
+static uint8_t lcd_cur = 0;
+/* DDRAM address of the next character (0xFF - unknown) and cell from which
+   changed cells are searched */
+static uint8_t lcd_addr = 0xFF, lcd_next = 0;
 
 /*      */
 void lcd_putnibble(char t)
@@ -61,14 +72,27 @@ void lcd_init()
     _delay_ms(1);
     lcd_putbyte(0x06, LCD_COMMAND);
     _delay_ms(1);
+    // display could keep characters from before reset, so all cells are sent
+    for (uint8_t n = 0; n < LCD_CELLS; n++) lcd_fb[n] = ' ';
+    for (uint8_t i = 0; i < sizeof(lcd_dirty); i++) lcd_dirty[i] = 0xFF;
+    lcd_addr = 0xFF;
+}
+
+/* puts character to cell of framebuffer, marks it if it is changed */
+static void lcd_fb_put(uint8_t n, char c)
+{
+	if (lcd_fb[n] == c) return;
+	lcd_fb[n] = c;
+	// interrupt only clears bits, so lost clear just sends cell again
+	lcd_dirty[n >> 3] |= 1 << (n & 7);
 }
 
 /*     
    */
 void lcd_clear()
 {
-    lcd_putbyte(0x01, LCD_COMMAND);
-    _delay_us(1500);
+	for (uint8_t n = 0; n < LCD_CELLS; n++) lcd_fb_put(n, ' ');
+	lcd_cur = 0;
 }
 
 /*      
@@ -76,15 +100,66 @@ col - 
 row -   (0  1) */
 void lcd_gotoxy(char col, char row)
 {
-  char adr;                                           
-  adr=0x40*row+col; 
-  adr|=0x80;
-  lcd_putbyte(adr, LCD_COMMAND);
+	if (((uint8_t)col >= LCD_COLS) || ((uint8_t)row >= LCD_ROWS))
+		lcd_cur = LCD_CELLS;
+	else
+		lcd_cur = row*LCD_COLS + col;
 }
 
+/* characters after the end of row are not shown */
 void lcd_puts(char* s) {
-	while (*s!=0) {
-		lcd_putc(*(s++));
+	uint8_t end = (lcd_cur/LCD_COLS + 1)*LCD_COLS;
+	while ((*s!=0) && (lcd_cur < end) && (lcd_cur < LCD_CELLS))
+		lcd_fb_put(lcd_cur++, *(s++));
+}
+
+/* writes nibble without waiting for its execution, E pulse only */
+static void lcd_putnibble_fast(char t)
+{
+	LCD_E_SET;
+	PORTC = (PORTC & 0x0F) | ((t & 0x0F) << 4);
+	_delay_us(1);
+	LCD_E_CLR;
+	_delay_us(1);
+}
+
+/* writes byte without waiting for its execution */
+static void lcd_putbyte_fast(char c, char rs)
+{
+	if (rs==LCD_COMMAND) LCD_RS_CLR;
+	else                 LCD_RS_SET;
+	lcd_putnibble_fast(c >> 4);
+	lcd_putnibble_fast(c);
+}
+
+/* one write is done per LCD_EXEC_US, so the time between calls covers
+   execution of the last one */
+void lcd_tick()
+{
+	uint8_t i, k, n = 0, addr;
+	for (i = 0, k = 0; i < sizeof(lcd_dirty); i++) k |= lcd_dirty[i];
+	if (!k) return;
+	for (i = 0; i < LCD_TICK_WRITES; i++) {
+		if (i) _delay_us(LCD_EXEC_US);
+		// changed cell next to the last sent one goes first, so address
+		// counter of display is used without setting it
+		for (k = 0; k < LCD_CELLS; k++) {
+			n = lcd_next + k;
+			if (n >= LCD_CELLS) n -= LCD_CELLS;
+			if (lcd_dirty[n >> 3] & (1 << (n & 7))) break;
+		}
+		if (k == LCD_CELLS) return;
+		addr = 0x40*(n/LCD_COLS) + n%LCD_COLS;
+		if (addr != lcd_addr) {
+			lcd_putbyte_fast(0x80 | addr, LCD_COMMAND);
+			lcd_addr = addr;
+			lcd_next = n;
+			continue;
+		}
+		lcd_dirty[n >> 3] &= ~(1 << (n & 7));
+		lcd_putbyte_fast(lcd_fb[n], LCD_DATA);
+		lcd_addr++;
+		lcd_next = (n + 1 < LCD_CELLS) ? n + 1 : 0;
 	}
 }
 
@@ -231,6 +231,17 @@
   */
 #define LCD_DATA     1             
 
+/* size of display */
+#define LCD_ROWS     2
+#define LCD_COLS     16
+
+/* bus writes (commands or characters) done by one lcd_tick */
+#ifndef LCD_TICK_WRITES
+	#define LCD_TICK_WRITES  1
+#endif
+/* execution time of one write by controller, us */
+#define LCD_EXEC_US  40
+
 
 
 extern void lcd_putbyte(char c, char rs);
@@ -245,6 +256,10 @@ col - 
 row -   (0  1) */
 extern void lcd_gotoxy(char col, char row);
 extern void lcd_puts(char* s);
+/* lcd_clear, lcd_gotoxy and lcd_puts only change framebuffer in RAM,
+this function sends its changed characters to display; it is called
+from timer interrupt (every millisecond) */
+extern void lcd_tick();
 
 
 
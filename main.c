@@ -8,6 +8,13 @@
 #include "lcd.h"
 #include "uart.h"
 #include "spi.h"
+#ifdef RFM73_CAPTURE
+	#include "cap.h"
+#endif
+#ifdef RFM73_WOR
+	#include "wor.h"
+	#include <avr/sleep.h>
+#endif
 
 #define CS_LED	   PA2
 
@@ -16,13 +23,10 @@
 
 
 unsigned char t1 = 0;
-
-static FILE mystdout = FDEV_SETUP_STREAM(uart_putchar, NULL,
-                                            _FDEV_SETUP_WRITE);
-
+/* set by RFM73 IRQ when new packet is received */
+volatile unsigned char rx_ready = 0;
 
 const uint8_t tx_buf[17]={0x30,0x31,0x32,0x33,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x3b,0x3c,0x3d,0x3e,0x3f,0x78};
-uint8_t rx_buf[RFM73_MAX_PACKET_LEN];
 
 /*********************************************************
 Function: init_port();                                         
@@ -52,6 +56,20 @@ void timer2_init(void)
 	TIMSK |= (1 << TOIE1);
 }
 
+/*********************************************************
+Function: timer0_init();                                         
+                                                            
+Description:                                                
+	1 ms time base of RFM73 driver: TIMER0 in CTC mode,
+	fck/64.
+*********************************************************/
+void timer0_init(void)
+{
+	OCR0 = F_CPU/64/1000 - 1;
+	TCCR0 = (1 << WGM01) | (1 << CS02);
+	TIMSK |= (1 << OCIE0);
+}
+
 /*********************************************************
 Function: init_mcu();                                         
                                                             
@@ -64,9 +82,11 @@ void init_mcu(void)
 	init_port();
 	spi_init();
 	timer2_init();
+	timer0_init();
 	lcd_init();
 	uart_init(0, 38400);
-	stdout = &mystdout;
+	// output is buffered and sent by interrupt
+	stdout = &uart_stdout;
 	lcd_clear();
 	sprintf_P(lcd_buf, PSTR("Hello from RX...")); // Change to RX
 	printf_P(PSTR("\033[2JHello from RFM73...\n"));
@@ -86,6 +106,310 @@ ISR(TIMER1_OVF_vect) {
 	TCNT1 = 65535-7250;
 }
 
+/*********************************************************
+Function:  ISR(TIMER0_COMP_vect)
+                                                            
+Description:                                                
+	calls rfm73_tick every millisecond and refreshes
+	LCD from its framebuffer.
+*********************************************************/
+ISR(TIMER0_COMP_vect) {
+	rfm73_tick();
+	lcd_tick();
+}
+
+/*********************************************************
+Function:  on_rx_dr()
+                                                            
+Description:                                                
+	called from RFM73 IRQ interrupt when packet is received.
+*********************************************************/
+void on_rx_dr(uint8_t status)
+{
+	rx_ready = 1;
+}
+
+#ifdef SPI_BENCH
+/*********************************************************
+Function:  spi_bench()
+                                                            
+Description:                                                
+	measures CPU cycles of 32-byte SPI block transfer done
+	byte by byte (spi_read) and pipelined (spi_transfer).
+	TIMER3 runs at fck, so its counts are cycles. Build with
+	-DSPI_BACKEND=0 or 1 and -DSPI_CLOCK_DIV=... to compare
+	backends. CSN stays high, so RFM73 is not affected.
+*********************************************************/
+void spi_bench(void)
+{
+	uint8_t i, buf[RFM73_MAX_PACKET_LEN];
+	uint16_t t0, t_empty, t_read, t_block;
+
+	TCCR3A = 0;
+	TCCR3B = (1 << CS30);
+	cli();
+	t0 = TCNT3;
+	t_empty = TCNT3 - t0;
+	t0 = TCNT3;
+	for (i = 0; i < RFM73_MAX_PACKET_LEN; i++)
+		buf[i] = spi_read(0);
+	t_read = TCNT3 - t0 - t_empty;
+	t0 = TCNT3;
+	spi_transfer(0, buf, RFM73_MAX_PACKET_LEN);
+	t_block = TCNT3 - t0 - t_empty;
+	sei();
+	TCCR3B = 0;
+	printf_P(PSTR("SPI backend %d, fck/%d: spi_read x32 = %u cycles, spi_transfer 32 = %u cycles\n"),
+	         SPI_BACKEND, SPI_CLOCK_DIV, t_read, t_block);
+}
+#endif
+
+#ifdef RFM73_SURVEY
+#define SURVEY_SAMPLES 50
+
+/*********************************************************
+Function:  survey_stream()
+                                                            
+Description:                                                
+	endless survey of air (see rfm73_survey). Every sweep
+	is sent to UART as binary frame of 133 bytes:
+	0xA5 0x5A - sync;
+	seq       - number of sweep (mod 256);
+	samples   - samples per channel (SURVEY_SAMPLES);
+	hist[128] - number of samples with carrier detected,
+	            channel 0 first;
+	sum       - sum of seq, samples and hist (mod 256).
+	Channels with the lowest hist/samples are the quietest.
+*********************************************************/
+void survey_stream(void)
+{
+	uint8_t hist[RFM73_SURVEY_CHANNELS], hdr[4], sum, seq = 0, i;
+	
+	while (1) {
+		if (rfm73_survey(hist, SURVEY_SAMPLES)) continue;
+		hdr[0] = 0xA5;
+		hdr[1] = 0x5A;
+		hdr[2] = seq++;
+		hdr[3] = SURVEY_SAMPLES;
+		sum = hdr[2] + hdr[3];
+		for (i = 0; i < RFM73_SURVEY_CHANNELS; i++) sum += hist[i];
+		uart_write(hdr, sizeof(hdr));
+		uart_write(hist, sizeof(hist));
+		uart_write(&sum, 1);
+	}
+}
+#endif
+
+#ifdef RFM73_CAPTURE
+/*********************************************************
+Function:  capture_stream()
+                                                            
+Description:                                                
+	endless capture of received packets (see cap.h).
+	Every packet is sent to UART as binary record with
+	time, channel, pipe, STATUS and OBSERVE_TX, nothing
+	else is printed. Records that don't fit UART buffer
+	are dropped whole and counted in the next record.
+	Recording is converted to pcap by tools/cap2pcap.
+*********************************************************/
+void capture_stream(void)
+{
+	rfm73_irq_enable(0, 0, 0);
+	cap_init(uart_try_write);
+	while (1) cap_poll();
+}
+#endif
+
+#ifdef RFM73_WOR
+#define WOR_PERIOD_MS  500
+#define WOR_WINDOW_MS  4
+
+/*********************************************************
+Function:  ISR(TIMER1_COMPA_vect)
+                                                            
+Description:                                                
+	1 ms time base of duty cycle, TIMER1 in CTC mode.
+*********************************************************/
+ISR(TIMER1_COMPA_vect) {
+	wor_tick();
+}
+
+/*********************************************************
+Function:  wor_loop()
+                                                            
+Description:                                                
+	endless duty-cycled receiving (RX_DEVICE) or sending
+	of a packet every 2 s to duty-cycled receiver
+	(TX_DEVICE). TIMER1 is switched from timer2_init
+	settings to 1 ms CTC interrupt, MCU sleeps in idle
+	mode between interrupts. First estimated average
+	current of module versus wake latency (period) is
+	printed, then receiver prints measured current
+	after every packet.
+*********************************************************/
+void wor_loop(void)
+{
+	static const uint16_t periods[] = { 20, 50, 100, 250, 500, 1000, 2000 };
+	uint8_t i;
+
+	TIMSK &=~(1 << TOIE1);
+	TCCR1A = 0;
+	TCCR1B = (1 << WGM12) | (1 << CS11);
+	OCR1A = F_CPU/8/1000 - 1;
+	TIMSK |= (1 << OCIE1A);
+	
+	printf_P(PSTR("window %u ms\nlatency_ms,current_uA\n"), WOR_WINDOW_MS);
+	for (i = 0; i < sizeof(periods)/sizeof(periods[0]); i++)
+		printf_P(PSTR("%u,%u\n"), periods[i],
+		         wor_estimate_ua(periods[i], WOR_WINDOW_MS));
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	#ifdef RX_DEVICE
+		rfm73_packet_t* rx;
+		rfm73_irq_enable(on_rx_dr, 0, 0);
+		wor_start(WOR_PERIOD_MS, WOR_WINDOW_MS);
+		while (1) {
+			wor_poll();
+			if (rfm73_receive_slot(RFM73_RX_WITH_NOACK, &rx) == 0) {
+				const wor_stats_t* st = wor_stats();
+				printf_P(PSTR("rx %u bytes, windows %u, wakeups %u, %u uA\n"),
+				         rx->len, st->windows, st->wakeups, wor_current_ua());
+				rfm73_slot_free(rx);
+			}
+			sleep_mode();
+		}
+	#endif
+	#ifdef TX_DEVICE
+		uint16_t t0;
+		while (1) {
+			t0 = rfm73_millis();
+			GREEN_LED_SET;
+			if (wor_send(tx_buf, sizeof(tx_buf), WOR_PERIOD_MS, WOR_WINDOW_MS))
+				RED_LED_SET;
+			else
+				RED_LED_CLR;
+			GREEN_LED_CLR;
+			while ((uint16_t)(rfm73_millis() - t0) < 2000) sleep_mode();
+		}
+	#endif
+}
+#endif
+
+#ifdef RFM73_BENCH
+/* CSV record format, the same as in sim/sim_bench.c */
+#define BENCH_PACKETS 100
+#define BENCH_LEN     RFM73_MAX_PACKET_LEN
+
+static volatile uint16_t bench_ovf;
+
+/*********************************************************
+Function:  ISR(TIMER3_OVF_vect)
+                                                            
+Description:                                                
+	counts high word of benchmark cycle counter.
+*********************************************************/
+ISR(TIMER3_OVF_vect) {
+	bench_ovf++;
+}
+
+/*********************************************************
+Function:  bench_start()
+                                                            
+Description:                                                
+	starts TIMER3 at fck and clears SPI byte counter.
+*********************************************************/
+void bench_start(void)
+{
+	TCCR3B = 0;
+	TCCR3A = 0;
+	TCNT3 = 0;
+	bench_ovf = 0;
+	ETIFR = (1 << TOV3);
+	ETIMSK |= (1 << TOIE3);
+	spi_bytes = 0;
+	TCCR3B = (1 << CS30);
+}
+
+/*********************************************************
+Function:  bench_report()
+                                                            
+Description:                                                
+	stops TIMER3 and prints CSV record: platform, op,
+	rate_kbps, ack, n, spi_bytes, cycles, time_us,
+	pkt_per_s, goodput_Bps. ok is number of packets
+	delivered.
+*********************************************************/
+void bench_report(PGM_P op, uint16_t kbps, uint8_t ack, uint16_t n,
+                  uint16_t ok)
+{
+	uint32_t cycles, us, pps;
+	TCCR3B = 0;
+	ETIMSK &=~(1 << TOIE3);
+	// overflow that happened right before stop
+	if (ETIFR & (1 << TOV3)) bench_ovf++;
+	cycles = ((uint32_t)bench_ovf << 16) | TCNT3;
+	us = cycles / (F_CPU/1000000UL);
+	if (us == 0) us = 1;
+	pps = (uint32_t)ok * 1000000UL / us;
+	printf_P(PSTR("avr,%S,%u,%u,%u,%lu,%lu,%lu,%lu,%lu\n"), op, kbps, ack, n,
+	         spi_bytes, cycles, us, pps, pps * BENCH_LEN);
+}
+
+/*********************************************************
+Function:  rfm73_bench()
+                                                            
+Description:                                                
+	measures rfm73_init, rfm73_send_packet at every data
+	rate with and without ACK (receiver board must be on
+	the same channel), empty rfm73_receive_packet and
+	rfm73_find_receiver. Results are printed to UART.
+*********************************************************/
+void rfm73_bench(void)
+{
+	static const uint8_t rates[] = { RFM73_DATA_RATE_250KBPS,
+	                                 RFM73_DATA_RATE_1MBPS,
+	                                 RFM73_DATA_RATE_2MBPS };
+	static const uint16_t kbps[] = { 250, 1000, 2000 };
+	uint8_t buf[BENCH_LEN], len, r, ack, ch = 0, dr = 0;
+	uint16_t i, ok;
+
+	printf_P(PSTR("platform,op,rate_kbps,ack,n,spi_bytes,cycles,time_us,pkt_per_s,goodput_Bps\n"));
+	bench_start();
+	if (rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	               RFM73_DATA_RATE_2MBPS, 0x23)) {
+		printf_P(PSTR("RFM73 doesn't answer\n"));
+		return;
+	}
+	bench_report(PSTR("init"), 2000, 0, 1, 0);
+
+	for (i = 0; i < BENCH_LEN; i++) buf[i] = i;
+	for (r = 0; r < 3; r++) {
+		rfm73_set_rf_params(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+		                    rates[r]);
+		for (ack = 0; ack < 2; ack++) {
+			ok = 0;
+			bench_start();
+			for (i = 0; i < BENCH_PACKETS; i++)
+				if (!rfm73_send_packet(ack ? RFM73_TX_WITH_ACK :
+				                       RFM73_TX_WITH_NOACK, buf, BENCH_LEN))
+					ok++;
+			bench_report(PSTR("send_packet"), kbps[r], ack, BENCH_PACKETS, ok);
+		}
+	}
+
+	rfm73_rx_mode();
+	bench_start();
+	for (i = 0; i < BENCH_PACKETS; i++)
+		rfm73_receive_packet(RFM73_RX_WITH_NOACK, buf, &len);
+	bench_report(PSTR("receive_packet_empty"), 2000, 0, BENCH_PACKETS, 0);
+
+	bench_start();
+	ok = rfm73_find_receiver(&ch, &dr);
+	// n is 1 if receiver was found
+	bench_report(PSTR("find_receiver"), 0, 1, ok, 0);
+}
+#endif
+
 /*********************************************************
 Function:      power_on_delay()                                    
                                                             
@@ -106,30 +430,37 @@ Description:
 void sub_program_1hz(void)
 {
 	uint8_t i;
-	uint8_t temp_buf[32];
-	static uint16_t cnt = 0, cnt_good = 0;
+	rfm73_packet_t* slot;
+	rfm73_stats_t st;
 	char lcd_buf[16];
 
 	if(t1)
 	{
 		t1 = 0;
 		
-		for(i=0;i<17;i++)
-		{
-			temp_buf[i]=tx_buf[i];
+		// packet is built in slot of the library and written to TX FIFO
+		// straight from it
+		slot = rfm73_slot_alloc();
+		if (slot) {
+			for(i=0;i<17;i++)
+			{
+				slot->data[i]=tx_buf[i];
+			}
+			slot->len = 17;
+			if (rfm73_send_slot(RFM73_TX_WITH_ACK, slot))
+				rfm73_slot_free(slot);
+			while (rfm73_send_status() == RFM73_TX_BUSY) ;
 		}
-		
-		uint8_t res = rfm73_send_packet(RFM73_TX_WITH_ACK, temp_buf, 17);
-		if (!res) cnt_good++;
-		if (cnt_good==1000) cnt_good=0;
-		uint8_t pl=0, rc=0;
-		rfm73_observe(&pl, &rc);
+		// counters of the library don't wrap like LCD fields
+		rfm73_stats(&st, 0);
 		uint8_t ch=rfm73_get_channel();
-		sprintf_P(lcd_buf, PSTR("R=%3d;L=%2d;C=%d "), cnt_good, pl, ch);
+		sprintf_P(lcd_buf, PSTR("R=%3d;L=%2d;C=%d "),
+		          (uint16_t)(st.tx_acked % 1000),
+		          (uint8_t)(st.tx_failed % 100), ch);
 		lcd_gotoxy(0, 1);
 		lcd_puts(lcd_buf);
-		temp_buf[RFM73_MAX_PACKET_LEN-1]=0;
-		printf_P(PSTR("Sent and received packet %s\nTotal transmittions: %d, no errors for %d times"), temp_buf, cnt, cnt_good);
+		printf_P(PSTR("Sent and received packet %.17s\nTotal transmittions: %lu, acknowledged %lu, failed %lu\n"),
+		         (const char*)tx_buf, st.tx_sent, st.tx_acked, st.tx_failed);
 		rfm73_rx_mode();  //switch to Rx mode
 	}	
 }
@@ -192,40 +523,86 @@ int main(void)
 	
 	uint16_t cnt = 0, cnt2 = 0;
 	static char lcd_buf[20];
-	uint8_t rx_buf[RFM73_MAX_PACKET_LEN];
 	uint8_t pwr = RFM73_OUT_PWR_PLUS5DBM;
 	uint8_t gain = RFM73_LNA_GAIN_HIGH;
 	uint8_t dr = RFM73_DATA_RATE_2MBPS;
-	uint8_t pl = 0, rc = 0, cs = 0, len = 0;
+	uint8_t pl = 0, rc = 0, cs = 0;
 	uint8_t ch = 0;
 	uint8_t b = 0;
 
-	rfm73_init(pwr, gain, dr, 0x23);
+	#ifdef RFM73_BENCH
+		rfm73_bench();
+	#endif
+	// module is configured and powered up in background
+	rfm73_init_async(pwr, gain, dr, 0x23);
+	while (rfm73_poll() != RFM73_STATE_RX) {
+		// LCD, UART or sensors could be served here
+	}
+	#ifdef SPI_BENCH
+		spi_bench();
+	#endif
+	#ifdef RFM73_SURVEY
+		survey_stream();
+	#endif
+	#ifdef RFM73_CAPTURE
+		capture_stream();
+	#endif
+	#ifdef RFM73_WOR
+		wor_loop();
+	#endif
+	#ifdef RX_DEVICE
+		rfm73_irq_enable(on_rx_dr, 0, 0);
+	#endif
 	#ifdef TX_DEVICE
 		sprintf_P(lcd_buf, PSTR("Finding receiver"));
 		lcd_gotoxy(0, 1);
 		lcd_puts(lcd_buf);
-		// auto-find first receiver
+		// auto-find first receiver, starting from the last one found (it
+		// is kept in EEPROM by the library, so it survives power cycle)
 		RFM73_CE_HIGH;
-		rfm73_find_receiver(&ch, &dr);
+		rfm73_scan_last(&ch, &dr);
+		rfm73_scan_start(ch, dr, RFM73_SCAN_FAST | RFM73_SCAN_FULL);
+		while (rfm73_scan_step() == RFM73_SCAN_RUNNING) {
+			const rfm73_scan_t* scan = rfm73_scan_state();
+			if (scan->probes % 16 == 0) {
+				sprintf_P(lcd_buf, PSTR("Scan %3u/%3u %c"), scan->probes,
+				          scan->total, scan->pass ? 'F' : 'Q');
+				lcd_gotoxy(0, 1);
+				lcd_puts(lcd_buf);
+			}
+		}
+		if (rfm73_scan_state()->result == RFM73_SCAN_FOUND) {
+			ch = rfm73_scan_state()->ch;
+			dr = rfm73_scan_state()->dr;
+		}
+		printf_P(PSTR("scan: %u probes, %u ms\n"), rfm73_scan_state()->probes,
+		         rfm73_scan_state()->elapsed_ms);
 	#endif
 	repaint(pwr, gain, dr);
+	// packet log mustn't hold radio loop: what doesn't fit buffer is dropped
+	uart_set_overflow(UART_OVF_DROP);
 	while(1)
 	{
-		RFM73_CE_HIGH;
-		// sensing the carrier
-		_delay_us(400);
-		uint8_t cd = rfm73_carrier_detect();
-		if (cd) CS_LED_SET;
-		else    CS_LED_CLR;
+		// sensing the carrier when PLL is locked, without waiting for it
+		if (rfm73_poll() == RFM73_STATE_RX) {
+			uint8_t cd = rfm73_carrier_detect();
+			if (cd) CS_LED_SET;
+			else    CS_LED_CLR;
+		}
 	#ifdef TX_DEVICE
 		sub_program_1hz(); // comment to use in RX
-		RFM73_CE_LOW;
 	#endif
 	#ifdef RX_DEVICE
-		_delay_ms(50);
-		uint8_t res = rfm73_receive_packet(RFM73_RX_WITH_ACK, rx_buf, &len); // 1 to RX, 0 to TX
-		RFM73_CE_LOW;
+		uint8_t res = 3;
+		rfm73_packet_t* rx = 0;
+		// new packet (from IRQ), packets left in RX queue or time to repaint
+		// status (from timer)
+		if (rx_ready || rfm73_rx_available() || t1) {
+			rx_ready = 0;
+			t1 = 0;
+			// packet stays in slot of the library, no copy is made
+			res = rfm73_receive_slot(RFM73_RX_WITH_ACK, &rx); // 1 to RX, 0 to TX
+		}
 		// new correct data
 		if (res == 0) {
 			cs=rfm73_carrier_detect();
@@ -233,8 +610,8 @@ int main(void)
 			sprintf_P(lcd_buf, PSTR("R=%3d;CS=%1d;C=%d"), ++cnt, cs, ch);
 			lcd_gotoxy(0, 1);
 			lcd_puts(lcd_buf);
-			rx_buf[len] = 0;
-			printf_P(PSTR("Received packet: %s\nTotal packets: %d\nCurrent channel: %d\n"), rx_buf, cnt, ch);
+			printf_P(PSTR("Received packet: %.*s\nTotal packets: %d\nCurrent channel: %d\n"), rx->len, (const char*)rx->data, cnt, ch);
+			rfm73_slot_free(rx);
 			if (cnt==999) cnt = 0;
 		};
 		// input fifo was flushed
@@ -243,7 +620,6 @@ int main(void)
 			sprintf_P(lcd_buf, PSTR("R=%3d FLUSHED!"), ++cnt2);
 			lcd_gotoxy(0, 1);
 			lcd_puts(lcd_buf);
-			rx_buf[len] = 0;
 			printf_P(PSTR("Received packet flushed!\nTotal correct packets: %d\n"), cnt);
 			if (cnt2==999) cnt2 = 0;
 		}
@@ -253,7 +629,7 @@ int main(void)
 			sprintf_P(lcd_buf, PSTR("R=%3d;CS=%1d;C=%d"), cnt, cs, ch);
 			lcd_gotoxy(0, 1);
 			lcd_puts(lcd_buf);
-			//printf_P(PSTR("Received packet: %s with correct CRC\nTotal correct packets: %d\n"), rx_buf, cnt2);	
+			//printf_P(PSTR("Received packet: %s with correct CRC\nTotal correct packets: %d\n"), rx->data, cnt2);	
 		}
 	#endif
 		uint8_t a = PINA & 0xF8;
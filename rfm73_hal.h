@@ -0,0 +1,151 @@
+/*
+ * rfm73_hal.h
+ *
+ * Hardware abstraction layer of RFM73 library: pins of the module, delays,
+ * atomic blocks, IRQ interrupt and non-volatile memory. RFM73.c touches
+ * hardware only through these macros and spi.h functions.
+ *
+ * Target build (default) uses AVR registers below. Host build (RFM73_HOST
+ * defined) maps everything to simulated module from sim/rfm73_sim.h, so
+ * library could be compiled with gcc and run on PC.
+ */ 
+
+
+#ifndef RFM73_HAL_H_
+#define RFM73_HAL_H_
+
+#include <inttypes.h>
+
+#ifndef RFM73_HOST
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+#include <util/atomic.h>
+
+/*! \brief Pin number of IRQ contact on RFM73 module. It must be an external
+interrupt pin, PB5 of ATmega128 can't generate interrupts.*/
+#define RFM73_IRQ_PIN     PE4
+/*! \brief PORT register to IRQ contact on RFM73 module.*/
+#define RFM73_IRQ_PORT    PORTE
+/*! \brief PIN register of IRQ contact on RFM73 module.*/
+#define RFM73_IRQ_IN      PINE
+/*! \brief DDR register of IRQ contact on RFM73 module.*/
+#define RFM73_IRQ_DIR     DDRE
+/*! \brief Interrupt vector of external interrupt connected to IRQ contact.*/
+#define RFM73_IRQ_vect    INT4_vect
+/*! \brief Setting low level sense of IRQ external interrupt. Level sense is
+used, so events that happen while interrupt is disabled are not lost.*/
+#define RFM73_IRQ_INT_INIT    EICRB &=~((1 << ISC41) | (1 << ISC40))
+/*! \brief Enabling IRQ external interrupt.*/
+#define RFM73_IRQ_INT_ENABLE  EIMSK |= (1 << INT4)
+/*! \brief Disabling IRQ external interrupt.*/
+#define RFM73_IRQ_INT_DISABLE EIMSK &=~(1 << INT4)
+/*! \brief Pin number of CE contact on RFM73 module.*/
+#define RFM73_CE_PIN      PB4
+/*! \brief PORT register to CE contact on RFM73 module.*/
+#define RFM73_CE_PORT     PORTB
+/*! \brief PIN register of CE contact on RFM73 module.*/
+#define RFM73_CE_IN       PINB
+/*! \brief DDR register of CE contact on RFM73 module.*/
+#define RFM73_CE_DIR      DDRB
+/*! \brief Pin number of CSN contact on RFM73 module.*/
+#define RFM73_CSN_PIN     PB0
+/*! \brief PORT register to CSN contact on RFM73 module.*/
+#define RFM73_CSN_PORT    PORTB
+/*! \brief PIN register of CSN contact on RFM73 module.*/
+#define RFM73_CSN_IN      PINB
+/*! \brief DDR register of CSN contact on RFM73 module.*/
+#define RFM73_CSN_DIR     DDRB
+
+/*! \brief Setting high level on CE line.*/
+#define RFM73_CE_HIGH     RFM73_CE_PORT |= (1 << RFM73_CE_PIN)
+/*! \brief Setting low level on CE line.*/
+#define RFM73_CE_LOW      RFM73_CE_PORT &=~(1 << RFM73_CE_PIN)
+/* It is important to never stay in TX mode for more than 4ms at one time. */
+//#define RFM73_CE_TX_PULSE RFM73_CE_HIGH; _delay_us(20); RFM73_CE_LOW
+/*! \brief Setting high level on CSN line.*/
+#define RFM73_CSN_HIGH    RFM73_CSN_PORT |= (1 << RFM73_CSN_PIN)
+/*! \brief Setting low level on CSN line.*/
+#define RFM73_CSN_LOW     RFM73_CSN_PORT &=~(1 << RFM73_CSN_PIN)
+//#define RFM73_CSN_PULSE   RFM73_CSN_HIGH; _delay_us(10); RFM73_CSN_LOW
+/*! \brief Reading state of CE line (non-zero if high).*/
+#define RFM73_CE_IS_HIGH  (RFM73_CE_PORT & (1 << RFM73_CE_PIN))
+/*! \brief Configuring IRQ pin as input.*/
+#define RFM73_IRQ_PIN_INIT    RFM73_IRQ_DIR &=~(1 << RFM73_IRQ_PIN)
+
+/*! \brief Delay for ms milliseconds.*/
+#define RFM73_DELAY_MS(ms)    _delay_ms(ms)
+/*! \brief Delay for us microseconds.*/
+#define RFM73_DELAY_US(us)    _delay_us(us)
+
+/*! \brief Defines IRQ pin interrupt, which calls rfm73_irq_handler.*/
+#define RFM73_IRQ_ISR         ISR(RFM73_IRQ_vect) { rfm73_irq_handler(); }
+
+/*! \brief Places variable to non-volatile memory (EEPROM), which keeps it
+over power cycle. Erased EEPROM reads 0xFF.*/
+#define RFM73_NV              EEMEM
+/*! \brief Reading byte of non-volatile memory.*/
+#define RFM73_NV_READ(p)      eeprom_read_byte(p)
+/*! \brief Writing byte of non-volatile memory, it is written only if it
+changes (takes about 3.4 ms then).*/
+#define RFM73_NV_WRITE(p, v)  eeprom_update_byte(p, v)
+
+/* status LEDs of example board */
+#define GREEN_LED		   PA0
+#define GREEN_LED_SET 	   PORTA |= (1 << GREEN_LED)
+#define GREEN_LED_CLR      PORTA &=~(1 << GREEN_LED)
+
+#define RED_LED 		   PA1
+#define RED_LED_SET        PORTA |= (1 << RED_LED)
+#define RED_LED_CLR        PORTA &=~(1 << RED_LED)
+
+#else
+
+#include "sim/rfm73_sim.h"
+
+#define RFM73_CE_HIGH         sim_ce(1)
+#define RFM73_CE_LOW          sim_ce(0)
+#define RFM73_CE_IS_HIGH      sim_ce_get()
+#define RFM73_CSN_HIGH        sim_csn(1)
+#define RFM73_CSN_LOW         sim_csn(0)
+#define RFM73_IRQ_PIN_INIT
+#define RFM73_IRQ_INT_INIT
+#define RFM73_IRQ_INT_ENABLE  sim_irq_int(1)
+#define RFM73_IRQ_INT_DISABLE sim_irq_int(0)
+
+#define RFM73_DELAY_MS(ms)    sim_delay_us((uint32_t)(ms)*1000)
+#define RFM73_DELAY_US(us)    sim_delay_us(us)
+
+/* simulator calls rfm73_irq_handler itself (see sim_irq_int) */
+#define RFM73_IRQ_ISR
+
+/* host program is single threaded, interrupts are called only from
+   simulator functions */
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type)    for (uint8_t __todo = 1; __todo; __todo = 0)
+
+/* constant tables stay in RAM */
+#define PROGMEM
+#define pgm_read_byte(addr)   (*(const uint8_t*)(addr))
+
+/* non-volatile memory is RAM which starts erased */
+#define RFM73_NV
+#define RFM73_NV_READ(p)      (*(p))
+#define RFM73_NV_WRITE(p, v)  (*(p) = (v))
+
+/* no LEDs; statements, so they could be bodies of if */
+#define GREEN_LED_SET         do {} while (0)
+#define GREEN_LED_CLR         do {} while (0)
+#define RED_LED_SET           do {} while (0)
+#define RED_LED_CLR           do {} while (0)
+
+#endif
+
+/* IRQ pin interrupt handler (see RFM73.c) */
+void rfm73_irq_handler();
+
+#endif /* RFM73_HAL_H_ */
@@ -0,0 +1,838 @@
+/*
+ * rfm73_sim.c
+ *
+ * Software model of RFM73 modules and SPI functions of spi.h for host build
+ * of the library (see rfm73_sim.h).
+ */
+
+#include "rfm73_sim.h"
+#include "../spi.h"
+#include "../rfm73_hal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* register addresses and bits (see RFM73.c) */
+#define R_CONFIG        0x00
+#define R_ENAA          0x01
+#define R_EN_RX_ADDR    0x02
+#define R_SETUP_AW      0x03
+#define R_SETUP_RETR    0x04
+#define R_RF_CH         0x05
+#define R_RF_SETUP      0x06
+#define R_STATUS        0x07
+#define R_OBSERVE_TX    0x08
+#define R_CD            0x09
+#define R_RX_ADDR_P0    0x0A
+#define R_RX_ADDR_P1    0x0B
+#define R_TX_ADDR       0x10
+#define R_RX_PW_P0      0x11
+#define R_FIFO_STATUS   0x17
+#define R_DYNPD         0x1C
+#define R_FEATURE       0x1D
+#define R_COUNT         0x1E
+
+#define CF_PRIM_RX      0x01
+#define CF_PWR_UP       0x02
+#define CF_CRCO         0x04
+#define CF_EN_CRC       0x08
+#define CF_MASK_bm      0x70
+#define ST_FLAGS_bm     0x70
+#define ST_MAX_RT       0x10
+#define ST_TX_DS        0x20
+#define ST_RX_DR        0x40
+#define RS_DR_HIGH      0x08
+#define RS_DR_LOW       0x20
+#define FE_EN_DYN_ACK   0x01
+#define FE_EN_ACK_PAY   0x02
+#define FE_EN_DPL       0x04
+
+/* commands */
+#define C_R_REGISTER    0x00
+#define C_W_REGISTER    0x20
+#define C_ACTIVATE      0x50
+#define C_R_RX_PL_WID   0x60
+#define C_R_RX_PAYLOAD  0x61
+#define C_W_TX_PAYLOAD  0xA0
+#define C_W_ACK_PAYLOAD 0xA8
+#define C_W_TX_NOACK    0xB0
+#define C_FLUSH_TX      0xE1
+#define C_FLUSH_RX      0xE2
+#define C_REUSE_TX_PL   0xE3
+#define C_NOP           0xFF
+
+/* timings, us */
+#define T_SETTLE        130
+#define FIFO_DEPTH      3
+#define MAX_RADIOS      16
+#define NO_PIPE         0xFF
+
+/* states of module */
+enum {
+	S_OFF,          // power down
+	S_STANDBY,      // standby, CE low or nothing to send
+	S_RX,           // PRX, listening
+	S_TX_SETTLE,    // PTX, PLL settling before packet
+	S_TX_AIR,       // PTX, packet in air
+	S_WAIT_ACK      // PTX, waiting for acknowledge
+};
+
+typedef struct {
+	uint8_t len;
+	uint8_t pipe;       // RX: pipe number; TX: NO_PIPE or ACK payload pipe
+	uint8_t noack;
+	uint8_t data[32];
+} sim_fifo_entry_t;
+
+struct sim_radio {
+	/* registers */
+	uint8_t reg[R_COUNT];
+	uint8_t addr_p0[5], addr_p1[5], addr_tx[5];
+	uint8_t bank1[15][11];
+	uint8_t rbank, activated, flags;
+	/* pins */
+	uint8_t ce, csn;
+	/* SPI transaction */
+	uint8_t cmd, pos, wlen;
+	uint8_t wbuf[32];
+	/* FIFOs */
+	sim_fifo_entry_t rx[FIFO_DEPTH], tx[FIFO_DEPTH];
+	uint8_t rx_cnt, tx_cnt, reuse;
+	/* state machine */
+	uint8_t state, arc_cnt, plos_cnt, pid, ack_ok;
+	uint64_t t_event;
+	sim_fifo_entry_t ack;
+	/* last packet in air */
+	uint64_t air_start, air_end;
+	uint8_t air_ch;
+	/* duplicate detection per pipe */
+	uint8_t last_pid[6];
+	uint16_t last_sum[6];
+	sim_stats_t stats;
+};
+
+static sim_radio_t sim_radios[MAX_RADIOS];
+static uint8_t sim_n = 0;
+static sim_radio_t* sim_sel = 0;
+static uint64_t sim_t = 0;
+static uint32_t sim_spi_ns = 1600, sim_spi_acc = 0, sim_spi_cnt = 0;
+static uint8_t sim_loss = 0;
+static uint8_t sim_noise[128];
+static uint32_t sim_rand_state = 1;
+static uint8_t sim_int_on = 0, sim_in_irq = 0;
+/* set while SPI interrupt or timer is running */
+static uint8_t sim_in_spi = 0, sim_in_timer = 0;
+/* IRQ interrupt latency, time when active IRQ line is serviced and flag of
+   active line */
+static uint32_t sim_irq_delay = 0;
+static uint64_t sim_irq_at;
+static uint8_t sim_irq_wait = 0;
+static void (*sim_timer_fn)() = 0;
+static uint32_t sim_timer_period;
+static uint64_t sim_timer_next;
+/* interrupt-driven SPI transfer: executed at once, or at sim_xfer_at by SPI
+   interrupt if sim_spi_async is set; sim_xfer_run is set while its bytes
+   are exchanged */
+static spi_xfer_t* sim_xfer = 0;
+static uint8_t sim_spi_async = 0, sim_xfer_run = 0;
+static uint64_t sim_xfer_at;
+
+static void sim_kick(sim_radio_t* r);
+static void sim_xfer_finish();
+
+///////////////////////////////////////////////////////////////////////////////
+//                  Helpers                                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+static uint32_t sim_rand() {
+	sim_rand_state = sim_rand_state * 1103515245UL + 12345UL;
+	return (sim_rand_state >> 16) & 0x7FFF;
+}
+
+static uint8_t sim_lost() {
+	return sim_loss && ((sim_rand() % 100) < sim_loss);
+}
+
+static uint8_t sim_aw(const sim_radio_t* r) {
+	uint8_t aw = r->reg[R_SETUP_AW] & 0x03;
+	return aw ? aw + 2 : 5;
+}
+
+static uint16_t sim_rate_kbps(const sim_radio_t* r) {
+	if (r->reg[R_RF_SETUP] & RS_DR_LOW) return 250;
+	if (r->reg[R_RF_SETUP] & RS_DR_HIGH) return 2000;
+	return 1000;
+}
+
+static uint8_t sim_crc_len(const sim_radio_t* r) {
+	if (!(r->reg[R_CONFIG] & CF_EN_CRC)) return 0;
+	return (r->reg[R_CONFIG] & CF_CRCO) ? 2 : 1;
+}
+
+/* time of packet in air: preamble, address, 9 bit control field, payload,
+   CRC */
+static uint32_t sim_airtime(const sim_radio_t* r, uint8_t len) {
+	uint32_t bits = 8UL*(1 + sim_aw(r) + len + sim_crc_len(r)) + 9;
+	return (bits*1000UL + sim_rate_kbps(r) - 1) / sim_rate_kbps(r);
+}
+
+static uint8_t sim_dpl(const sim_radio_t* r, uint8_t pipe) {
+	return r->activated && (r->reg[R_FEATURE] & FE_EN_DPL) &&
+	       (r->reg[R_DYNPD] & (1 << pipe));
+}
+
+static uint16_t sim_sum(const sim_fifo_entry_t* e) {
+	uint16_t s = e->len;
+	uint8_t i;
+	for (i = 0; i < e->len; i++) s = (s << 1 | s >> 15) ^ e->data[i];
+	return s;
+}
+
+/* address of pipe, returns 0 if pipe is disabled */
+static uint8_t sim_pipe_addr(const sim_radio_t* r, uint8_t pipe,
+                             uint8_t* addr) {
+	if (!(r->reg[R_EN_RX_ADDR] & (1 << pipe))) return 0;
+	if (pipe == 0) memcpy(addr, r->addr_p0, 5);
+	else {
+		memcpy(addr, r->addr_p1, 5);
+		if (pipe > 1) addr[0] = r->reg[R_RX_ADDR_P0 + pipe];
+	}
+	return 1;
+}
+
+static void sim_fifo_pop(sim_fifo_entry_t* f, uint8_t* cnt, uint8_t i) {
+	for (; i+1 < *cnt; i++) f[i] = f[i+1];
+	(*cnt)--;
+}
+
+/* index of first TX FIFO entry that is sent as packet (not ACK payload) */
+static int8_t sim_tx_packet(const sim_radio_t* r) {
+	uint8_t i;
+	for (i = 0; i < r->tx_cnt; i++)
+		if (r->tx[i].pipe == NO_PIPE) return i;
+	return -1;
+}
+
+static int8_t sim_tx_ack_payload(const sim_radio_t* r, uint8_t pipe) {
+	uint8_t i;
+	for (i = 0; i < r->tx_cnt; i++)
+		if (r->tx[i].pipe == pipe) return i;
+	return -1;
+}
+
+static uint8_t sim_status(const sim_radio_t* r) {
+	uint8_t st = (r->rbank << 7) | r->flags;
+	st |= (r->rx_cnt ? r->rx[0].pipe : 7) << 1;
+	if (r->tx_cnt == FIFO_DEPTH) st |= 0x01;
+	return st;
+}
+
+static uint8_t sim_carrier(const sim_radio_t* r) {
+	uint8_t i, ch = r->reg[R_RF_CH] & 0x7F;
+	if (sim_noise[ch]) return 1;
+	for (i = 0; i < sim_n; i++) {
+		const sim_radio_t* o = &sim_radios[i];
+		if ((o != r) && (o->air_ch == ch) &&
+		    (o->air_start <= sim_t) && (sim_t < o->air_end)) return 1;
+	}
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                  Registers                                                //
+///////////////////////////////////////////////////////////////////////////////
+
+static void sim_reset(sim_radio_t* r) {
+	static const uint8_t reset[R_COUNT] = {
+		0x08, 0x3F, 0x03, 0x03, 0x03, 0x02, 0x3F, 0x0E,
+		0x00, 0x00, 0xE7, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6,
+		0xE7, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x11,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+	memset(r, 0, sizeof(*r));
+	memcpy(r->reg, reset, R_COUNT);
+	memset(r->addr_p0, 0xE7, 5);
+	memset(r->addr_p1, 0xC2, 5);
+	memset(r->addr_tx, 0xE7, 5);
+	r->csn = 1;
+	r->air_ch = 0xFF;
+	memset(r->last_pid, 0xFF, sizeof(r->last_pid));
+}
+
+static uint8_t sim_reg_read(sim_radio_t* r, uint8_t reg, uint8_t idx) {
+	if (r->rbank) {
+		if (reg > 14) return 0;
+		if (reg == R_STATUS) return sim_status(r);
+		if (reg == 8) return idx ? 0 : 0x63;    // chip ID
+		return r->bank1[reg][idx % 11];
+	}
+	if (idx >= 5) idx = 4;
+	switch (reg) {
+		case R_STATUS:      return sim_status(r);
+		case R_OBSERVE_TX:  return (r->plos_cnt << 4) | r->arc_cnt;
+		case R_CD:          return sim_carrier(r);
+		case R_RX_ADDR_P0:  return r->addr_p0[idx];
+		case R_RX_ADDR_P1:  return r->addr_p1[idx];
+		case R_TX_ADDR:     return r->addr_tx[idx];
+		case R_FIFO_STATUS:
+			return (r->reuse << 6) |
+			       ((r->tx_cnt == FIFO_DEPTH) << 5) |
+			       ((r->tx_cnt == 0) << 4) |
+			       ((r->rx_cnt == FIFO_DEPTH) << 1) |
+			       (r->rx_cnt == 0);
+		case R_DYNPD:
+		case R_FEATURE:
+			return r->activated ? r->reg[reg] : 0;
+	}
+	return (reg < R_COUNT) ? r->reg[reg] : 0;
+}
+
+static void sim_reg_write(sim_radio_t* r, uint8_t reg, const uint8_t* buf,
+                          uint8_t len) {
+	if (len == 0) return;
+	if (r->rbank) {
+		if (reg <= 14) memcpy(r->bank1[reg], buf, len > 11 ? 11 : len);
+		return;
+	}
+	switch (reg) {
+		case R_STATUS:
+			// writing 1 clears flag
+			r->flags &= ~(buf[0] & ST_FLAGS_bm);
+			break;
+		case R_RX_ADDR_P0: memcpy(r->addr_p0, buf, len > 5 ? 5 : len); break;
+		case R_RX_ADDR_P1: memcpy(r->addr_p1, buf, len > 5 ? 5 : len); break;
+		case R_TX_ADDR:    memcpy(r->addr_tx, buf, len > 5 ? 5 : len); break;
+		case R_OBSERVE_TX:
+		case R_CD:
+		case R_FIFO_STATUS:
+			break;
+		case R_DYNPD:
+		case R_FEATURE:
+			if (r->activated) r->reg[reg] = buf[0];
+			break;
+		case R_RF_CH:
+			r->reg[reg] = buf[0];
+			r->plos_cnt = 0;
+			break;
+		default:
+			if (reg < R_COUNT) r->reg[reg] = buf[0];
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                  SPI slave                                                //
+///////////////////////////////////////////////////////////////////////////////
+
+static void sim_csn_low(sim_radio_t* r) {
+	r->csn = 0;
+	r->pos = 0;
+	r->wlen = 0;
+}
+
+static uint8_t sim_byte(sim_radio_t* r, uint8_t in) {
+	uint8_t out = 0, c;
+	// SPI time, time of finished asynchronous transfer has passed already
+	if (!(sim_xfer_run && sim_spi_async)) {
+		sim_spi_acc += sim_spi_ns;
+		while (sim_spi_acc >= 1000) {
+			sim_spi_acc -= 1000;
+			sim_t++;
+		}
+	}
+	if (r->csn) return 0xFF;
+	if (r->pos == 0) {
+		r->cmd = in;
+		r->pos = 1;
+		return sim_status(r);
+	}
+	c = r->cmd;
+	if ((c & 0xE0) == C_R_REGISTER)
+		out = sim_reg_read(r, c & 0x1F, r->pos - 1);
+	else if (c == C_R_RX_PAYLOAD)
+		out = (r->rx_cnt && r->pos <= 32) ? r->rx[0].data[r->pos-1] : 0;
+	else if (c == C_R_RX_PL_WID)
+		out = (r->activated && r->rx_cnt) ? r->rx[0].len : 0;
+	else if (r->wlen < 32)
+		r->wbuf[r->wlen++] = in;
+	r->pos++;
+	return out;
+}
+
+static void sim_push_tx(sim_radio_t* r, uint8_t pipe, uint8_t noack) {
+	sim_fifo_entry_t* e;
+	if ((r->tx_cnt == FIFO_DEPTH) || (r->wlen == 0)) return;
+	e = &r->tx[r->tx_cnt++];
+	e->len = r->wlen;
+	e->pipe = pipe;
+	e->noack = noack;
+	memcpy(e->data, r->wbuf, r->wlen);
+	if (pipe == NO_PIPE) r->reuse = 0;
+}
+
+static void sim_csn_high(sim_radio_t* r) {
+	uint8_t c = r->cmd;
+	if (r->csn) return;
+	r->csn = 1;
+	if (r->pos == 0) return;
+	if ((c & 0xE0) == C_W_REGISTER)
+		sim_reg_write(r, c & 0x1F, r->wbuf, r->wlen);
+	else if ((c == C_R_RX_PAYLOAD) && (r->pos > 1) && r->rx_cnt)
+		sim_fifo_pop(r->rx, &r->rx_cnt, 0);
+	else if (c == C_W_TX_PAYLOAD)
+		sim_push_tx(r, NO_PIPE, 0);
+	else if ((c == C_W_TX_NOACK) && r->activated)
+		sim_push_tx(r, NO_PIPE, 1);
+	else if (((c & 0xF8) == C_W_ACK_PAYLOAD) && ((c & 7) < 6) &&
+	         r->activated)
+		sim_push_tx(r, c & 7, 0);
+	else if (c == C_FLUSH_TX) {
+		r->tx_cnt = 0;
+		r->reuse = 0;
+	}
+	else if (c == C_FLUSH_RX)
+		r->rx_cnt = 0;
+	else if (c == C_REUSE_TX_PL)
+		r->reuse = 1;
+	else if ((c == C_ACTIVATE) && r->wlen) {
+		if (r->wbuf[0] == 0x73) r->activated ^= 1;
+		if (r->wbuf[0] == 0x53) r->rbank ^= 1;
+	}
+	sim_kick(r);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                  Air and state machine                                    //
+///////////////////////////////////////////////////////////////////////////////
+
+/* starts transmission of first packet of TX FIFO if module could do it */
+static void sim_kick(sim_radio_t* r) {
+	uint8_t cfg = r->reg[R_CONFIG];
+	if (!(cfg & CF_PWR_UP)) {
+		r->state = S_OFF;
+		return;
+	}
+	// packet in progress is always finished
+	if (r->state >= S_TX_SETTLE) return;
+	if (cfg & CF_PRIM_RX) {
+		r->state = r->ce ? S_RX : S_STANDBY;
+		return;
+	}
+	// MAX_RT stops transmission until it is cleared
+	if (r->ce && (sim_tx_packet(r) >= 0) && !(r->flags & ST_MAX_RT)) {
+		r->state = S_TX_SETTLE;
+		r->arc_cnt = 0;
+		r->pid++;
+		r->t_event = sim_t + T_SETTLE;
+	}
+	else
+		r->state = S_STANDBY;
+}
+
+/* checks if packet sent by t is heard by r; puts it to RX FIFO and returns
+   1 if acknowledge is sent (ACK payload is returned in ack) */
+static uint8_t sim_deliver(sim_radio_t* t, sim_radio_t* r,
+                           const sim_fifo_entry_t* p,
+                           sim_fifo_entry_t* ack) {
+	uint8_t pipe, i, addr[5];
+	int8_t k;
+	uint16_t sum;
+	if (r->state != S_RX) return 0;
+	if (((r->reg[R_RF_CH] ^ t->reg[R_RF_CH]) & 0x7F) ||
+	    (sim_rate_kbps(r) != sim_rate_kbps(t)) ||
+	    (sim_aw(r) != sim_aw(t)) ||
+	    (sim_crc_len(r) != sim_crc_len(t)))
+		return 0;
+	for (pipe = 0; pipe < 6; pipe++)
+		if (sim_pipe_addr(r, pipe, addr) &&
+		    !memcmp(addr, t->addr_tx, sim_aw(r))) break;
+	if (pipe == 6) return 0;
+	// noise, collisions and random loss
+	if (sim_noise[t->air_ch] || sim_lost()) {
+		r->stats.rx_lost++;
+		return 0;
+	}
+	for (i = 0; i < sim_n; i++) {
+		sim_radio_t* o = &sim_radios[i];
+		if ((o != t) && (o->air_ch == t->air_ch) &&
+		    (o->air_start < t->air_end) && (t->air_start < o->air_end)) {
+			r->stats.rx_lost++;
+			return 0;
+		}
+	}
+	// static payload length must match
+	if (!sim_dpl(r, pipe) && (p->len != (r->reg[R_RX_PW_P0+pipe] & 0x3F)))
+		return 0;
+	sum = sim_sum(p);
+	if ((r->last_pid[pipe] == t->pid) && (r->last_sum[pipe] == sum))
+		r->stats.rx_dup++;
+	else {
+		if (r->rx_cnt == FIFO_DEPTH) {
+			r->stats.rx_full++;
+			return 0;
+		}
+		r->rx[r->rx_cnt] = *p;
+		r->rx[r->rx_cnt].pipe = pipe;
+		r->rx_cnt++;
+		r->flags |= ST_RX_DR;
+		r->last_pid[pipe] = t->pid;
+		r->last_sum[pipe] = sum;
+		r->stats.rx_ok++;
+	}
+	if (p->noack || !(r->reg[R_ENAA] & (1 << pipe))) return 0;
+	// acknowledge with payload if there is one for this pipe
+	ack->len = 0;
+	k = sim_tx_ack_payload(r, pipe);
+	if ((k >= 0) && (r->reg[R_FEATURE] & FE_EN_ACK_PAY)) {
+		*ack = r->tx[k];
+		sim_fifo_pop(r->tx, &r->tx_cnt, k);
+		r->flags |= ST_TX_DS;
+	}
+	r->air_start = sim_t + T_SETTLE;
+	r->air_end = r->air_start + sim_airtime(r, ack->len);
+	r->air_ch = t->air_ch;
+	r->stats.air_us += r->air_end - r->air_start;
+	return 1;
+}
+
+/* processes event of module r at current time */
+static void sim_event(sim_radio_t* r) {
+	int8_t k = sim_tx_packet(r);
+	uint8_t i;
+	uint32_t ard;
+	sim_fifo_entry_t* p;
+	if (k < 0) {
+		// TX FIFO was flushed
+		r->state = S_STANDBY;
+		sim_kick(r);
+		return;
+	}
+	p = &r->tx[k];
+	switch (r->state) {
+		case S_TX_SETTLE:
+			r->state = S_TX_AIR;
+			r->air_ch = r->reg[R_RF_CH] & 0x7F;
+			r->air_start = sim_t;
+			r->air_end = sim_t + sim_airtime(r, p->len);
+			r->t_event = r->air_end;
+			r->stats.tx_air++;
+			r->stats.air_us += r->air_end - r->air_start;
+			break;
+		case S_TX_AIR:
+			r->ack_ok = 0;
+			for (i = 0; i < sim_n; i++)
+				if ((&sim_radios[i] != r) &&
+				    sim_deliver(r, &sim_radios[i], p, &r->ack))
+					r->ack_ok = 1;
+			if (p->noack) {
+				r->ack_ok = 1;
+				r->ack.len = 0;
+				r->t_event = sim_t;
+			}
+			else {
+				ard = 250UL * ((r->reg[R_SETUP_RETR] >> 4) + 1);
+				// acknowledge must come back before ARD is over
+				if (r->ack_ok && (sim_lost() ||
+				    (T_SETTLE + sim_airtime(r, r->ack.len) > ard)))
+					r->ack_ok = 0;
+				r->t_event = sim_t + (r->ack_ok ?
+				             T_SETTLE + sim_airtime(r, r->ack.len) : ard);
+			}
+			r->state = S_WAIT_ACK;
+			break;
+		case S_WAIT_ACK:
+			if (r->ack_ok) {
+				r->flags |= ST_TX_DS;
+				r->stats.tx_ds++;
+				if (!r->reuse) sim_fifo_pop(r->tx, &r->tx_cnt, k);
+				if (r->ack.len && (r->rx_cnt < FIFO_DEPTH)) {
+					r->rx[r->rx_cnt] = r->ack;
+					r->rx[r->rx_cnt].pipe = 0;
+					r->rx_cnt++;
+					r->flags |= ST_RX_DR;
+				}
+				r->state = S_STANDBY;
+				sim_kick(r);
+			}
+			else if (r->arc_cnt < (r->reg[R_SETUP_RETR] & 0x0F)) {
+				r->arc_cnt++;
+				r->stats.tx_retries++;
+				r->state = S_TX_SETTLE;
+				r->t_event = sim_t + T_SETTLE;
+			}
+			else {
+				r->flags |= ST_MAX_RT;
+				r->stats.max_rt++;
+				if (r->plos_cnt < 15) r->plos_cnt++;
+				r->state = S_STANDBY;
+			}
+			break;
+	}
+}
+
+static uint8_t sim_irq_active(const sim_radio_t* r) {
+	return (r->flags & ~r->reg[R_CONFIG] & CF_MASK_bm) != 0;
+}
+
+/* advances time to t processing module events, timers and interrupts */
+static void sim_run_until(uint64_t t) {
+	uint8_t i;
+	sim_radio_t* next;
+	for (;;) {
+		// IRQ interrupt of selected module, level triggered, called
+		// sim_irq_delay after line went active
+		if (sim_sel && sim_int_on && !sim_in_irq && !sim_in_spi &&
+		    !sim_in_timer && sim_irq_active(sim_sel)) {
+			if (!sim_irq_wait) {
+				sim_irq_wait = 1;
+				sim_irq_at = sim_t + sim_irq_delay;
+			}
+			if (sim_irq_at <= sim_t) {
+				sim_irq_wait = 0;
+				sim_in_irq = 1;
+				rfm73_irq_handler();
+				sim_in_irq = 0;
+				continue;
+			}
+		}
+		else if (!sim_in_irq)
+			sim_irq_wait = 0;
+		next = 0;
+		for (i = 0; i < sim_n; i++) {
+			sim_radio_t* r = &sim_radios[i];
+			if ((r->state >= S_TX_SETTLE) &&
+			    (!next || (r->t_event < next->t_event)))
+				next = r;
+		}
+		// SPI interrupt at the end of asynchronous transfer
+		if (sim_xfer && sim_spi_async && !sim_in_irq && !sim_in_spi &&
+		    !sim_in_timer && (sim_xfer_at <= t) &&
+		    (!next || (sim_xfer_at <= next->t_event)) &&
+		    (!sim_timer_fn || (sim_xfer_at <= sim_timer_next))) {
+			if (sim_xfer_at > sim_t) sim_t = sim_xfer_at;
+			sim_xfer_finish();
+			continue;
+		}
+		if (sim_timer_fn && !sim_in_timer && (sim_timer_next <= t) &&
+		    (!next || (sim_timer_next <= next->t_event)) &&
+		    (!sim_irq_wait || (sim_timer_next < sim_irq_at))) {
+			if (sim_timer_next > sim_t) sim_t = sim_timer_next;
+			sim_timer_next += sim_timer_period;
+			sim_in_timer = 1;
+			sim_timer_fn();
+			sim_in_timer = 0;
+			continue;
+		}
+		// late IRQ interrupt comes before the next event
+		if (sim_irq_wait && (sim_irq_at <= t) &&
+		    (!next || (sim_irq_at <= next->t_event))) {
+			if (sim_irq_at > sim_t) sim_t = sim_irq_at;
+			continue;
+		}
+		if (!next || (next->t_event > t)) break;
+		if (next->t_event > sim_t) sim_t = next->t_event;
+		sim_event(next);
+	}
+	if (t > sim_t) sim_t = t;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                  Public functions                                         //
+///////////////////////////////////////////////////////////////////////////////
+
+uint64_t sim_now() {
+	return sim_t;
+}
+
+void sim_delay_us(uint32_t us) {
+	sim_run_until(sim_t + us);
+}
+
+void sim_set_timer(void (*fn)(), uint32_t period_us) {
+	sim_timer_fn = fn;
+	sim_timer_period = period_us;
+	sim_timer_next = sim_t + period_us;
+}
+
+void sim_set_irq_delay(uint32_t us) {
+	sim_irq_delay = us;
+}
+
+void sim_set_spi_byte_ns(uint32_t ns) {
+	sim_spi_ns = ns;
+}
+
+void sim_set_spi_async(uint8_t on) {
+	sim_spi_async = on;
+}
+
+uint32_t sim_spi_bytes() {
+	return sim_spi_cnt;
+}
+
+void sim_air_loss(uint8_t percent) {
+	sim_loss = percent;
+}
+
+void sim_air_noise(uint8_t ch, uint8_t on) {
+	sim_noise[ch & 0x7F] = on;
+}
+
+void sim_seed(uint32_t seed) {
+	sim_rand_state = seed;
+}
+
+sim_radio_t* sim_radio_new() {
+	sim_radio_t* r;
+	if (sim_n == MAX_RADIOS) return 0;
+	r = &sim_radios[sim_n++];
+	sim_reset(r);
+	if (!sim_sel) sim_sel = r;
+	return r;
+}
+
+void sim_select(sim_radio_t* r) {
+	sim_sel = r;
+}
+
+sim_radio_t* sim_selected() {
+	return sim_sel;
+}
+
+void sim_radio_reset(sim_radio_t* r) {
+	sim_reset(r);
+}
+
+void sim_radio_copy(sim_radio_t* dst, const sim_radio_t* src) {
+	memcpy(dst->reg, src->reg, R_COUNT);
+	memcpy(dst->addr_p0, src->addr_p0, 5);
+	memcpy(dst->addr_p1, src->addr_p1, 5);
+	memcpy(dst->addr_tx, src->addr_tx, 5);
+	memcpy(dst->bank1, src->bank1, sizeof(dst->bank1));
+	dst->activated = src->activated;
+	dst->flags = 0;
+	sim_kick(dst);
+}
+
+uint8_t sim_radio_spi(sim_radio_t* r, uint8_t cmd, const uint8_t* tx,
+                      uint8_t* rx, uint8_t len) {
+	uint8_t i, status, in;
+	sim_csn_low(r);
+	status = sim_byte(r, cmd);
+	for (i = 0; i < len; i++) {
+		in = sim_byte(r, tx ? tx[i] : 0);
+		if (rx) rx[i] = in;
+	}
+	sim_csn_high(r);
+	return status;
+}
+
+void sim_radio_write_reg(sim_radio_t* r, uint8_t reg, uint8_t value) {
+	sim_radio_spi(r, C_W_REGISTER | reg, &value, 0, 1);
+}
+
+uint8_t sim_radio_read_reg(sim_radio_t* r, uint8_t reg) {
+	uint8_t value;
+	sim_radio_spi(r, C_R_REGISTER | reg, 0, &value, 1);
+	return value;
+}
+
+void sim_radio_ce(sim_radio_t* r, uint8_t level) {
+	r->ce = level;
+	sim_kick(r);
+}
+
+uint8_t sim_radio_irq(sim_radio_t* r) {
+	return !sim_irq_active(r);
+}
+
+sim_stats_t* sim_radio_stats(sim_radio_t* r) {
+	return &r->stats;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                  HAL and SPI of selected module                           //
+///////////////////////////////////////////////////////////////////////////////
+
+void sim_ce(uint8_t level) {
+	if (sim_sel) sim_radio_ce(sim_sel, level);
+}
+
+uint8_t sim_ce_get() {
+	return sim_sel ? sim_sel->ce : 0;
+}
+
+void sim_csn(uint8_t level) {
+	if (!sim_sel) return;
+	if (level) sim_csn_high(sim_sel);
+	else sim_csn_low(sim_sel);
+}
+
+void sim_irq_int(uint8_t on) {
+	sim_int_on = on;
+}
+
+void spi_init() {
+}
+
+/* stops program: SPI is used in a way that fails on target */
+static void sim_spi_fault(const char* what) {
+	fprintf(stderr, "sim: %s at %llu us\n", what, (unsigned long long)sim_t);
+	abort();
+}
+
+uint8_t spi_read(uint8_t value) {
+	if (sim_xfer && !sim_xfer_run)
+		sim_spi_fault("SPI is used while interrupt-driven transfer is running");
+	sim_spi_cnt++;
+	return sim_sel ? sim_byte(sim_sel, value) : 0xFF;
+}
+
+void spi_transfer(const uint8_t* tx, uint8_t* rx, uint8_t len) {
+	uint8_t i, in;
+	for (i = 0; i < len; i++) {
+		in = spi_read(tx ? tx[i] : 0);
+		if (rx) rx[i] = in;
+	}
+}
+
+/* exchanges bytes of interrupt-driven transfer and calls its callback */
+static void sim_xfer_finish() {
+	spi_xfer_t* x = sim_xfer;
+	sim_xfer_run = 1;
+	RFM73_CSN_LOW;
+	x->status = spi_read(x->cmd);
+	spi_transfer(x->tx, x->rx, x->len);
+	RFM73_CSN_HIGH;
+	sim_xfer_run = 0;
+	sim_xfer = 0;
+	sim_in_spi = sim_spi_async;
+	if (x->done) x->done(x);
+	sim_in_spi = 0;
+}
+
+/* interrupt-driven transfer is done at once, callback is called before
+   return like SPI interrupt that preempts caller; in asynchronous mode it
+   is finished by SPI interrupt when its bytes are shifted */
+uint8_t spi_xfer_start(spi_xfer_t* xfer) {
+	if (sim_xfer) return 1;
+	sim_xfer = xfer;
+	if (sim_spi_async) {
+		sim_xfer_at = sim_t + ((uint64_t)(xfer->len + 1) * sim_spi_ns + 999) /
+		              1000;
+		return 0;
+	}
+	sim_xfer_finish();
+	return 0;
+}
+
+uint8_t spi_busy() {
+	return sim_xfer != 0;
+}
+
+/* SPI interrupt can't come while other interrupt is running */
+void spi_wait() {
+	if (!sim_xfer) return;
+	if (sim_in_irq || sim_in_spi || sim_in_timer)
+		sim_spi_fault("SPI transfer is waited for in interrupt");
+	while (sim_xfer) sim_run_until(sim_xfer_at);
+}
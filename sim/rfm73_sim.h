@@ -0,0 +1,126 @@
+/*
+ * rfm73_sim.h
+ *
+ * Software model of RFM73 modules for running the library on PC.
+ *
+ * Model keeps both register banks, TX and RX FIFOs (3 packets each), STATUS
+ * flags and IRQ line, and simulates PTX/PRX state machine with auto
+ * acknowledge, retransmits (ARD/ARC), acknowledge payloads, dynamic payload
+ * length and carrier detect. Any number of modules could be created, they
+ * share one simulated air: packet is heard by every module in RX mode which
+ * has the same channel, data rate and address, overlapping packets on the
+ * same channel are lost, random loss could be added.
+ *
+ * Time is simulated in microseconds and advances only in sim_delay_us (all
+ * library delays go there through rfm73_hal.h) and by SPI bytes. IRQ
+ * interrupt and periodic timers are called from sim_delay_us.
+ *
+ * Interrupt-driven SPI transfers are done at once by default. With
+ * sim_set_spi_async they are finished by simulated SPI interrupt when their
+ * bytes are shifted out, as on target, and SPI used by interrupt (IRQ, SPI
+ * or timer) while transfer is in progress stops the program: target would
+ * hang or break the transfer there.
+ *
+ * The library itself drives one module at a time, selected by sim_select.
+ * Other modules are operated directly with sim_radio_* functions.
+ *
+ * Library is built for host with RFM73_HOST defined, e.g. from repository
+ * root:
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_example \
+ *       RFM73.c sim/rfm73_sim.c sim/sim_example.c
+ */
+
+
+#ifndef RFM73_SIM_H_
+#define RFM73_SIM_H_
+
+#include <inttypes.h>
+
+/*! \brief Simulated RFM73 module.*/
+typedef struct sim_radio sim_radio_t;
+
+/*! \brief Counters of simulated module.*/
+typedef struct {
+	/*! \brief Packets put to air (retransmits included).*/
+	uint32_t tx_air;
+	/*! \brief Retransmits.*/
+	uint32_t tx_retries;
+	/*! \brief Packets finished with TX_DS.*/
+	uint32_t tx_ds;
+	/*! \brief Packets finished with MAX_RT.*/
+	uint32_t max_rt;
+	/*! \brief Packets put to RX FIFO.*/
+	uint32_t rx_ok;
+	/*! \brief Duplicates (same PID and payload) acknowledged and dropped.*/
+	uint32_t rx_dup;
+	/*! \brief Packets dropped because RX FIFO was full.*/
+	uint32_t rx_full;
+	/*! \brief Packets lost in air (random loss, noise or collision).*/
+	uint32_t rx_lost;
+	/*! \brief Microseconds spent transmitting.*/
+	uint32_t air_us;
+} sim_stats_t;
+
+/* time */
+
+/* current simulated time, us */
+uint64_t sim_now();
+/* advances time, calls timers and IRQ interrupt */
+void sim_delay_us(uint32_t us);
+/* calls fn every period_us of simulated time (like timer interrupt) */
+void sim_set_timer(void (*fn)(), uint32_t period_us);
+/* sets time from IRQ line going active to call of IRQ interrupt, us
+   (default 0), like interrupt serviced late */
+void sim_set_irq_delay(uint32_t us);
+/* sets SPI byte time in ns (default 1600, SCK 5 MHz) */
+void sim_set_spi_byte_ns(uint32_t ns);
+/* 1 - interrupt-driven SPI transfers are finished later by SPI interrupt,
+   0 - they are done at once (default) */
+void sim_set_spi_async(uint8_t on);
+/* number of SPI bytes exchanged by library (see spi.h) */
+uint32_t sim_spi_bytes();
+
+/* air */
+
+/* sets probability of losing a packet or acknowledge, percents */
+void sim_air_loss(uint8_t percent);
+/* turns continuous noise (carrier) on channel on or off */
+void sim_air_noise(uint8_t ch, uint8_t on);
+/* seeds random number generator of air */
+void sim_seed(uint32_t seed);
+
+/* modules */
+
+/* creates module in power on reset state */
+sim_radio_t* sim_radio_new();
+/* selects module driven by library (pins, SPI, IRQ) */
+void sim_select(sim_radio_t* r);
+/* returns selected module */
+sim_radio_t* sim_selected();
+/* resets module to power on state, like power glitch does */
+void sim_radio_reset(sim_radio_t* r);
+/* copies registers and addresses, FIFOs and state are not copied */
+void sim_radio_copy(sim_radio_t* dst, const sim_radio_t* src);
+/* one SPI transaction with module, returns STATUS */
+uint8_t sim_radio_spi(sim_radio_t* r, uint8_t cmd, const uint8_t* tx,
+                      uint8_t* rx, uint8_t len);
+/* writes one byte register of bank 0 */
+void sim_radio_write_reg(sim_radio_t* r, uint8_t reg, uint8_t value);
+/* reads one byte register of bank 0 */
+uint8_t sim_radio_read_reg(sim_radio_t* r, uint8_t reg);
+/* sets CE line of module */
+void sim_radio_ce(sim_radio_t* r, uint8_t level);
+/* returns IRQ line of module (0 - active) */
+uint8_t sim_radio_irq(sim_radio_t* r);
+/* returns counters of module */
+sim_stats_t* sim_radio_stats(sim_radio_t* r);
+
+/* HAL of selected module (see rfm73_hal.h) */
+
+void sim_ce(uint8_t level);
+uint8_t sim_ce_get();
+void sim_csn(uint8_t level);
+void sim_irq_int(uint8_t on);
+
+#endif /* RFM73_SIM_H_ */
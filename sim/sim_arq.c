@@ -0,0 +1,123 @@
+/*
+ * sim_arq.c
+ *
+ * Host test of software retransmission: backoff of every packet must stay
+ * within its windows, attempts within #ARQ_MAX_TRIES, lossy link must be
+ * recovered by retransmits, cached destination must be forgotten by
+ * arq_reset_stats.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_arq \
+ *       RFM73.c arq.c sim/rfm73_sim.c sim/sim_arq.c
+ */
+
+#include "RFM73.h"
+#include "arq.h"
+#include "sim/rfm73_sim.h"
+#include "sim/sim_test.h"
+
+#define PACKETS     200
+#define R_CONFIG    0x00
+#define R_STATUS    0x07
+
+static sim_radio_t* peer;
+
+/* reads out RX FIFO of receiver, returns number of packets */
+static unsigned drain() {
+	uint8_t w, buf[RFM73_MAX_PACKET_LEN];
+	unsigned n = 0;
+	while (((sim_radio_spi(peer, 0xFF, 0, 0, 0) >> 1) & 7) != 7) {
+		sim_radio_spi(peer, 0x60, 0, &w, 1);
+		sim_radio_spi(peer, 0x61, 0, buf, w);
+		n++;
+	}
+	sim_radio_write_reg(peer, R_STATUS, 0x70);
+	return n;
+}
+
+/* maximum backoff of a dropped packet, ms */
+static uint32_t backoff_max() {
+	uint32_t sum = 0, window = ARQ_BACKOFF_MIN_MS;
+	uint8_t i;
+	for (i = 0; i < ARQ_MAX_TRIES - 1; i++) {
+		sum += window - 1;
+		if (window < ARQ_BACKOFF_MAX_MS) window <<= 1;
+	}
+	return sum;
+}
+
+int main(void) {
+	uint8_t data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	uint8_t a[5] = { 0x34, 0x43, 0x10, 0x10, 0x01 };
+	uint8_t b[5] = { 0x55, 0x55, 0x55, 0x55, 0x55 };
+	unsigned i, ok, got;
+	uint32_t bo, bo_total;
+	uint64_t t;
+	const arq_stats_t* s;
+	sim_radio_t* me = sim_radio_new();
+
+	peer = sim_radio_new();
+	sim_select(me);
+	sim_set_timer(rfm73_tick, 1000);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 0x23);
+	arq_init(77);
+
+	// nobody answers: every packet is dropped after all attempts, its backoff
+	// is within windows and sending takes at least the backoff time
+	bo_total = 0;
+	for (i = 0; i < 20; i++) {
+		s = arq_stats(a);
+		bo = s ? s->backoff_ms : 0;
+		t = sim_now();
+		SIM_CHECK(arq_send(a, data, sizeof(data)) == 1);
+		s = arq_stats(a);
+		bo = s->backoff_ms - bo;
+		SIM_CHECK(bo <= backoff_max());
+		SIM_CHECK(sim_now() - t >= bo * 1000UL);
+		bo_total += bo;
+	}
+	SIM_CHECK((s->sent == 20) && (s->failed == 20) && (s->delivered == 0));
+	SIM_CHECK(s->attempts == 20 * ARQ_MAX_TRIES);
+	SIM_CHECK(s->hw_retries == 20 * ARQ_MAX_TRIES * ARQ_HW_ARC);
+	// backoff is random: neither always 0 nor always maximum
+	SIM_CHECK((bo_total > 20 * backoff_max() / 4) &&
+	          (bo_total < 20 * backoff_max() * 3 / 4));
+	printf("dropped: average backoff %lu ms of %lu ms\n",
+	       (unsigned long)(bo_total / 20), (unsigned long)backoff_max());
+
+	// lossy link: retransmits deliver nearly everything
+	sim_radio_copy(peer, me);
+	sim_radio_write_reg(peer, R_CONFIG,
+	                    sim_radio_read_reg(peer, R_CONFIG) | 0x03);
+	sim_radio_ce(peer, 1);
+	arq_reset_stats();
+	sim_air_loss(60);
+	ok = 0;
+	got = 0;
+	for (i = 0; i < PACKETS; i++) {
+		if (arq_send(a, data, sizeof(data)) == 0) ok++;
+		got += drain();
+	}
+	sim_air_loss(0);
+	s = arq_stats(a);
+	SIM_CHECK(s->sent == PACKETS);
+	SIM_CHECK(s->delivered == ok);
+	SIM_CHECK(s->failed == PACKETS - ok);
+	SIM_CHECK(ok >= PACKETS * 9 / 10);
+	SIM_CHECK(got >= ok);
+	SIM_CHECK((s->attempts >= PACKETS) &&
+	          (s->attempts <= PACKETS * ARQ_MAX_TRIES));
+	SIM_CHECK(s->backoff_ms <= (uint32_t)(s->attempts - s->sent) *
+	          (ARQ_BACKOFF_MAX_MS - 1));
+	printf("60%% loss: %u of %u delivered, %u attempts, backoff %lu ms\n",
+	       ok, PACKETS, s->attempts, (unsigned long)s->backoff_ms);
+
+	// TX address changed by application: cache is dropped by reset
+	rfm73_set_tx_addr(b);
+	rfm73_set_rx_addr_p0(b);
+	arq_reset_stats();
+	SIM_CHECK(arq_stats(a) == 0);
+	SIM_CHECK(arq_send(a, data, sizeof(data)) == 0);
+	SIM_CHECK(drain() == 1);
+	return SIM_RESULT();
+}
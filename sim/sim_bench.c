@@ -0,0 +1,191 @@
+/*
+ * sim_bench.c
+ *
+ * Throughput and latency benchmark of RFM73 library on simulated modules.
+ * Every line of output is CSV record (see BENCH_HEADER), on-target
+ * benchmark (main.c built with RFM73_BENCH) prints the same records with
+ * platform "avr", so both could be tracked by one script.
+ *
+ * Times are simulated: air and protocol timing of the module model plus SPI
+ * time of sim_set_spi_byte_ns, CPU time of the target is not simulated, so
+ * cycles field is empty.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_bench \
+ *       RFM73.c sim/rfm73_sim.c sim/sim_bench.c
+ */
+
+#include "RFM73.h"
+#include "sim/rfm73_sim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* CSV fields: platform, operation, data rate, ACK used, number of
+   operations, SPI bytes, CPU cycles, time, packets per second and goodput
+   (payload bytes per second) */
+#define BENCH_HEADER  "platform,op,rate_kbps,ack,n,spi_bytes,cycles,time_us," \
+                      "pkt_per_s,goodput_Bps\n"
+
+#define BENCH_PACKETS 200
+#define BENCH_LEN     RFM73_MAX_PACKET_LEN
+#define BENCH_CHANNEL 0x23
+
+static sim_radio_t* me;
+static sim_radio_t* peer;
+static uint32_t bench_bytes;
+static uint64_t bench_t;
+
+static const uint8_t bench_rates[] = {
+	RFM73_DATA_RATE_250KBPS, RFM73_DATA_RATE_1MBPS, RFM73_DATA_RATE_2MBPS };
+static const uint16_t bench_kbps[] = { 250, 1000, 2000 };
+
+static void bench_start() {
+	bench_bytes = sim_spi_bytes();
+	bench_t = sim_now();
+}
+
+/* prints record, ok is number of packets delivered */
+static void bench_report(const char* op, uint16_t kbps, uint8_t ack,
+                         uint16_t n, uint16_t ok) {
+	uint64_t t = sim_now() - bench_t;
+	if (t == 0) t = 1;
+	printf("sim,%s,%u,%u,%u,%lu,,%llu,%llu,%llu\n", op, kbps, ack, n,
+	       (unsigned long)(sim_spi_bytes() - bench_bytes),
+	       (unsigned long long)t,
+	       (unsigned long long)(ok * 1000000ULL / t),
+	       (unsigned long long)(ok * (uint64_t)BENCH_LEN * 1000000ULL / t));
+}
+
+/* copies library settings to peer module and sets its mode */
+static void bench_peer(uint8_t prx) {
+	uint8_t cfg;
+	sim_radio_copy(peer, me);
+	cfg = sim_radio_read_reg(peer, 0x00) | 0x02;
+	sim_radio_write_reg(peer, 0x00, prx ? (cfg | 0x01) : (cfg & ~0x01));
+	sim_radio_spi(peer, 0xE1, 0, 0, 0);
+	sim_radio_spi(peer, 0xE2, 0, 0, 0);
+	sim_radio_write_reg(peer, 0x07, 0x70);
+	sim_radio_ce(peer, prx);
+}
+
+/* reads all packets from RX FIFO of peer, returns their number */
+static uint16_t bench_peer_drain() {
+	uint8_t n = 0, wid, buf[32];
+	while (((sim_radio_spi(peer, 0xFF, 0, 0, 0) >> 1) & 7) != 7) {
+		sim_radio_spi(peer, 0x60, 0, &wid, 1);
+		sim_radio_spi(peer, 0x61, 0, buf, wid);
+		n++;
+	}
+	sim_radio_write_reg(peer, 0x07, 0x40);
+	return n;
+}
+
+static void bench_send(uint8_t r, uint8_t ack) {
+	uint8_t buf[BENCH_LEN];
+	uint16_t i, ok = 0;
+	rfm73_set_rf_params(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	                    bench_rates[r]);
+	bench_peer(1);
+	memset(buf, 0x55, sizeof(buf));
+	bench_start();
+	for (i = 0; i < BENCH_PACKETS; i++) {
+		buf[0] = (uint8_t)i;
+		rfm73_send_packet(ack ? RFM73_TX_WITH_ACK : RFM73_TX_WITH_NOACK,
+		                  buf, BENCH_LEN);
+		ok += bench_peer_drain();
+	}
+	bench_report("send_packet", bench_kbps[r], ack, BENCH_PACKETS, ok);
+}
+
+static void bench_receive(uint8_t r, uint8_t ack) {
+	uint8_t buf[BENCH_LEN], len, st;
+	uint16_t i, ok = 0;
+	rfm73_set_rf_params(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	                    bench_rates[r]);
+	rfm73_rx_mode();
+	bench_peer(0);
+	memset(buf, 0xAA, sizeof(buf));
+	bench_start();
+	for (i = 0; i < BENCH_PACKETS; i++) {
+		// peer sends one packet with CE pulse
+		sim_radio_spi(peer, ack ? 0xA0 : 0xB0, buf, 0, BENCH_LEN);
+		sim_radio_ce(peer, 1);
+		sim_delay_us(10);
+		sim_radio_ce(peer, 0);
+		do {
+			sim_delay_us(10);
+			st = sim_radio_read_reg(peer, 0x07);
+		} while (!(st & 0x30));
+		sim_radio_write_reg(peer, 0x07, 0x70);
+		if (st & 0x10) sim_radio_spi(peer, 0xE1, 0, 0, 0);
+		while (rfm73_receive_packet(RFM73_RX_WITH_NOACK, buf, &len) == 0)
+			ok++;
+	}
+	bench_report("receive_packet", bench_kbps[r], ack, BENCH_PACKETS, ok);
+}
+
+static void bench_request(uint8_t r) {
+	uint8_t buf[BENCH_LEN];
+	uint16_t i, ok = 0;
+	rfm73_packet_t resp;
+	rfm73_set_rf_params(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	                    bench_rates[r]);
+	bench_peer(1);
+	memset(buf, 0x5A, sizeof(buf));
+	bench_start();
+	for (i = 0; i < BENCH_PACKETS; i++) {
+		// peer has response ready before request comes
+		buf[0] = (uint8_t)i;
+		sim_radio_spi(peer, 0xA8, buf, 0, BENCH_LEN);
+		if ((rfm73_send_request(buf, BENCH_LEN, &resp) == 0) &&
+		    (resp.data[0] == (uint8_t)i))
+			ok++;
+		bench_peer_drain();
+	}
+	bench_report("send_request", bench_kbps[r], 1, BENCH_PACKETS, ok);
+}
+
+static void bench_find() {
+	uint8_t ch = 0, dr = 0, found;
+	// peer waits at 1 Mbps on BENCH_CHANNEL
+	rfm73_set_rf_params(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	                    RFM73_DATA_RATE_1MBPS);
+	rfm73_set_channel(BENCH_CHANNEL);
+	bench_peer(1);
+	rfm73_set_channel(0);
+	bench_start();
+	found = rfm73_find_receiver(&ch, &dr);
+	// n is 1 if receiver was found
+	bench_report("find_receiver", 1000, 1, found, 0);
+	// the same with start point near the receiver
+	ch = BENCH_CHANNEL - 2;
+	dr = RFM73_DATA_RATE_2MBPS;
+	bench_start();
+	found = rfm73_find_receiver(&ch, &dr);
+	bench_report("find_receiver_near", 1000, 1, found, 0);
+}
+
+int main(void) {
+	uint8_t r;
+	me = sim_radio_new();
+	peer = sim_radio_new();
+	sim_select(me);
+	sim_set_timer(rfm73_tick, 1000);
+
+	printf(BENCH_HEADER);
+	bench_start();
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, BENCH_CHANNEL);
+	rfm73_irq_enable(0, 0, 0);
+	bench_report("init", 2000, 0, 1, 0);
+
+	for (r = 0; r < sizeof(bench_rates); r++) {
+		bench_send(r, 1);
+		bench_send(r, 0);
+		bench_receive(r, 1);
+		bench_receive(r, 0);
+		bench_request(r);
+	}
+	bench_find();
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * sim_cap.c
+ *
+ * Host test of packet capture: time and channel of record must be the ones of
+ * reception, not of cap_poll, time must go on over long idle periods, STATUS
+ * must be the one read with payload, and records must be framed as cap.h
+ * tells.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_cap \
+ *       RFM73.c cap.c sim/rfm73_sim.c sim/sim_cap.c
+ */
+
+#include <string.h>
+#include "RFM73.h"
+#include "cap.h"
+#include "sim/rfm73_sim.h"
+#include "sim/sim_test.h"
+
+#define R_CONFIG    0x00
+#define R_RF_CH     0x05
+#define R_STATUS    0x07
+
+static sim_radio_t* peer;
+/* the last record written */
+static uint8_t rec[CAP_MAX_RECORD], rec_len;
+static unsigned recs;
+
+static uint8_t out(const uint8_t* buf, uint8_t len) {
+	memcpy(rec, buf, len);
+	rec_len = len;
+	recs++;
+	return 0;
+}
+
+/* peer sends packet of len bytes of value v, returns 1 if it is
+   acknowledged */
+static uint8_t peer_send(uint8_t v, uint8_t len) {
+	uint8_t buf[RFM73_MAX_PACKET_LEN], st;
+	memset(buf, v, len);
+	sim_radio_spi(peer, 0xA0, buf, 0, len);
+	sim_radio_ce(peer, 1);
+	sim_delay_us(15);
+	sim_radio_ce(peer, 0);
+	do {
+		sim_delay_us(10);
+		st = sim_radio_read_reg(peer, R_STATUS);
+	} while (!(st & 0x30));
+	sim_radio_write_reg(peer, R_STATUS, 0x70);
+	if (st & 0x20) return 1;
+	sim_radio_spi(peer, 0xE1, 0, 0, 0);
+	return 0;
+}
+
+/* time of the last record, ms */
+static uint32_t rec_ms() {
+	return rec[2] | (rec[3] << 8) | ((uint32_t)rec[4] << 16) |
+	       ((uint32_t)rec[5] << 24);
+}
+
+/* checks framing of the last record */
+static uint8_t rec_ok(uint8_t len) {
+	uint8_t i, sum = 0;
+	if (rec_len != CAP_HEADER_LEN + len + 1) return 0;
+	if ((rec[0] != CAP_SYNC0) || (rec[1] != CAP_SYNC1)) return 0;
+	if (rec[11] != len) return 0;
+	for (i = 2; i < rec_len - 1; i++) sum += rec[i];
+	return sum == rec[rec_len - 1];
+}
+
+int main(void) {
+	unsigned k;
+	uint64_t t0, t;
+	sim_radio_t* me = sim_radio_new();
+
+	peer = sim_radio_new();
+	sim_select(me);
+	sim_set_timer(rfm73_tick, 1000);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 10);
+	rfm73_irq_enable(0, 0, 0);
+	sim_radio_copy(peer, me);
+	sim_radio_write_reg(peer, R_CONFIG,
+	                    (sim_radio_read_reg(peer, R_CONFIG) | 0x02) & ~0x01);
+	sim_radio_spi(peer, 0xE1, 0, 0, 0);
+	cap_init(out);
+	t0 = sim_now();
+
+	// packet is recorded with time and channel of reception, though channel
+	// is changed before cap_poll
+	sim_delay_us(20000);
+	SIM_CHECK(peer_send(0x11, 5) == 1);
+	t = (sim_now() - t0) / 1000;
+	sim_delay_us(300000);
+	rfm73_set_channel(20);
+	SIM_CHECK(cap_poll() == 1);
+	SIM_CHECK(rec_ok(5) && (rec[CAP_HEADER_LEN] == 0x11));
+	SIM_CHECK((rec_ms() >= t - 1) && (rec_ms() <= t + 1));
+	SIM_CHECK(rec[6] == 10);
+	SIM_CHECK((rec[7] == 0) && (rec[10] == 0));
+	// RX_P_NO of STATUS is pipe of the packet
+	SIM_CHECK(((rec[8] >> 1) & 7) == rec[7]);
+
+	// time goes on over idle periods longer than 16-bit rfm73_millis
+	rfm73_set_channel(10);
+	for (k = 0; k < 100; k++) {
+		sim_delay_us(1000000);
+		SIM_CHECK(cap_poll() == 0);
+	}
+	SIM_CHECK(peer_send(0x22, 32) == 1);
+	t = (sim_now() - t0) / 1000;
+	SIM_CHECK(cap_poll() == 1);
+	SIM_CHECK(rec_ok(32) && (rec[CAP_HEADER_LEN + 31] == 0x22));
+	SIM_CHECK((rec_ms() >= t - 1) && (rec_ms() <= t + 1));
+	SIM_CHECK((recs == 2) && (cap_stats()->records == 2));
+	return SIM_RESULT();
+}
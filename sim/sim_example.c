@@ -0,0 +1,85 @@
+/*
+ * sim_example.c
+ *
+ * Host example of RFM73 library running on simulated modules: library
+ * drives transmitter, second module is a receiver that is read directly.
+ * Air loses some packets, so retransmits are seen in statistics.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_example \
+ *       RFM73.c sim/rfm73_sim.c sim/sim_example.c
+ */
+
+#include "RFM73.h"
+#include "sim/rfm73_sim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define PACKETS     1000
+#define LOSS        10
+
+/* reads all packets from RX FIFO of receiver, returns their number */
+static uint8_t drain(sim_radio_t* r, uint8_t* last) {
+	uint8_t n = 0, wid, buf[32];
+	// RX_P_NO = 7: RX FIFO is empty
+	while (((sim_radio_spi(r, 0xFF, 0, 0, 0) >> 1) & 7) != 7) {
+		sim_radio_spi(r, 0x60, 0, &wid, 1);
+		sim_radio_spi(r, 0x61, 0, buf, wid);
+		*last = buf[0];
+		n++;
+	}
+	// clear RX_DR
+	sim_radio_write_reg(r, 0x07, 0x40);
+	return n;
+}
+
+int main(void) {
+	uint8_t buf[32], last = 0;
+	uint16_t i, sent = 0, received = 0;
+	uint64_t t0;
+	rfm73_stats_t ls;
+	sim_radio_t* tx = sim_radio_new();
+	sim_radio_t* rx = sim_radio_new();
+	sim_stats_t* st = sim_radio_stats(tx);
+
+	sim_select(tx);
+	sim_set_timer(rfm73_tick, 1000);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 0x23);
+	rfm73_irq_enable(0, 0, 0);
+	if (rfm73_verify())
+		printf("register shadow differs from module\n");
+
+	// receiver gets the same settings and stays in PRX mode
+	sim_radio_copy(rx, tx);
+	sim_radio_ce(rx, 1);
+	sim_air_loss(LOSS);
+
+	t0 = sim_now();
+	for (i = 0; i < PACKETS; i++) {
+		memset(buf, 0, sizeof(buf));
+		buf[0] = (uint8_t)i;
+		if (rfm73_send_packet(RFM73_TX_WITH_ACK, buf, 17) == 0) sent++;
+		received += drain(rx, &last);
+	}
+	t0 = sim_now() - t0;
+
+	printf("packets: %u, acknowledged: %u, received: %u\n",
+	       PACKETS, sent, received);
+	printf("in air: %lu, retries: %lu, max_rt: %lu\n",
+	       (unsigned long)st->tx_air, (unsigned long)st->tx_retries,
+	       (unsigned long)st->max_rt);
+	printf("time: %lu us, %lu bytes/s\n", (unsigned long)t0,
+	       (unsigned long)(17ULL * received * 1000000ULL / t0));
+
+	// the same seen by the library
+	rfm73_stats(&ls, 1);
+	printf("library: sent %lu, acked %lu, failed %lu, tx %lu ms\n",
+	       (unsigned long)ls.tx_sent, (unsigned long)ls.tx_acked,
+	       (unsigned long)ls.tx_failed, (unsigned long)ls.tx_ms);
+	printf("retransmits:");
+	for (i = 0; i < 16; i++)
+		printf(" %lu", (unsigned long)ls.tx_retries[i]);
+	printf("\n");
+	return 0;
+}
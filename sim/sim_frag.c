@@ -0,0 +1,184 @@
+/*
+ * sim_frag.c
+ *
+ * Host test of fragmentation: message must be delivered over lossy link,
+ * sending must be aborted when receiver is gone, receiver must pass
+ * fragments to sink in order, drop duplicates and old message, and keep
+ * fragments acknowledged while its RX queue was full over a mode switch.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_frag \
+ *       RFM73.c frag.c sim/rfm73_sim.c sim/sim_frag.c
+ */
+
+#include <string.h>
+#include "RFM73.h"
+#include "frag.h"
+#include "sim/rfm73_sim.h"
+#include "sim/sim_test.h"
+
+#define MSG_LEN     4000
+#define R_CONFIG    0x00
+#define R_STATUS    0x07
+
+static sim_radio_t* peer;
+static uint8_t msg[MSG_LEN], out[MSG_LEN];
+/* fragments seen by peer receiver: bit of every fragment of the message */
+static uint8_t seen[32];
+static unsigned peer_rx, sink_bytes;
+static uint16_t sink_next;
+static uint8_t sink_bad;
+
+/* timer of sender: peer receiver is drained every 100 us */
+static void sender_timer() {
+	static uint8_t div;
+	uint8_t w, buf[RFM73_MAX_PACKET_LEN];
+	uint16_t off;
+	if (++div == 10) {
+		div = 0;
+		rfm73_tick();
+	}
+	while (((sim_radio_spi(peer, 0xFF, 0, 0, 0) >> 1) & 7) != 7) {
+		sim_radio_spi(peer, 0x60, 0, &w, 1);
+		sim_radio_spi(peer, 0x61, 0, buf, w);
+		sim_radio_write_reg(peer, R_STATUS, 0x40);
+		peer_rx++;
+		seen[buf[1] >> 3] |= 1 << (buf[1] & 7);
+		off = (uint16_t)buf[1] * FRAG_DATA_LEN;
+		memcpy(out + off, buf + FRAG_HEADER_LEN, w - FRAG_HEADER_LEN);
+	}
+}
+
+/* sink of receiver: data must come in order */
+static void sink(uint16_t offset, const uint8_t* data, uint8_t len) {
+	if (offset != sink_next) sink_bad = 1;
+	memcpy(out + offset, data, len);
+	sink_next = offset + len;
+	sink_bytes += len;
+}
+
+/* peer transmitter sends fragment n of message id, returns 1 if it is
+   acknowledged */
+static uint8_t peer_send(uint8_t id, uint8_t n, uint8_t last, uint16_t len) {
+	uint8_t buf[RFM73_MAX_PACKET_LEN], st, cnt;
+	uint16_t off = (uint16_t)n * FRAG_DATA_LEN;
+	cnt = (len - off > FRAG_DATA_LEN) ? FRAG_DATA_LEN : len - off;
+	buf[0] = id;
+	buf[1] = n;
+	buf[2] = last;
+	memcpy(buf + FRAG_HEADER_LEN, msg + off, cnt);
+	sim_radio_spi(peer, 0xA0, buf, 0, FRAG_HEADER_LEN + cnt);
+	sim_radio_ce(peer, 1);
+	sim_delay_us(15);
+	sim_radio_ce(peer, 0);
+	do {
+		sim_delay_us(10);
+		st = sim_radio_read_reg(peer, R_STATUS);
+	} while (!(st & 0x30));
+	sim_radio_write_reg(peer, R_STATUS, 0x70);
+	if (st & 0x20) return 1;
+	sim_radio_spi(peer, 0xE1, 0, 0, 0);
+	return 0;
+}
+
+int main(void) {
+	uint8_t acked[16], i, n, last;
+	uint16_t len, l;
+	unsigned k;
+	uint64_t t;
+	sim_radio_t* me = sim_radio_new();
+	sim_radio_t* me2 = sim_radio_new();
+
+	for (l = 0; l < MSG_LEN; l++) msg[l] = l * 7 + (l >> 8);
+	last = (MSG_LEN - 1) / FRAG_DATA_LEN;
+
+	// sender: message over 20% loss
+	peer = sim_radio_new();
+	sim_select(me);
+	sim_set_timer(sender_timer, 100);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 10);
+	rfm73_irq_enable(0, 0, 0);
+	rfm73_set_autort(500, 3);
+	sim_radio_copy(peer, me);
+	sim_radio_write_reg(peer, R_CONFIG,
+	                    sim_radio_read_reg(peer, R_CONFIG) | 0x03);
+	sim_radio_ce(peer, 1);
+	sim_air_loss(20);
+	t = sim_now();
+	SIM_CHECK(frag_send(msg, MSG_LEN) == 0);
+	printf("%u bytes over 20%% loss: %u packets, %lu ms\n", MSG_LEN, peer_rx,
+	       (unsigned long)((sim_now() - t) / 1000));
+	for (n = 0; n <= last; n++) SIM_CHECK(seen[n >> 3] & (1 << (n & 7)));
+	SIM_CHECK(memcmp(msg, out, MSG_LEN) == 0);
+	SIM_CHECK(rfm73_send_queued() == 0);
+	sim_air_loss(0);
+
+	// receiver is gone: sending is aborted after FRAG_MAX_FAILS fragments
+	sim_radio_ce(peer, 0);
+	peer_rx = 0;
+	SIM_CHECK(frag_send(msg, MSG_LEN) == 1);
+	SIM_CHECK(peer_rx == 0);
+	SIM_CHECK(rfm73_send_queued() == 0);
+	SIM_CHECK(frag_send(msg, 0) == 1);
+
+	// receiver: library on another module, peer sends fragments by hand
+	sim_select(me2);
+	sim_set_timer(rfm73_tick, 1000);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 10);
+	rfm73_irq_enable(0, 0, 0);
+	sim_radio_copy(peer, me2);
+	sim_radio_write_reg(peer, R_CONFIG,
+	                    (sim_radio_read_reg(peer, R_CONFIG) | 0x02) & ~0x01);
+	sim_radio_spi(peer, 0xE1, 0, 0, 0);
+	frag_sink(sink);
+
+	// fragments out of order and duplicates are passed in order once
+	{
+		const uint8_t order[] = { 1, 0, 0, 3, 1, 2, 4 };
+		memset(out, 0, sizeof(out));
+		len = 4 * FRAG_DATA_LEN + 5;
+		for (i = 0; i < sizeof(order); i++) {
+			SIM_CHECK(peer_send(1, order[i], 4, len) == 1);
+			SIM_CHECK(frag_receive(&l) == (i == sizeof(order) - 1 ? 0 : 1));
+		}
+		SIM_CHECK(l == len);
+		SIM_CHECK((sink_bytes == len) && !sink_bad);
+		SIM_CHECK(memcmp(msg, out, len) == 0);
+	}
+
+	// fragment of new message drops unfinished one
+	sink_next = 0;
+	SIM_CHECK(peer_send(2, 0, 3, 4 * FRAG_DATA_LEN) == 1);
+	SIM_CHECK(peer_send(2, 2, 3, 4 * FRAG_DATA_LEN) == 1);
+	SIM_CHECK(frag_receive(&l) == 1);
+	sink_next = 0;
+	SIM_CHECK(peer_send(3, 0, 0, 10) == 1);
+	SIM_CHECK((frag_receive(&l) == 0) && (l == 10) && !sink_bad);
+
+	// receiver is busy: RX queue fills up and module acknowledges more
+	// fragments into RX FIFO, they must survive switch of mode
+	sink_next = 0;
+	sink_bytes = 0;
+	memset(out, 0, sizeof(out));
+	memset(acked, 0, sizeof(acked));
+	len = 12 * FRAG_DATA_LEN;
+	for (n = 0; n < 12; n++) acked[n] = peer_send(4, n, 11, len);
+	SIM_CHECK(acked[RFM73_RXQ_SIZE + 2] && !acked[RFM73_RXQ_SIZE + 3]);
+	rfm73_rx_mode();
+	sim_delay_us(1000);
+	// peer retries only fragments that were not acknowledged
+	for (k = 0; k < 100; k++) {
+		if (frag_receive(&l) == 0) break;
+		for (n = 0; n < 12; n++)
+			if (!acked[n]) {
+				acked[n] = peer_send(4, n, 11, len);
+				break;
+			}
+		sim_delay_us(1000);
+	}
+	SIM_CHECK(k < 100);
+	SIM_CHECK((l == len) && (sink_bytes == len) && !sink_bad);
+	SIM_CHECK(memcmp(msg, out, len) == 0);
+	return SIM_RESULT();
+}
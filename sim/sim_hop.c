@@ -0,0 +1,147 @@
+/*
+ * sim_hop.c
+ *
+ * Host test of hopping layer: noisy channels of master must be blacklisted
+ * (loss at the replacement channel is charged to its own entry), slave must
+ * follow master and fall back to the first channel without it, sequence
+ * shorter than 2 channels must be clamped.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_hop \
+ *       RFM73.c hop.c sim/rfm73_sim.c sim/sim_hop.c
+ */
+
+#include "RFM73.h"
+#include "hop.h"
+#include "sim/rfm73_sim.h"
+#include "sim/sim_test.h"
+
+#define CHANNELS    12
+#define STEP        3
+#define SEED        0x1234
+#define SLOT_US     (HOP_SLOT_MS * 1000UL)
+#define R_CONFIG    0x00
+#define R_RF_CH     0x05
+#define R_STATUS    0x07
+
+/* one receiver at every channel of sequence */
+static sim_radio_t* rx[CHANNELS];
+
+static void tick() {
+	rfm73_tick();
+	hop_tick();
+}
+
+/* reads out RX FIFO of all receivers, so they acknowledge every packet */
+static void drain() {
+	uint8_t c, w, buf[RFM73_MAX_PACKET_LEN];
+	for (c = 0; c < CHANNELS; c++) {
+		while (((sim_radio_spi(rx[c], 0xFF, 0, 0, 0) >> 1) & 7) != 7) {
+			sim_radio_spi(rx[c], 0x60, 0, &w, 1);
+			sim_radio_spi(rx[c], 0x61, 0, buf, w);
+		}
+		sim_radio_write_reg(rx[c], R_STATUS, 0x70);
+	}
+}
+
+/* sends until time 'until', returns number of delivered packets */
+static unsigned send_until(uint64_t until, unsigned* sent) {
+	uint8_t data[3] = { 1, 2, 3 };
+	unsigned ok = 0;
+	*sent = 0;
+	while (sim_now() < until) {
+		if (hop_send(RFM73_TX_WITH_ACK, data, sizeof(data)) == 0) ok++;
+		(*sent)++;
+		sim_delay_us(1000);
+		drain();
+	}
+	return ok;
+}
+
+int main(void) {
+	uint8_t seq[CHANNELS], i, len, buf[HOP_MAX_PAYLOAD];
+	uint8_t pkt[6] = { 5, 3, 0x83, 9, 9, 9 };
+	unsigned ok, sent;
+	uint64_t t0;
+	sim_radio_t* me = sim_radio_new();
+	sim_radio_t* peer = sim_radio_new();
+
+	sim_select(me);
+	sim_set_timer(tick, 1000);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 0x23);
+	rfm73_set_autort(250, 3);
+	for (i = 0; i < CHANNELS; i++) {
+		rx[i] = sim_radio_new();
+		sim_radio_copy(rx[i], me);
+		sim_radio_write_reg(rx[i], R_CONFIG,
+		                    sim_radio_read_reg(rx[i], R_CONFIG) | 0x03);
+		sim_radio_write_reg(rx[i], R_RF_CH, i * STEP);
+		sim_radio_ce(rx[i], 1);
+	}
+
+	// sequence is taken from the middle of every slot
+	hop_init(HOP_MASTER, SEED, 0, STEP, CHANNELS);
+	sim_delay_us(SLOT_US / 2);
+	for (i = 0; i < CHANNELS; i++) {
+		hop_poll();
+		seq[i] = hop_channel();
+		SIM_CHECK((seq[i] % STEP == 0) && (seq[i] < CHANNELS * STEP));
+		sim_delay_us(SLOT_US);
+	}
+
+	// noise at two adjacent entries: entry 4 replaces blacklisted entry 3
+	// and must be blacklisted by losses in slot 3 already
+	sim_air_noise(seq[3], 1);
+	sim_air_noise(seq[4], 1);
+	hop_init(HOP_MASTER, SEED, 0, STEP, CHANNELS);
+	t0 = sim_now();
+	send_until(t0 + 4 * SLOT_US - 2000, &sent);
+	SIM_CHECK(hop_blacklist() == ((1UL << 3) | (1UL << 4)));
+
+	// blacklist holds, packets are delivered at the remaining channels
+	send_until(t0 + 20 * CHANNELS * SLOT_US, &sent);
+	ok = send_until(t0 + 30 * CHANNELS * SLOT_US, &sent);
+	SIM_CHECK(hop_blacklist() == ((1UL << 3) | (1UL << 4)));
+	SIM_CHECK(ok == sent);
+	printf("master: %u of %u delivered, blacklist %08lx\n", ok, sent,
+	       (unsigned long)hop_blacklist());
+	sim_air_noise(seq[3], 0);
+	sim_air_noise(seq[4], 0);
+
+	// slave: waits at the first channel, synchronizes by packet of master
+	hop_init(HOP_SLAVE, SEED, 0, STEP, CHANNELS);
+	rfm73_rx_mode();
+	SIM_CHECK(hop_synced() == 0);
+	SIM_CHECK(hop_channel() == seq[0]);
+	sim_radio_copy(peer, me);
+	sim_radio_write_reg(peer, R_CONFIG,
+	                    sim_radio_read_reg(peer, R_CONFIG) & ~0x01);
+	sim_radio_write_reg(peer, R_RF_CH, seq[0]);
+	sim_radio_spi(peer, 0xA0, pkt, 0, sizeof(pkt));
+	sim_radio_ce(peer, 1);
+	sim_delay_us(500);
+	sim_radio_ce(peer, 0);
+	SIM_CHECK(hop_receive(buf, &len) == 0);
+	SIM_CHECK((len == 3) && (buf[0] == 9));
+	SIM_CHECK(hop_synced() == 1);
+	SIM_CHECK(hop_channel() == seq[5]);
+	SIM_CHECK(hop_blacklist() == (1UL << 3));
+	SIM_CHECK(sim_ce_get() == 1);
+
+	// master is lost: slave returns to the first channel
+	sim_delay_us((HOP_SYNC_LOST_SLOTS + 1) * SLOT_US);
+	hop_poll();
+	SIM_CHECK(hop_synced() == 0);
+	SIM_CHECK(hop_channel() == seq[0]);
+
+	// too short sequence is clamped to 2 channels
+	for (len = 0; len < 2; len++) {
+		hop_init(HOP_MASTER, SEED, 60, STEP, len);
+		for (i = 0; i < 4; i++) {
+			SIM_CHECK((hop_channel() == 60) || (hop_channel() == 60 + STEP));
+			sim_delay_us(SLOT_US);
+			hop_poll();
+		}
+	}
+	return SIM_RESULT();
+}
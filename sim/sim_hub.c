@@ -0,0 +1,152 @@
+/*
+ * sim_hub.c
+ *
+ * Host test of star network hub with more leaf nodes than pipes: pipes must
+ * be rotated so every node is served within a few rotation periods, packets
+ * must be dispatched to their senders, lost packets must be counted and
+ * downlink data must reach its node.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_hub \
+ *       RFM73.c hub.c sim/rfm73_sim.c sim/sim_hub.c
+ */
+
+#include <string.h>
+#include "RFM73.h"
+#include "hub.h"
+#include "sim/rfm73_sim.h"
+#include "sim/sim_test.h"
+
+#define LEAVES      9
+#define ROUNDS      400
+/* leaf which skips sequence numbers */
+#define LOSSY       2
+#define R_CONFIG    0x00
+#define R_SETUP_RETR 0x04
+#define R_RX_ADDR_P0 0x0A
+#define R_STATUS    0x07
+#define R_TX_ADDR   0x10
+
+static sim_radio_t* leaf[LEAVES];
+static uint8_t leaf_seq[LEAVES];
+static unsigned leaf_dl[LEAVES], bad;
+static const uint8_t base[5] = { 0x00, 0x21, 0x22, 0x23, 0x24 };
+
+/* leaf l sends one packet and reads downlink data from acknowledge, returns
+   1 if packet is acknowledged */
+static uint8_t leaf_send(uint8_t l) {
+	uint8_t buf[8], st, w, ack[RFM73_MAX_PACKET_LEN];
+	sim_radio_t* p = leaf[l];
+	buf[0] = leaf_seq[l];
+	memset(buf + 1, l, sizeof(buf) - 1);
+	sim_radio_spi(p, 0xA0, buf, 0, sizeof(buf));
+	sim_radio_ce(p, 1);
+	sim_delay_us(15);
+	sim_radio_ce(p, 0);
+	do {
+		sim_delay_us(10);
+		st = sim_radio_read_reg(p, R_STATUS);
+	} while (!(st & 0x30));
+	sim_radio_write_reg(p, R_STATUS, 0x70);
+	if (st & 0x10) {
+		sim_radio_spi(p, 0xE1, 0, 0, 0);
+		return 0;
+	}
+	while (((sim_radio_spi(p, 0xFF, 0, 0, 0) >> 1) & 7) != 7) {
+		sim_radio_spi(p, 0x60, 0, &w, 1);
+		sim_radio_spi(p, 0x61, 0, ack, w);
+		if (ack[0] != l) bad++;
+		leaf_dl[l]++;
+	}
+	leaf_seq[l]++;
+	return 1;
+}
+
+/* checks that pipes are bound to different nodes, returns number of them */
+static uint8_t pipes_bound() {
+	uint8_t l, n = 0, used = 0;
+	for (l = 0; l < LEAVES; l++) {
+		uint8_t pipe = hub_node(l)->pipe;
+		if (pipe == HUB_NONE) continue;
+		SIM_CHECK((pipe < HUB_PIPES) && !(used & (1 << pipe)));
+		used |= 1 << pipe;
+		n++;
+	}
+	return n;
+}
+
+int main(void) {
+	uint8_t l, node, buf[RFM73_MAX_PACKET_LEN], len, addr[5];
+	unsigned k, acked = 0;
+	uint64_t since[LEAVES], wait, wait_max = 0;
+	const hub_node_t* nd;
+	sim_radio_t* me = sim_radio_new();
+
+	sim_select(me);
+	sim_set_timer(rfm73_tick, 1000);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 10);
+	rfm73_irq_enable(0, 0, 0);
+
+	// empty hub is polled safely
+	hub_init(base);
+	sim_delay_us(2000UL * HUB_ROTATE_MS);
+	hub_poll();
+	SIM_CHECK(hub_node(0) == 0);
+	SIM_CHECK(hub_receive(&node, buf, &len) == 1);
+
+	for (l = 0; l < LEAVES; l++) {
+		SIM_CHECK(hub_add(0x40 + l) == l);
+		since[l] = sim_now();
+	}
+	SIM_CHECK(hub_add(0x40) == 0);
+	SIM_CHECK(pipes_bound() == HUB_PIPES);
+	rfm73_rx_mode();
+	for (l = 0; l < LEAVES; l++) {
+		leaf[l] = sim_radio_new();
+		sim_radio_copy(leaf[l], me);
+		memcpy(addr, base, 5);
+		addr[0] = 0x40 + l;
+		sim_radio_spi(leaf[l], 0x20 | R_TX_ADDR, addr, 0, 5);
+		sim_radio_spi(leaf[l], 0x20 | R_RX_ADDR_P0, addr, 0, 5);
+		sim_radio_write_reg(leaf[l], R_CONFIG, 0x0E);
+		sim_radio_write_reg(leaf[l], R_SETUP_RETR, 0x13);
+		sim_radio_spi(leaf[l], 0xE1, 0, 0, 0);
+		sim_radio_spi(leaf[l], 0xE2, 0, 0, 0);
+		sim_radio_write_reg(leaf[l], R_STATUS, 0x70);
+	}
+
+	// every leaf sends in turn, hub has downlink data for all of them
+	for (k = 0; k < ROUNDS; k++) {
+		for (l = 0; l < LEAVES; l++) {
+			buf[0] = l;
+			hub_send(l, buf, 4);
+			hub_poll();
+			acked += leaf_send(l);
+			if ((k % 7 == 3) && (l == LOSSY)) leaf_seq[l]++;
+			while (hub_receive(&node, buf, &len) == 0)
+				if ((node != buf[0]) || (len != 7)) bad++;
+			sim_delay_us(500);
+		}
+		// time without pipe of every node
+		SIM_CHECK(pipes_bound() == HUB_PIPES);
+		for (l = 0; l < LEAVES; l++) {
+			if (hub_node(l)->pipe != HUB_NONE) since[l] = sim_now();
+			wait = sim_now() - since[l];
+			if (wait > wait_max) wait_max = wait;
+		}
+	}
+	SIM_CHECK(bad == 0);
+	// node waits for pipe up to (nodes - pipes) rotations
+	SIM_CHECK(wait_max <= (LEAVES - HUB_PIPES + 1) * HUB_ROTATE_MS * 1000UL);
+	for (l = 0; l < LEAVES; l++) {
+		nd = hub_node(l);
+		SIM_CHECK(nd->rx >= ROUNDS / 2);
+		SIM_CHECK(nd->dup == 0);
+		SIM_CHECK(nd->lost == ((l == LOSSY) ? ROUNDS / 7 : 0));
+		SIM_CHECK(nd->tx == leaf_dl[l]);
+	}
+	SIM_CHECK(hub_node(LOSSY)->quality < 255);
+	printf("%u of %u packets acknowledged, longest wait for pipe %u ms\n",
+	       acked, ROUNDS * LEAVES, (unsigned)(wait_max / 1000));
+	return SIM_RESULT();
+}
@@ -0,0 +1,162 @@
+/*
+ * sim_irq.c
+ *
+ * Host test of interrupt-driven operation with SPI transfers finished by SPI
+ * interrupt later, as on target: acknowledges with payload (TX_DS and RX_DR
+ * in one event) must not make IRQ interrupt wait for SPI while the next
+ * queued packet is written, packets queued from callbacks must be sent,
+ * callbacks must be able to use SPI, and application which only waits for
+ * callbacks must get results of all packets, timeouts too.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_irq \
+ *       RFM73.c sim/rfm73_sim.c sim/sim_irq.c
+ */
+
+#include "RFM73.h"
+#include "sim/rfm73_sim.h"
+#include "sim/sim_test.h"
+
+#define PACKETS     300
+#define R_CONFIG    0x00
+#define R_STATUS    0x07
+#define R_FIFO_STATUS 0x17
+
+/* IRQ latencies, us: one, two or more events are merged */
+static const uint16_t delays[] = { 0, 300, 700 };
+
+static sim_radio_t* peer;
+/* sequence numbers: next to queue, next expected by peer, next acknowledge
+   payload of peer and next expected by library */
+static uint8_t next, peer_seq, ack_seq, ack_exp;
+/* packets to queue and results of packets */
+static unsigned to_send, done, delivered, max_rt, timeouts;
+static unsigned acks, peer_rx, bad, tx_ds, max_rt_ev;
+
+/* peer receiver: reads packets and keeps acknowledge payloads loaded */
+static void timer() {
+	static uint8_t div;
+	uint8_t w, buf[RFM73_MAX_PACKET_LEN];
+	if (++div == 10) {
+		div = 0;
+		rfm73_tick();
+	}
+	while (((sim_radio_spi(peer, 0xFF, 0, 0, 0) >> 1) & 7) != 7) {
+		sim_radio_spi(peer, 0x60, 0, &w, 1);
+		sim_radio_spi(peer, 0x61, 0, buf, w);
+		sim_radio_write_reg(peer, R_STATUS, 0x40);
+		if ((w != 24) || (buf[0] != peer_seq)) bad++;
+		peer_seq++;
+		peer_rx++;
+	}
+	while (!(sim_radio_read_reg(peer, R_FIFO_STATUS) & 0x20)) {
+		buf[0] = ack_seq++;
+		sim_radio_spi(peer, 0xA8, buf, 0, 8);
+	}
+}
+
+/* queues the next packet */
+static uint8_t queue() {
+	uint8_t buf[24] = { 0 };
+	buf[0] = next;
+	if (rfm73_send_async(RFM73_TX_WITH_ACK, buf, sizeof(buf))) return 1;
+	next++;
+	to_send--;
+	return 0;
+}
+
+/* acknowledge payloads are taken right in callback */
+static void on_rx_dr(uint8_t status) {
+	rfm73_packet_t pkt;
+	while (rfm73_rx_get(&pkt) == 0) {
+		if ((pkt.len != 8) || (pkt.data[0] != ack_exp)) bad++;
+		ack_exp = pkt.data[0] + 1;
+		acks++;
+	}
+}
+
+/* callbacks may use SPI functions */
+static void on_tx_ds(uint8_t status) {
+	if (rfm73_verify()) bad++;
+	tx_ds++;
+}
+
+static void on_max_rt(uint8_t status) {
+	max_rt_ev++;
+}
+
+/* the next packet is queued from callback */
+static void on_done(uint8_t result) {
+	done++;
+	if (result == RFM73_TX_DELIVERED) delivered++;
+	if (result == RFM73_TX_MAX_RT) max_rt++;
+	if (result == RFM73_TX_TIMEOUT) timeouts++;
+	if (to_send) queue();
+}
+
+/* waits for results of n packets without polling the library, up to ms
+   milliseconds */
+static void wait_done(unsigned n, unsigned ms) {
+	while ((done < n) && ms--) sim_delay_us(1000);
+}
+
+int main(void) {
+	uint8_t d;
+	unsigned sent = 0;
+	sim_radio_t* me = sim_radio_new();
+
+	peer = sim_radio_new();
+	sim_select(me);
+	sim_set_spi_async(1);
+	// slow SCK: payload transfer takes about 100 us
+	sim_set_spi_byte_ns(4000);
+	sim_set_timer(rfm73_tick, 1000);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 0x23);
+	rfm73_set_autort(250, 3);
+	rfm73_irq_enable(on_rx_dr, on_tx_ds, on_max_rt);
+	rfm73_send_callback(on_done);
+	sim_radio_copy(peer, me);
+	sim_radio_write_reg(peer, R_CONFIG,
+	                    sim_radio_read_reg(peer, R_CONFIG) | 0x03);
+	sim_radio_ce(peer, 1);
+	sim_set_timer(timer, 100);
+
+	// stream with acknowledge payloads, packets are queued from callback
+	for (d = 0; d < sizeof(delays)/sizeof(delays[0]); d++) {
+		sim_set_irq_delay(delays[d]);
+		to_send = PACKETS;
+		while (to_send && !queue()) ;
+		sent += PACKETS;
+		wait_done(sent, 2000);
+		// the last acknowledge payload is read after its packet is finished
+		sim_delay_us(1000);
+		SIM_CHECK(done == sent);
+		SIM_CHECK(delivered == sent);
+		SIM_CHECK(peer_rx == sent);
+		SIM_CHECK(acks == sent);
+	}
+	SIM_CHECK(bad == 0);
+	SIM_CHECK(tx_ds > 0);
+	SIM_CHECK(rfm73_send_queued() == 0);
+	printf("%u packets, %u acknowledge payloads, %u TX_DS events\n",
+	       peer_rx, acks, tx_ds);
+
+	// receiver is gone: packets are finished by MAX_RT events
+	sim_radio_ce(peer, 0);
+	to_send = 3;
+	while (to_send && !queue()) ;
+	sent += 3;
+	wait_done(sent, 100);
+	SIM_CHECK((done == sent) && (max_rt == 3) && (max_rt_ev == 3));
+
+	// power glitch: module gives no events, packets are finished by timeout
+	// of rfm73_tick
+	to_send = 3;
+	while (to_send && !queue()) ;
+	sim_radio_reset(me);
+	sent += 3;
+	wait_done(sent, 4 * RFM73_TX_TIMEOUT_MS);
+	SIM_CHECK((done == sent) && (timeouts == 3));
+	SIM_CHECK(rfm73_send_queued() == 0);
+	return SIM_RESULT();
+}
@@ -0,0 +1,80 @@
+/*
+ * sim_request.c
+ *
+ * Host test of rfm73_send_request: response must come in acknowledge, and
+ * request must be refused while RX or TX queue holds packets, so they are
+ * not lost.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_request \
+ *       RFM73.c sim/rfm73_sim.c sim/sim_request.c
+ */
+
+#include "RFM73.h"
+#include "sim/rfm73_sim.h"
+#include "sim/sim_test.h"
+
+#define R_CONFIG    0x00
+#define R_STATUS    0x07
+
+static sim_radio_t* peer;
+
+/* loads acknowledge payload of peer: 4 bytes of value v */
+static void peer_response(uint8_t v) {
+	uint8_t buf[4] = { v, v, v, v };
+	sim_radio_spi(peer, 0xA8, buf, 0, sizeof(buf));
+}
+
+/* reads out RX FIFO of peer */
+static void peer_drain() {
+	uint8_t w, buf[RFM73_MAX_PACKET_LEN];
+	while (((sim_radio_spi(peer, 0xFF, 0, 0, 0) >> 1) & 7) != 7) {
+		sim_radio_spi(peer, 0x60, 0, &w, 1);
+		sim_radio_spi(peer, 0x61, 0, buf, w);
+	}
+	sim_radio_write_reg(peer, R_STATUS, 0x70);
+}
+
+int main(void) {
+	uint8_t req[3] = { 1, 2, 3 };
+	rfm73_packet_t resp, pkt;
+	sim_radio_t* me = sim_radio_new();
+
+	peer = sim_radio_new();
+	sim_select(me);
+	sim_set_timer(rfm73_tick, 1000);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 0x23);
+	sim_radio_copy(peer, me);
+	sim_radio_write_reg(peer, R_CONFIG,
+	                    sim_radio_read_reg(peer, R_CONFIG) | 0x03);
+	sim_radio_ce(peer, 1);
+
+	// response comes in acknowledge
+	peer_response(0x11);
+	SIM_CHECK(rfm73_send_request(req, sizeof(req), &resp) ==
+	          RFM73_TX_DELIVERED);
+	SIM_CHECK((resp.len == 4) && (resp.data[0] == 0x11));
+	SIM_CHECK(rfm73_send_request(req, sizeof(req), &resp) ==
+	          RFM73_TX_NO_PAYLOAD);
+	peer_drain();
+
+	// acknowledge payload of async packet waits in RX queue: refused
+	peer_response(0x22);
+	SIM_CHECK(rfm73_send_async(RFM73_TX_WITH_ACK, req, sizeof(req)) == 0);
+	peer_response(0x33);
+	SIM_CHECK(rfm73_send_request(req, sizeof(req), &resp) ==
+	          RFM73_TX_PENDING);
+	while (rfm73_send_status() == RFM73_TX_BUSY)
+		sim_delay_us(100);
+	SIM_CHECK(rfm73_send_request(req, sizeof(req), &resp) ==
+	          RFM73_TX_PENDING);
+	SIM_CHECK(rfm73_rx_get(&pkt) == 0);
+	SIM_CHECK((pkt.len == 4) && (pkt.data[0] == 0x22));
+
+	// queues are empty: response is the one loaded for request
+	SIM_CHECK(rfm73_send_request(req, sizeof(req), &resp) ==
+	          RFM73_TX_DELIVERED);
+	SIM_CHECK((resp.len == 4) && (resp.data[0] == 0x33));
+	SIM_CHECK(rfm73_rx_get(&pkt) == 1);
+	return SIM_RESULT();
+}
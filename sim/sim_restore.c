@@ -0,0 +1,74 @@
+/*
+ * sim_restore.c
+ *
+ * Host test of RAM shadow of the library: module is reset (power glitch)
+ * and its address register is changed behind the library, rfm73_verify must
+ * see it, rfm73_restore must bring back all registers including FEATURE and
+ * DYNPD, so dynamic payload length keeps working. rfm73_init must fail if
+ * module doesn't answer.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_restore \
+ *       RFM73.c sim/rfm73_sim.c sim/sim_restore.c
+ */
+
+#include "RFM73.h"
+#include "sim/rfm73_sim.h"
+#include "sim/sim_test.h"
+
+#include <string.h>
+
+#define R_FEATURE   0x1D
+#define R_DYNPD     0x1C
+#define R_RX_ADDR_P1 0x0B
+
+/* reads width of the top packet of receiver and drops it, 0 if none */
+static uint8_t rx_width(sim_radio_t* r) {
+	uint8_t wid, buf[32];
+	if (((sim_radio_spi(r, 0xFF, 0, 0, 0) >> 1) & 7) == 7) return 0;
+	sim_radio_spi(r, 0x60, 0, &wid, 1);
+	sim_radio_spi(r, 0x61, 0, buf, wid);
+	return wid;
+}
+
+int main(void) {
+	uint8_t buf[32], p1[5] = { 0x11, 0x22, 0x33, 0x44, 0x55 };
+	uint8_t bad[5] = { 0x66, 0x22, 0x33, 0x44, 0x55 };
+	sim_radio_t* tx = sim_radio_new();
+	sim_radio_t* rx = sim_radio_new();
+
+	sim_set_timer(rfm73_tick, 1000);
+	// no module: MISO line reads 0xFF
+	sim_select(0);
+	SIM_CHECK(rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	                     RFM73_DATA_RATE_2MBPS, 0x23) == 1);
+	sim_select(tx);
+	SIM_CHECK(rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	                     RFM73_DATA_RATE_2MBPS, 0x23) == 0);
+	rfm73_set_rx_addr_p1(p1);
+	SIM_CHECK(rfm73_verify() == 0);
+	SIM_CHECK(rfm73_restore() == 0);
+	SIM_CHECK(sim_radio_read_reg(tx, R_FEATURE) == 0x07);
+	sim_radio_copy(rx, tx);
+	sim_radio_ce(rx, 1);
+
+	// address register changed behind the library
+	sim_radio_spi(tx, 0x20 | R_RX_ADDR_P1, bad, 0, 5);
+	SIM_CHECK(rfm73_verify() == 1);
+	SIM_CHECK(rfm73_restore() == 1);
+	SIM_CHECK(rfm73_verify() == 0);
+
+	// power glitch: module comes back in power on state
+	sim_radio_reset(tx);
+	SIM_CHECK(rfm73_verify() != 0);
+	SIM_CHECK(rfm73_restore() != 0);
+	SIM_CHECK(rfm73_verify() == 0);
+	SIM_CHECK(sim_radio_read_reg(tx, R_FEATURE) == 0x07);
+	SIM_CHECK(sim_radio_read_reg(tx, R_DYNPD) == 0x3F);
+
+	// dynamic payload length works after restore
+	memset(buf, 0x5A, sizeof(buf));
+	SIM_CHECK(rfm73_send_packet(RFM73_TX_WITH_ACK, buf, 5) ==
+	          RFM73_TX_DELIVERED);
+	SIM_CHECK(rx_width(rx) == 5);
+	return SIM_RESULT();
+}
@@ -0,0 +1,145 @@
+/*
+ * sim_stats.c
+ *
+ * Host test of link counters: packets must be counted as sent when they are
+ * finished, not when they are queued, histogram of retransmits must have one
+ * sample per packet and match retransmits of the module, queued packets must
+ * be counted in it too (or as unknown when the next packet was already in
+ * the air), and a stall of RX queue must be counted once.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_stats \
+ *       RFM73.c sim/rfm73_sim.c sim/sim_stats.c
+ */
+
+#include "RFM73.h"
+#include "sim/rfm73_sim.h"
+#include "sim/sim_test.h"
+
+#define PACKETS     500
+#define R_CONFIG    0x00
+#define R_STATUS    0x07
+
+static sim_radio_t* peer;
+
+/* reads out RX FIFO of peer receiver */
+static void peer_drain() {
+	uint8_t w, buf[RFM73_MAX_PACKET_LEN];
+	while (((sim_radio_spi(peer, 0xFF, 0, 0, 0) >> 1) & 7) != 7) {
+		sim_radio_spi(peer, 0x60, 0, &w, 1);
+		sim_radio_spi(peer, 0x61, 0, buf, w);
+	}
+	sim_radio_write_reg(peer, R_STATUS, 0x70);
+}
+
+/* peer transmitter sends one packet, returns 1 if it is acknowledged */
+static uint8_t peer_send() {
+	uint8_t buf[8] = { 0 }, st;
+	sim_radio_spi(peer, 0xA0, buf, 0, sizeof(buf));
+	sim_radio_ce(peer, 1);
+	sim_delay_us(15);
+	sim_radio_ce(peer, 0);
+	do {
+		sim_delay_us(10);
+		st = sim_radio_read_reg(peer, R_STATUS);
+	} while (!(st & 0x30));
+	sim_radio_write_reg(peer, R_STATUS, 0x70);
+	if (st & 0x20) return 1;
+	sim_radio_spi(peer, 0xE1, 0, 0, 0);
+	return 0;
+}
+
+int main(void) {
+	uint8_t buf[17] = { 0 }, i;
+	uint16_t k;
+	uint32_t samples = 0, retries = 0, air0;
+	rfm73_stats_t ls;
+	rfm73_packet_t pkt;
+	sim_radio_t* me = sim_radio_new();
+	sim_stats_t* st = sim_radio_stats(me);
+
+	peer = sim_radio_new();
+	sim_select(me);
+	sim_set_timer(rfm73_tick, 1000);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 0x23);
+	rfm73_irq_enable(0, 0, 0);
+	rfm73_set_autort(250, 15);
+	sim_radio_copy(peer, me);
+	sim_radio_write_reg(peer, R_CONFIG,
+	                    sim_radio_read_reg(peer, R_CONFIG) | 0x03);
+	sim_radio_ce(peer, 1);
+
+	// blocking sends over lossy link: one sample per acknowledged packet
+	sim_air_loss(20);
+	for (k = 0; k < PACKETS; k++) {
+		SIM_CHECK(rfm73_send_packet(RFM73_TX_WITH_ACK, buf, sizeof(buf)) ==
+		          RFM73_TX_DELIVERED);
+		peer_drain();
+	}
+	sim_air_loss(0);
+	rfm73_stats(&ls, 1);
+	for (i = 0; i < 16; i++) {
+		samples += ls.tx_retries[i];
+		retries += (uint32_t)i * ls.tx_retries[i];
+	}
+	SIM_CHECK((ls.tx_sent == PACKETS) && (ls.tx_acked == PACKETS));
+	SIM_CHECK(samples == PACKETS);
+	SIM_CHECK(ls.tx_retries_unknown == 0);
+	SIM_CHECK(retries == st->tx_retries);
+
+	// queued packets over lossy link: each acknowledged packet is counted
+	// once, and no more retransmits than the module made
+	air0 = st->tx_retries;
+	sim_air_loss(20);
+	for (k = 0; k < PACKETS; ) {
+		if (rfm73_send_async(RFM73_TX_WITH_ACK, buf, sizeof(buf)) == 0) k++;
+		sim_delay_us(100);
+		peer_drain();
+	}
+	while (rfm73_send_status() == RFM73_TX_BUSY) {
+		sim_delay_us(100);
+		peer_drain();
+	}
+	sim_air_loss(0);
+	rfm73_stats(&ls, 1);
+	samples = retries = 0;
+	for (i = 0; i < 16; i++) {
+		samples += ls.tx_retries[i];
+		retries += (uint32_t)i * ls.tx_retries[i];
+	}
+	SIM_CHECK(ls.tx_acked == PACKETS);
+	SIM_CHECK((samples > 0) && (ls.tx_retries_unknown > 0));
+	SIM_CHECK(samples + ls.tx_retries_unknown == PACKETS);
+	SIM_CHECK(retries <= st->tx_retries - air0);
+
+	// queued packets are counted when they are finished, packets which
+	// reach maximum retransmits are sent and failed
+	sim_radio_ce(peer, 0);
+	for (i = 0; i < 3; i++)
+		SIM_CHECK(rfm73_send_async(RFM73_TX_WITH_ACK, buf, sizeof(buf)) == 0);
+	rfm73_stats(&ls, 0);
+	SIM_CHECK(ls.tx_sent == 0);
+	while (rfm73_send_status() == RFM73_TX_BUSY)
+		sim_delay_us(100);
+	rfm73_stats(&ls, 1);
+	SIM_CHECK((ls.tx_sent == 3) && (ls.tx_failed == 3));
+	SIM_CHECK(ls.tx_acked == 0);
+	sim_radio_ce(peer, 1);
+
+	// receiver: RX queue fills up while application doesn't read it, stall
+	// is counted once however many packets wait
+	rfm73_rx_mode();
+	sim_radio_write_reg(peer, R_CONFIG,
+	                    (sim_radio_read_reg(peer, R_CONFIG) | 0x02) & ~0x01);
+	sim_radio_ce(peer, 0);
+	for (i = 0; i < RFM73_RXQ_SIZE + 3; i++) SIM_CHECK(peer_send() == 1);
+	rfm73_stats(&ls, 0);
+	SIM_CHECK(ls.rx_stalled == 1);
+	SIM_CHECK(ls.rx_pipe[0] == RFM73_RXQ_SIZE);
+	for (i = 0; i < RFM73_RXQ_SIZE + 3; i++) SIM_CHECK(rfm73_rx_get(&pkt) == 0);
+	SIM_CHECK(rfm73_rx_get(&pkt) == 1);
+	rfm73_stats(&ls, 1);
+	SIM_CHECK(ls.rx_stalled == 1);
+	SIM_CHECK(ls.rx_pipe[0] == RFM73_RXQ_SIZE + 3);
+	return SIM_RESULT();
+}
@@ -0,0 +1,204 @@
+/*
+ * sim_stream.c
+ *
+ * Host test of sliding window stream: library is the transmitter, receiver
+ * is modeled on the peer module (it keeps STREAM_WINDOW packets and loads
+ * its state to acknowledge payload, as stream_poll of receiver does). Data
+ * must come in order without gaps over lossy link, transmitter must not send
+ * beyond window of receiver and must go on when window opens again. Goodput
+ * at 2 Mbps is printed for the stream and for blocking sends with
+ * acknowledge.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_stream \
+ *       RFM73.c stream.c sim/rfm73_sim.c sim/sim_stream.c
+ */
+
+#include "RFM73.h"
+#include "stream.h"
+#include "sim/rfm73_sim.h"
+#include "sim/sim_test.h"
+
+#define TOTAL       50000UL
+#define R_CONFIG    0x00
+#define R_STATUS    0x07
+
+static sim_radio_t* peer;
+
+/* receiver model: the next sequence number to read and the next expected
+   one, filled buffers, data read in order */
+static uint8_t rx_rd, rx_exp, rx_reading = 1;
+static uint16_t rx_held;
+static uint8_t rx_buf[STREAM_WINDOW][RFM73_MAX_PACKET_LEN];
+static uint8_t rx_len[STREAM_WINDOW];
+static uint32_t rx_bytes;
+static unsigned rx_bad, rx_beyond, rx_dup;
+
+/* byte n of the stream */
+static uint8_t data_byte(uint32_t n) {
+	return (uint8_t)(n * 13 + (n >> 8));
+}
+
+/* loads state of receiver to acknowledge payload of the peer */
+static void rx_status() {
+	uint8_t st[STREAM_STATUS_LEN], i, s;
+	uint16_t sack = 0;
+	for (i = 0; i < 16; i++) {
+		s = rx_exp + 1 + i;
+		if (((uint8_t)(s - rx_rd) < STREAM_WINDOW) &&
+		    (rx_held & (1 << (s & (STREAM_WINDOW - 1)))))
+			sack |= 1 << i;
+	}
+	st[0] = rx_exp;
+	st[1] = sack;
+	st[2] = sack >> 8;
+	st[3] = rx_rd + STREAM_WINDOW;
+	sim_radio_spi(peer, 0xE1, 0, 0, 0);
+	sim_radio_spi(peer, 0xA8, st, 0, STREAM_STATUS_LEN);
+}
+
+/* timer: library tick every ms, receiver model every 100 us */
+static void timer() {
+	static uint8_t div;
+	uint8_t w, pkt[RFM73_MAX_PACKET_LEN], s, b, i, dirty = 0;
+	if (++div == 10) {
+		div = 0;
+		rfm73_tick();
+	}
+	while (((sim_radio_spi(peer, 0xFF, 0, 0, 0) >> 1) & 7) != 7) {
+		sim_radio_spi(peer, 0x60, 0, &w, 1);
+		sim_radio_spi(peer, 0x61, 0, pkt, w);
+		sim_radio_write_reg(peer, R_STATUS, 0x40);
+		dirty = 1;
+		if (w <= STREAM_HEADER_LEN) continue;
+		s = pkt[0];
+		b = s & (STREAM_WINDOW - 1);
+		if ((uint8_t)(s - rx_rd) >= STREAM_WINDOW) {
+			// old duplicate or packet beyond window
+			if ((uint8_t)(rx_rd - s) > STREAM_WINDOW) rx_beyond++;
+			else rx_dup++;
+			continue;
+		}
+		if (rx_held & (1 << b)) {
+			rx_dup++;
+			continue;
+		}
+		rx_len[b] = w - STREAM_HEADER_LEN;
+		for (i = 0; i < rx_len[b]; i++)
+			rx_buf[b][i] = pkt[STREAM_HEADER_LEN + i];
+		rx_held |= 1 << b;
+		while (((uint8_t)(rx_exp - rx_rd) < STREAM_WINDOW) &&
+		       (rx_held & (1 << (rx_exp & (STREAM_WINDOW - 1)))))
+			rx_exp++;
+	}
+	// application of receiver reads data in order
+	while (rx_reading && (rx_rd != rx_exp)) {
+		b = rx_rd & (STREAM_WINDOW - 1);
+		for (i = 0; i < rx_len[b]; i++)
+			if (rx_buf[b][i] != data_byte(rx_bytes + i)) rx_bad++;
+		rx_bytes += rx_len[b];
+		rx_held &= ~(1 << b);
+		rx_rd++;
+		dirty = 1;
+	}
+	if (dirty) rx_status();
+}
+
+/* bytes written to the stream */
+static uint32_t written;
+
+/* fills window of transmitter and polls the stream for us microseconds */
+static void run_us(uint32_t us) {
+	uint8_t buf[STREAM_MAX_PAYLOAD], n, i;
+	uint64_t t0 = sim_now();
+	while (sim_now() - t0 < us) {
+		while (written < TOTAL) {
+			n = (TOTAL - written > STREAM_MAX_PAYLOAD) ? STREAM_MAX_PAYLOAD :
+			    TOTAL - written;
+			for (i = 0; i < n; i++) buf[i] = data_byte(written + i);
+			if (stream_write(buf, n)) break;
+			written += n;
+		}
+		stream_poll();
+		sim_delay_us(10);
+	}
+}
+
+/* runs stream until receiver has limit bytes (5 s at most), returns goodput,
+   bytes per second */
+static uint32_t transfer(uint32_t limit) {
+	uint32_t b0 = rx_bytes;
+	uint64_t t0 = sim_now();
+	while ((rx_bytes < limit) && (sim_now() - t0 < 5000000ULL)) run_us(10);
+	return (uint64_t)(rx_bytes - b0) * 1000000 / (sim_now() - t0);
+}
+
+int main(void) {
+	uint8_t buf[RFM73_MAX_PACKET_LEN];
+	uint32_t rate, blocking;
+	uint16_t i, ok = 0;
+	uint64_t t0;
+	sim_radio_t* me = sim_radio_new();
+
+	peer = sim_radio_new();
+	sim_select(me);
+	sim_set_timer(timer, 100);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 10);
+	rfm73_set_autort(250, 3);
+	sim_radio_copy(peer, me);
+	sim_radio_write_reg(peer, R_CONFIG,
+	                    sim_radio_read_reg(peer, R_CONFIG) | 0x03);
+	sim_radio_ce(peer, 1);
+
+	// blocking sends with acknowledge for comparison, peer has no payload
+	t0 = sim_now();
+	for (i = 0; i < 500; i++) {
+		buf[0] = i;
+		if (rfm73_send_packet(RFM73_TX_WITH_ACK, buf, RFM73_MAX_PACKET_LEN)
+		    == RFM73_TX_DELIVERED)
+			ok++;
+	}
+	blocking = (uint64_t)ok * RFM73_MAX_PACKET_LEN * 1000000 / (sim_now() - t0);
+	// packets of blocking sends are drained before receiver model starts
+	timer();
+	rx_rd = 0;
+	rx_exp = 0;
+	rx_held = 0;
+	rx_bytes = 0;
+	rx_dup = 0;
+	rx_bad = 0;
+	rx_beyond = 0;
+
+	// stream without loss: the first 20000 bytes
+	stream_init(STREAM_TX);
+	rx_status();
+	rate = transfer(20000);
+	SIM_CHECK(rx_bytes >= 20000);
+	SIM_CHECK(stream_stats()->retries == 0);
+	printf("2 Mbps goodput: stream %lu B/s, blocking send with ack %lu B/s\n",
+	       (unsigned long)rate, (unsigned long)blocking);
+	SIM_CHECK(rate > blocking);
+
+	// receiver stops reading: transmitter stays within its window, then goes
+	// on with probes when window opens
+	rx_reading = 0;
+	run_us(50000);
+	SIM_CHECK((uint8_t)(rx_exp - rx_rd) == STREAM_WINDOW);
+	rx_reading = 1;
+
+	// 10% loss: lost packets are sent again, data stays in order
+	sim_air_loss(10);
+	rate = transfer(TOTAL);
+	sim_air_loss(0);
+	for (i = 0; (i < 1000) && !stream_flushed(); i++) run_us(100);
+	printf("10%% loss goodput: %lu B/s, %lu packets, %u sent again\n",
+	       (unsigned long)rate, (unsigned long)stream_stats()->packets,
+	       stream_stats()->retries);
+	SIM_CHECK(rx_bytes == TOTAL);
+	SIM_CHECK(stream_flushed());
+	SIM_CHECK(stream_stats()->bytes == TOTAL);
+	SIM_CHECK(stream_stats()->retries > 0);
+	SIM_CHECK(rx_bad == 0);
+	SIM_CHECK(rx_beyond == 0);
+	return SIM_RESULT();
+}
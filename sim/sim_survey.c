@@ -0,0 +1,62 @@
+/*
+ * sim_survey.c
+ *
+ * Host test of rfm73_survey: noise on some channels must be seen in
+ * histogram, survey must be refused while TX queue is not empty, and
+ * channel, CONFIG, CE and driver state must be restored after it.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_survey \
+ *       RFM73.c sim/rfm73_sim.c sim/sim_survey.c
+ */
+
+#include "RFM73.h"
+#include "sim/rfm73_sim.h"
+#include "sim/sim_test.h"
+
+#define SAMPLES     50
+#define R_CONFIG    0x00
+
+int main(void) {
+	uint8_t hist[RFM73_SURVEY_CHANNELS], buf[4] = { 1, 2, 3, 4 }, i, cfg;
+	sim_radio_t* r = sim_radio_new();
+
+	sim_select(r);
+	sim_set_timer(rfm73_tick, 1000);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 0x23);
+	sim_air_noise(10, 1);
+	sim_air_noise(77, 1);
+
+	// receiver: noise is seen only where it is
+	cfg = sim_radio_read_reg(r, R_CONFIG);
+	SIM_CHECK(rfm73_survey(hist, SAMPLES) == 0);
+	for (i = 0; i < RFM73_SURVEY_CHANNELS; i++)
+		SIM_CHECK(hist[i] == (((i == 10) || (i == 77)) ? SAMPLES : 0));
+	SIM_CHECK(rfm73_get_channel() == 0x23);
+	SIM_CHECK(sim_radio_read_reg(r, R_CONFIG) == cfg);
+	SIM_CHECK(sim_ce_get() == 1);
+	SIM_CHECK(rfm73_verify() == 0);
+	sim_delay_us(2000);
+	SIM_CHECK(rfm73_poll() == RFM73_STATE_RX);
+
+	// transmitter with packet in TX queue (nobody answers): refused
+	rfm73_set_autort(4000, 15);
+	SIM_CHECK(rfm73_send_async(RFM73_TX_WITH_ACK, buf, sizeof(buf)) == 0);
+	cfg = sim_radio_read_reg(r, R_CONFIG);
+	hist[0] = 0xEE;
+	SIM_CHECK(rfm73_survey(hist, SAMPLES) == 1);
+	SIM_CHECK(hist[0] == 0xEE);
+	SIM_CHECK(sim_radio_read_reg(r, R_CONFIG) == cfg);
+	while (rfm73_send_status() == RFM73_TX_BUSY)
+		sim_delay_us(100);
+	SIM_CHECK(rfm73_send_status() == RFM73_TX_MAX_RT);
+
+	// TX queue is empty: survey is done, TX mode is restored
+	SIM_CHECK(rfm73_survey(hist, SAMPLES) == 0);
+	SIM_CHECK(hist[10] == SAMPLES);
+	SIM_CHECK(sim_radio_read_reg(r, R_CONFIG) == cfg);
+	SIM_CHECK(rfm73_verify() == 0);
+	sim_delay_us(2000);
+	SIM_CHECK(rfm73_poll() == RFM73_STATE_TX);
+	return SIM_RESULT();
+}
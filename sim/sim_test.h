@@ -0,0 +1,30 @@
+/*
+ * sim_test.h
+ *
+ * Checks of host tests in sim/: failed check is printed with its line, test
+ * program returns SIM_RESULT from main, so its exit code is 0 only if all
+ * checks passed.
+ */
+
+
+#ifndef SIM_TEST_H_
+#define SIM_TEST_H_
+
+#include <stdio.h>
+
+/* number of failed checks */
+static unsigned sim_failed = 0;
+
+/*! \brief Checks condition, prints it if it is false.*/
+#define SIM_CHECK(cond) do { \
+		if (!(cond)) { \
+			sim_failed++; \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		} \
+	} while (0)
+
+/*! \brief Prints result of the test and returns exit code of it.*/
+#define SIM_RESULT()    (printf("%s\n", sim_failed ? "FAIL" : "PASS"), \
+                         sim_failed ? 1 : 0)
+
+#endif /* SIM_TEST_H_ */
@@ -0,0 +1,140 @@
+/*
+ * sim_txq.c
+ *
+ * Host test of software TX queue with IRQ interrupt serviced late, so
+ * several TX_DS events of the module are merged into one: every queued
+ * packet must be finished once, with result of its own, in order of
+ * queueing. First part sends packets to receiver which reads them at once,
+ * second part lets RX FIFO of receiver fill up, so packets after the third
+ * one get MAX_RT. Blocking send must fail when no packet slot is free,
+ * not return result of the previous packet.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_txq \
+ *       RFM73.c sim/rfm73_sim.c sim/sim_txq.c
+ */
+
+#include "RFM73.h"
+#include "sim/rfm73_sim.h"
+#include "sim/sim_test.h"
+
+#include <string.h>
+
+#define PACKETS     200
+
+/* IRQ latencies, us: packet with acknowledge takes about 400 us, so one,
+   two or more events are merged */
+static const uint16_t delays[] = { 0, 300, 500, 700, 1000, 3000 };
+
+static uint8_t results[PACKETS];
+static uint16_t done;
+
+static void on_done(uint8_t result) {
+	if (done < PACKETS) results[done] = result;
+	done++;
+}
+
+/* reads all packets from RX FIFO of receiver to seen[] by first byte,
+   returns their number */
+static uint16_t drain(sim_radio_t* r, uint8_t* seen) {
+	uint8_t n = 0, wid, buf[32];
+	while (((sim_radio_spi(r, 0xFF, 0, 0, 0) >> 1) & 7) != 7) {
+		sim_radio_spi(r, 0x60, 0, &wid, 1);
+		sim_radio_spi(r, 0x61, 0, buf, wid);
+		seen[buf[0]]++;
+		n++;
+	}
+	sim_radio_write_reg(r, 0x07, 0x40);
+	return n;
+}
+
+/* queues packets first..first+n-1, waits until all are finished, receiver
+   is drained every 100 us if seen is not NULL */
+static void send_all(sim_radio_t* rx, uint8_t first, uint8_t n,
+                     uint8_t* seen) {
+	uint8_t i = 0, buf[32];
+	memset(buf, 0, sizeof(buf));
+	while ((i < n) || rfm73_send_queued()) {
+		if (i < n) {
+			buf[0] = first + i;
+			if (rfm73_send_async(RFM73_TX_WITH_ACK, buf, 16) == 0) i++;
+		}
+		rfm73_send_status();
+		sim_delay_us(100);
+		if (seen) drain(rx, seen);
+	}
+}
+
+/* runs both parts of the test with IRQ latency of delay us */
+static void run(sim_radio_t* tx, sim_radio_t* rx, uint16_t delay) {
+	uint16_t i;
+	uint8_t seen[256];
+	rfm73_stats_t ls;
+	sim_stats_t* st = sim_radio_stats(tx);
+	uint32_t tx_ds = st->tx_ds;
+
+	printf("IRQ delay %u us\n", delay);
+	sim_set_irq_delay(delay);
+	rfm73_stats(&ls, 1);
+
+	// all packets are delivered, each is reported once
+	memset(seen, 0, sizeof(seen));
+	done = 0;
+	send_all(rx, 0, PACKETS, seen);
+	SIM_CHECK(done == PACKETS);
+	SIM_CHECK(st->tx_ds - tx_ds == PACKETS);
+	for (i = 0; i < PACKETS; i++) {
+		SIM_CHECK(results[i] == RFM73_TX_DELIVERED);
+		SIM_CHECK(seen[i] == 1);
+	}
+	rfm73_stats(&ls, 1);
+	SIM_CHECK(ls.tx_acked == PACKETS);
+	SIM_CHECK(ls.tx_failed == 0);
+
+	// receiver is not read: 3 packets fill its RX FIFO, the rest fail
+	memset(seen, 0, sizeof(seen));
+	done = 0;
+	send_all(rx, 0, 6, 0);
+	drain(rx, seen);
+	SIM_CHECK(done == 6);
+	for (i = 0; i < 6; i++) {
+		SIM_CHECK(results[i] == ((i < 3) ? RFM73_TX_DELIVERED :
+		                                   RFM73_TX_MAX_RT));
+		SIM_CHECK(seen[i] == (i < 3));
+	}
+	rfm73_stats(&ls, 1);
+	SIM_CHECK(ls.tx_acked == 3);
+	SIM_CHECK(ls.tx_failed == 3);
+}
+
+int main(void) {
+	uint8_t d, n = 0, buf[4] = { 0 }, seen[PACKETS];
+	rfm73_packet_t* slots[RFM73_SLOTS];
+	sim_radio_t* tx = sim_radio_new();
+	sim_radio_t* rx = sim_radio_new();
+
+	sim_select(tx);
+	sim_set_timer(rfm73_tick, 1000);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 0x23);
+	rfm73_set_autort(250, 3);
+	rfm73_irq_enable(0, 0, 0);
+	rfm73_send_callback(on_done);
+	sim_radio_copy(rx, tx);
+	sim_radio_ce(rx, 1);
+	for (d = 0; d < sizeof(delays)/sizeof(delays[0]); d++)
+		run(tx, rx, delays[d]);
+
+	// all slots are held by application
+	drain(rx, seen);
+	SIM_CHECK(rfm73_send_packet(RFM73_TX_WITH_ACK, buf, sizeof(buf)) ==
+	          RFM73_TX_DELIVERED);
+	drain(rx, seen);
+	while ((n < RFM73_SLOTS) && (slots[n] = rfm73_slot_alloc())) n++;
+	SIM_CHECK(n == RFM73_SLOTS);
+	SIM_CHECK(rfm73_send_packet(RFM73_TX_WITH_ACK, buf, sizeof(buf)) ==
+	          RFM73_TX_NO_SLOT);
+	rfm73_slot_free(slots[--n]);
+	SIM_CHECK(rfm73_send_packet(RFM73_TX_WITH_ACK, buf, sizeof(buf)) ==
+	          RFM73_TX_DELIVERED);
+	return SIM_RESULT();
+}
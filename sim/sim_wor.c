@@ -0,0 +1,128 @@
+/*
+ * sim_wor.c
+ *
+ * Host test of duty-cycled receiver: packet sent while receiver sleeps must
+ * be missed, repeated packet must wake it within a period, receiver must
+ * return to sleep after hold time, wor_send must give up after a period.
+ *
+ *   gcc -std=gnu99 -Wall -DRFM73_HOST -I. -o sim_wor \
+ *       RFM73.c wor.c sim/rfm73_sim.c sim/sim_wor.c
+ */
+
+#include "RFM73.h"
+#include "wor.h"
+#include "sim/rfm73_sim.h"
+#include "sim/sim_test.h"
+
+#define PERIOD_MS   500
+#define WINDOW_MS   4
+#define R_CONFIG    0x00
+#define R_SETUP_RETR 0x04
+#define R_STATUS    0x07
+
+static sim_radio_t* peer;
+/* packets taken from RX queue */
+static unsigned got;
+
+static void tick() {
+	rfm73_tick();
+	wor_tick();
+}
+
+/* runs main loop of receiver for ms milliseconds */
+static void run_ms(unsigned ms) {
+	uint8_t buf[RFM73_MAX_PACKET_LEN], len;
+	while (ms--) {
+		wor_poll();
+		while (rfm73_receive_packet(RFM73_RX_WITH_NOACK, buf, &len) == 0)
+			got++;
+		sim_delay_us(1000);
+	}
+}
+
+/* one attempt of peer: packet with 3 retransmits 250 us apart, returns 1 if
+   it is acknowledged */
+static uint8_t peer_try() {
+	uint8_t data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 }, st;
+	sim_radio_spi(peer, 0xA0, data, 0, sizeof(data));
+	sim_radio_ce(peer, 1);
+	sim_delay_us(15);
+	sim_radio_ce(peer, 0);
+	do {
+		sim_delay_us(50);
+		st = sim_radio_read_reg(peer, R_STATUS);
+	} while (!(st & 0x30));
+	sim_radio_write_reg(peer, R_STATUS, 0x70);
+	if (st & 0x20) return 1;
+	sim_radio_spi(peer, 0xE1, 0, 0, 0);
+	return 0;
+}
+
+int main(void) {
+	uint8_t data[4] = { 1, 2, 3, 4 };
+	unsigned k;
+	uint64_t t;
+	const wor_stats_t* s;
+	sim_radio_t* me = sim_radio_new();
+
+	peer = sim_radio_new();
+	sim_select(me);
+	sim_set_timer(tick, 1000);
+	rfm73_init(RFM73_OUT_PWR_PLUS5DBM, RFM73_LNA_GAIN_HIGH,
+	           RFM73_DATA_RATE_2MBPS, 0x23);
+	rfm73_irq_enable(0, 0, 0);
+	sim_radio_copy(peer, me);
+	sim_radio_write_reg(peer, R_CONFIG,
+	                    (sim_radio_read_reg(peer, R_CONFIG) | 0x02) & ~0x01);
+	sim_radio_write_reg(peer, R_SETUP_RETR, 0x03);
+
+	// idle: a window every period, current as estimated
+	wor_start(PERIOD_MS, WINDOW_MS);
+	run_ms(4 * PERIOD_MS + PERIOD_MS / 2);
+	s = wor_stats();
+	SIM_CHECK(s->windows == 5);
+	SIM_CHECK(s->wakeups == 0);
+	SIM_CHECK(wor_poll() == WOR_SLEEP);
+	SIM_CHECK((wor_current_ua() > wor_estimate_ua(PERIOD_MS, WINDOW_MS) / 2) &&
+	          (wor_current_ua() < wor_estimate_ua(PERIOD_MS, WINDOW_MS) * 2));
+	printf("idle: %u uA, estimated %u uA\n", wor_current_ua(),
+	       wor_estimate_ua(PERIOD_MS, WINDOW_MS));
+
+	// miss: single attempt between windows is not received
+	SIM_CHECK(peer_try() == 0);
+	run_ms(PERIOD_MS);
+	SIM_CHECK(got == 0);
+	SIM_CHECK(s->wakeups == 0);
+
+	// wake: repeated attempts hit the next window
+	t = sim_now();
+	for (k = 0; k < 2 * PERIOD_MS; k++) {
+		if (peer_try()) break;
+		run_ms(1);
+	}
+	SIM_CHECK(sim_now() - t <= (PERIOD_MS + WINDOW_MS + 2 * WOR_SETTLE_MS) *
+	          1000UL);
+	printf("wake: %u attempts, %lu ms\n", k,
+	       (unsigned long)((sim_now() - t) / 1000));
+	run_ms(1);
+	SIM_CHECK(got == 1);
+	SIM_CHECK(s->wakeups == 1);
+	SIM_CHECK(wor_poll() == WOR_AWAKE);
+
+	// awake: the next packet is received at once, then hold time runs out
+	SIM_CHECK(peer_try() == 1);
+	run_ms(WOR_HOLD_MS - 10);
+	SIM_CHECK(got == 2);
+	SIM_CHECK(wor_poll() == WOR_AWAKE);
+	run_ms(20);
+	SIM_CHECK(wor_poll() == WOR_SLEEP);
+
+	// transmitter without receiver gives up after a whole period
+	wor_stop();
+	sim_radio_write_reg(me, R_CONFIG, sim_radio_read_reg(me, R_CONFIG) & ~0x01);
+	rfm73_tx_mode();
+	t = sim_now();
+	SIM_CHECK(wor_send(data, sizeof(data), PERIOD_MS, WINDOW_MS) == 1);
+	SIM_CHECK(sim_now() - t >= (PERIOD_MS + WINDOW_MS) * 1000UL);
+	return SIM_RESULT();
+}
@@ -9,16 +9,56 @@
 #define  SPI_C
 
 #include "spi.h"
+#include "rfm73_hal.h"
 #include <avr/io.h>
+#include <avr/interrupt.h>
+
+/* descriptor of transfer being processed by SPI_STC interrupt */
+static spi_xfer_t* volatile spi_cur = 0;
+/* number of data bytes of current transfer already put to SPDR */
+static volatile uint8_t spi_pos;
+
+#ifdef RFM73_BENCH
+/* number of bytes exchanged, counted for benchmark only */
+volatile uint32_t spi_bytes = 0;
+#define SPI_COUNT(n)          spi_bytes += (n)
+#else
+#define SPI_COUNT(n)
+#endif
+
+#if (SPI_BACKEND == SPI_BACKEND_SPI)
 
 void spi_init() {
 	/* Set MOSI and SCK output, all others input */
 	DDRB |= (1<<DD_MOSI)|(1<<DD_SCK);
-	/* Enable SPI, Master, set clock rate fck/16 */
-	SPCR = (1<<SPE)|(1<<MSTR)|(1<<SPR0);
+	/* Enable SPI, Master, set clock rate fck/SPI_CLOCK_DIV */
+	SPCR = (1<<SPE)|(1<<MSTR)|SPI_SPCR_SPR;
+	SPSR = SPI_SPSR_2X;
 	SPI_DORD_MSB_TO_LSB;
 }
 
+/* waits for the end of byte transfer */
+#define SPI_WAIT_BYTE         while(!(SPSR & (1<<SPIF)))
+
+#else
+
+void spi_init() {
+	/* baud rate must be zero while transmitter is enabled */
+	UBRR1 = 0;
+	/* Set XCK and TXD output */
+	SPI_USART_DDR |= (1<<DD_XCK)|(1<<DD_TXD);
+	/* Master SPI mode, mode 0, MSB first */
+	UCSR1C = (1<<UMSEL11)|(1<<UMSEL10);
+	UCSR1B = (1<<RXEN1)|(1<<TXEN1);
+	/* set clock rate fck/SPI_CLOCK_DIV */
+	UBRR1 = SPI_CLOCK_DIV/2 - 1;
+}
+
+/* waits for the end of byte transfer */
+#define SPI_WAIT_BYTE         while(!(UCSR1A & (1<<RXC1)))
+
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 //                  SPI access                                               //
 ///////////////////////////////////////////////////////////////////////////////
@@ -32,12 +72,126 @@ Description:
 uint8_t spi_read(uint8_t value)                                    
 {
 	uint8_t res;                            
+	SPI_COUNT(1);
 	/* Start transmission */
-	SPDR = value;
+	SPI_DR = value;
 	/* Wait for transmission complete */
-	while(!(SPSR & (1<<SPIF))) ;
-	res = SPDR;
+	SPI_WAIT_BYTE;
+	res = SPI_DR;
 	return res;
 }                                                           
+
+/**************************************************         
+Function: spi_transfer();                                         
+                                                            
+Description:                                                
+	Sends len bytes from tx (zeros if tx is NULL) and stores received
+	bytes to rx (if it is not NULL). Next byte is prepared while current
+	one is shifted, and written as soon as data register is free: SPI
+	module receive buffer keeps previous byte while next one is shifted,
+	USART transmit buffer takes next byte before current one is finished.
+	CSN line is not touched.
+**************************************************/        
+void spi_transfer(const uint8_t* tx, uint8_t* rx, uint8_t len)
+{
+	uint8_t i, out;
+	if (len == 0) return;
+	SPI_COUNT(len);
+	SPI_DR = tx ? tx[0] : 0;
+	for (i = 1; i < len; i++) {
+		out = tx ? tx[i] : 0;
+#if (SPI_BACKEND == SPI_BACKEND_SPI)
+		SPI_WAIT_BYTE;
+		SPI_DR = out;
+		/* previous byte is still in receive buffer */
+		out = SPI_DR;
+#else
+		while(!(UCSR1A & (1<<UDRE1))) ;
+		SPI_DR = out;
+		SPI_WAIT_BYTE;
+		out = SPI_DR;
+#endif
+		if (rx) rx[i-1] = out;
+	}
+	SPI_WAIT_BYTE;
+	out = SPI_DR;
+	if (rx) rx[len-1] = out;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                  Interrupt-driven SPI engine                              //
+///////////////////////////////////////////////////////////////////////////////
+
+/**************************************************         
+Function: spi_xfer_start();                                         
+                                                            
+Description:                                                
+	Pulls CSN low and sends command byte of the transfer. The rest of
+	bytes are moved by SPI_STC interrupt, so function returns at once.
+	Returns 1 (and does nothing) if previous transfer is not finished.
+**************************************************/        
+uint8_t spi_xfer_start(spi_xfer_t* xfer)
+{
+	if (spi_cur) return 1;
+	spi_cur = xfer;
+	spi_pos = 0;
+	RFM73_CSN_LOW;
+	SPI_INT_ON;
+	SPI_DR = xfer->cmd;
+	return 0;
+}
+
+/**************************************************         
+Function: spi_busy();                                         
+                                                            
+Description:                                                
+	Returns 1 while interrupt-driven transfer is in progress.
+**************************************************/        
+uint8_t spi_busy()
+{
+	return (spi_cur != 0);
+}
+
+/**************************************************         
+Function: spi_wait();                                         
+                                                            
+Description:                                                
+	Waits for the end of interrupt-driven transfer. Must not be called
+	with interrupts disabled while transfer is in progress.
+**************************************************/        
+void spi_wait()
+{
+	while (spi_cur) ;
+}
+
+/**************************************************         
+Function: ISR(SPI_vect)
+                                                            
+Description:                                                
+	Stores received byte and sends next one. After the last byte CSN is
+	set high, interrupt is disabled and completion callback is called.
+**************************************************/        
+ISR(SPI_vect)
+{
+	spi_xfer_t* x = spi_cur;
+	uint8_t res = SPI_DR;
+
+	SPI_COUNT(1);
+	if (spi_pos == 0)
+		x->status = res;
+	else if (x->rx)
+		x->rx[spi_pos-1] = res;
+
+	if (spi_pos < x->len) {
+		SPI_DR = x->tx ? x->tx[spi_pos] : 0;
+		spi_pos++;
+	}
+	else {
+		RFM73_CSN_HIGH;
+		SPI_INT_OFF;
+		spi_cur = 0;
+		if (x->done) x->done(x);
+	}
+}
                                                               
 #endif
\ No newline at end of file
@@ -11,13 +11,143 @@
 
 #include <inttypes.h>
 
+/* on host SPI functions are provided by simulator (sim/rfm73_sim.c) */
+#ifndef RFM73_HOST
+
+#include <avr/io.h>
+
+/*! \brief SPI module backend: SPI module of MCU (pins MOSI, MISO, SCK).*/
+#define SPI_BACKEND_SPI       0
+/*! \brief USART backend: USART1 in master SPI mode (pins TXD1, RXD1, XCK1).
+Its transmitter is double buffered, so block transfers have no gaps between
+bytes. Only MCUs with MSPIM support (e.g. ATmega1281) could use it.*/
+#define SPI_BACKEND_USART     1
+
+/*! \brief Backend used by spi_read, spi_transfer and interrupt-driven engine.*/
+#ifndef SPI_BACKEND
+	#define SPI_BACKEND       SPI_BACKEND_SPI
+#endif
+
+/*! \brief SCK frequency divider: SCK = F_CPU/SPI_CLOCK_DIV. For SPI module
+it is 2, 4, 8, 16, 32, 64 or 128, for USART it is any even value from 2 to
+512. RFM73 accepts SCK up to 8 MHz.*/
+#ifndef SPI_CLOCK_DIV
+	#define SPI_CLOCK_DIV     2
+#endif
+
+#if (SPI_BACKEND == SPI_BACKEND_SPI)
+
 #define DD_MOSI           PB2
 #define DD_SCK            PB1
 
 #define SPI_DORD_LSB_TO_MSB   SPCR |= (1 << DORD)
 #define SPI_DORD_MSB_TO_LSB   SPCR &=~(1 << DORD)
 
+/* data register, byte complete interrupt and its control */
+#define SPI_DR                SPDR
+#define SPI_vect              SPI_STC_vect
+#define SPI_INT_ON            SPCR |= (1 << SPIE)
+#define SPI_INT_OFF           SPCR &=~(1 << SPIE)
+
+#if   (SPI_CLOCK_DIV == 2)
+	#define SPI_SPCR_SPR      0
+	#define SPI_SPSR_2X       (1 << SPI2X)
+#elif (SPI_CLOCK_DIV == 4)
+	#define SPI_SPCR_SPR      0
+	#define SPI_SPSR_2X       0
+#elif (SPI_CLOCK_DIV == 8)
+	#define SPI_SPCR_SPR      (1 << SPR0)
+	#define SPI_SPSR_2X       (1 << SPI2X)
+#elif (SPI_CLOCK_DIV == 16)
+	#define SPI_SPCR_SPR      (1 << SPR0)
+	#define SPI_SPSR_2X       0
+#elif (SPI_CLOCK_DIV == 32)
+	#define SPI_SPCR_SPR      (1 << SPR1)
+	#define SPI_SPSR_2X       (1 << SPI2X)
+#elif (SPI_CLOCK_DIV == 64)
+	#define SPI_SPCR_SPR      (1 << SPR1)
+	#define SPI_SPSR_2X       0
+#elif (SPI_CLOCK_DIV == 128)
+	#define SPI_SPCR_SPR      ((1 << SPR1) | (1 << SPR0))
+	#define SPI_SPSR_2X       0
+#else
+	#error "SPI_CLOCK_DIV is not supported by SPI module"
+#endif
+
+#elif (SPI_BACKEND == SPI_BACKEND_USART)
+
+#ifndef UMSEL11
+	#error "USART of this MCU has no master SPI mode, use SPI_BACKEND_SPI"
+#endif
+
+/* XCK1 and TXD1 pins */
+#ifndef SPI_USART_DDR
+	#define SPI_USART_DDR     DDRD
+	#define DD_XCK            PD5
+	#define DD_TXD            PD3
+#endif
+
+#if (SPI_CLOCK_DIV < 2) || (SPI_CLOCK_DIV > 512) || (SPI_CLOCK_DIV & 1)
+	#error "SPI_CLOCK_DIV is not supported by USART"
+#endif
+
+/* data register, byte complete interrupt and its control */
+#define SPI_DR                UDR1
+#define SPI_vect              USART1_RX_vect
+#define SPI_INT_ON            UCSR1B |= (1 << RXCIE1)
+#define SPI_INT_OFF           UCSR1B &=~(1 << RXCIE1)
+
+#define SPI_DORD_LSB_TO_MSB   UCSR1C |= (1 << UDORD1)
+#define SPI_DORD_MSB_TO_LSB   UCSR1C &=~(1 << UDORD1)
+
+#else
+	#error "Unknown SPI_BACKEND"
+#endif
+
+#endif /* RFM73_HOST */
+
+struct spi_xfer;
+
+/*! \brief Function called from SPI_STC interrupt when transfer is finished.
+CSN line is already high and engine is idle, so new transfer could be
+started right from this function.*/
+typedef void (*spi_callback_t)(struct spi_xfer* xfer);
+
+/*! \brief Transfer descriptor of interrupt-driven SPI engine.
+
+One transaction is: CSN low, command byte, len data bytes, CSN high. Byte
+that was shifted in while command byte was sent (STATUS register of RFM73) is
+stored in status field. Descriptor must stay valid until callback is called.*/
+typedef struct spi_xfer {
+	/*! \brief Command byte, sent first.*/
+	uint8_t cmd;
+	/*! \brief Data bytes to send after command, NULL to send zeros.*/
+	const uint8_t* tx;
+	/*! \brief Buffer for received data bytes, NULL to discard them.*/
+	uint8_t* rx;
+	/*! \brief Number of data bytes after command byte.*/
+	uint8_t len;
+	/*! \brief Byte received while command byte was sent.*/
+	uint8_t status;
+	/*! \brief Completion callback (may be NULL).*/
+	spi_callback_t done;
+} spi_xfer_t;
+
 extern void spi_init();
 extern uint8_t spi_read(uint8_t value);
+/* exchanges block of bytes without gaps between them */
+extern void spi_transfer(const uint8_t* tx, uint8_t* rx, uint8_t len);
+
+#ifdef RFM73_BENCH
+/* number of bytes exchanged, counted for benchmark only */
+extern volatile uint32_t spi_bytes;
+#endif
+
+/* starts interrupt-driven transfer, returns 1 if engine is busy */
+extern uint8_t spi_xfer_start(spi_xfer_t* xfer);
+/* returns 1 while interrupt-driven transfer is in progress */
+extern uint8_t spi_busy();
+/* waits until interrupt-driven transfer is finished */
+extern void spi_wait();
 
-#endif /* SPI_H_ */
\ No newline at end of file
+#endif /* SPI_H_ */
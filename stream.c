@@ -0,0 +1,311 @@
+/*
+ * stream.c
+ *
+ * Sliding window reliable stream over RFM73 library (see stream.h).
+ */
+
+#include "stream.h"
+
+/*! \brief State of sent packet: no acknowledge yet.*/
+#define STREAM_SENT                0
+/*! \brief State of sent packet: it must be sent again.*/
+#define STREAM_LOST                1
+/*! \brief State of sent packet: receiver has it.*/
+#define STREAM_RCVD                2
+
+/* role of the node */
+static uint8_t stream_role;
+/* packet buffers: packet with sequence number s is kept in buffer
+   s % STREAM_WINDOW (whole packet for transmitter, data for receiver) */
+static uint8_t stream_buf[STREAM_WINDOW][RFM73_MAX_PACKET_LEN];
+static uint8_t stream_len[STREAM_WINDOW];
+/* statistics and time of the last stream_poll */
+static stream_stats_t stream_stat;
+static uint16_t stream_last_ms;
+
+/* transmitter: state of sent packets and their order of sending */
+static uint8_t stream_st[STREAM_WINDOW];
+static uint8_t stream_stamp[STREAM_WINDOW];
+static uint8_t stream_clock;
+/* transmitter: the oldest unacknowledged, the next unsent and the next
+   written sequence numbers */
+static uint8_t stream_una, stream_snd, stream_nxt;
+/* transmitter: end of window of receiver */
+static uint8_t stream_limit;
+/* transmitter: packets sent since the last one with acknowledge */
+static uint8_t stream_since_ack;
+/* transmitter: time of the last progress */
+static uint16_t stream_rto_ms;
+
+/* receiver: the next sequence number to read and the next expected one */
+static uint8_t stream_rd, stream_exp;
+/* receiver: bit n is set if buffer n is filled */
+static uint16_t stream_held;
+/* receiver: state must be loaded to acknowledge payload */
+static uint8_t stream_dirty;
+/* receiver: pipe of transmitter */
+static uint8_t stream_pipe;
+
+/* returns buffer of sequence number */
+static uint8_t stream_slot(uint8_t seq) {
+	return seq & (STREAM_WINDOW - 1);
+}
+
+/* returns 1 if sequence number is in window of transmitter */
+static uint8_t stream_in_flight(uint8_t seq) {
+	return (uint8_t)(seq - stream_una) < (uint8_t)(stream_snd - stream_una);
+}
+
+/* applies state of receiver got in acknowledge payload: frees acknowledged
+   buffers, marks packets sent before received ones as lost */
+static void stream_status(const uint8_t* st) {
+	uint8_t i, s, b, newest = 0, got = 0;
+	uint16_t sack = st[1] | ((uint16_t)st[2] << 8);
+	// state loaded before packets of this window were sent is skipped
+	if ((uint8_t)(st[0] - stream_una) > (uint8_t)(stream_snd - stream_una))
+		return;
+	stream_stat.acks++;
+	if ((int8_t)(st[3] - stream_limit) > 0) stream_limit = st[3];
+	while (stream_una != st[0]) {
+		b = stream_slot(stream_una++);
+		if (!got || ((int8_t)(stream_stamp[b] - newest) > 0))
+			newest = stream_stamp[b];
+		got = 1;
+		stream_stat.bytes += stream_len[b] - STREAM_HEADER_LEN;
+	}
+	for (i = 0; i < 16; i++) {
+		s = st[0] + 1 + i;
+		if (!(sack & (1 << i)) || !stream_in_flight(s)) continue;
+		b = stream_slot(s);
+		if (stream_st[b] == STREAM_RCVD) continue;
+		stream_st[b] = STREAM_RCVD;
+		if (!got || ((int8_t)(stream_stamp[b] - newest) > 0))
+			newest = stream_stamp[b];
+		got = 1;
+	}
+	if (!got) return;
+	stream_rto_ms = rfm73_millis();
+	// packet sent before a received one is lost
+	for (s = stream_una; s != stream_snd; s++) {
+		b = stream_slot(s);
+		if ((stream_st[b] == STREAM_SENT) &&
+		    ((int8_t)(stream_stamp[b] - newest) < 0))
+			stream_st[b] = STREAM_LOST;
+	}
+}
+
+/* returns sequence number of the next packet to send: the oldest lost one or
+   the next unsent one if window of receiver is open, 0xFFFF if none */
+static uint16_t stream_next() {
+	uint8_t s;
+	for (s = stream_una; s != stream_snd; s++)
+		if (stream_st[stream_slot(s)] == STREAM_LOST) return s;
+	if ((stream_snd != stream_nxt) &&
+	    ((int8_t)(stream_snd - stream_limit) < 0))
+		return stream_snd;
+	return 0xFFFF;
+}
+
+/* transmitter part of stream_poll */
+static void stream_tx_poll(uint16_t now) {
+	rfm73_packet_t pkt;
+	uint8_t s, b, type, lost = 0;
+	uint16_t next;
+	while (rfm73_rx_get(&pkt) == 0)
+		if (pkt.len == STREAM_STATUS_LEN) stream_status(pkt.data);
+	// nothing acknowledged for a long time: packets are sent again, empty
+	// probe gets state of receiver with closed window
+	if ((rfm73_send_queued() == 0) && (stream_una != stream_nxt) &&
+	    ((uint16_t)(now - stream_rto_ms) >= STREAM_RTO_MS)) {
+		stream_rto_ms = now;
+		for (s = stream_una; s != stream_snd; s++) {
+			b = stream_slot(s);
+			if (stream_st[b] == STREAM_SENT) {
+				stream_st[b] = STREAM_LOST;
+				lost = 1;
+			}
+		}
+		if (!lost && (stream_next() == 0xFFFF)) {
+			pkt.data[0] = stream_snd;
+			rfm73_send_async(RFM73_TX_WITH_ACK, pkt.data, STREAM_HEADER_LEN);
+			stream_since_ack = 0;
+		}
+	}
+	// TX queue keeps TX FIFO filled
+	next = stream_next();
+	while ((next != 0xFFFF) && (rfm73_send_queued() < RFM73_TXQ_SIZE)) {
+		s = next;
+		b = stream_slot(s);
+		if (s == stream_snd) stream_snd++;
+		else stream_stat.retries++;
+		stream_st[b] = STREAM_SENT;
+		stream_stamp[b] = stream_clock++;
+		next = stream_next();
+		// the last packet is always acknowledged to get the final state
+		if ((++stream_since_ack >= STREAM_ACK_EVERY) || (next == 0xFFFF)) {
+			type = RFM73_TX_WITH_ACK;
+			stream_since_ack = 0;
+		}
+		else type = RFM73_TX_WITH_NOACK;
+		rfm73_send_async(type, stream_buf[b], stream_len[b]);
+		stream_stat.packets++;
+	}
+	rfm73_send_status();
+}
+
+/* loads state of receiver to acknowledge payload */
+static void stream_load_status() {
+	uint8_t st[STREAM_STATUS_LEN], i, s;
+	uint16_t sack = 0;
+	for (i = 0; i < 16; i++) {
+		s = stream_exp + 1 + i;
+		if (((uint8_t)(s - stream_rd) < STREAM_WINDOW) &&
+		    (stream_held & (1 << stream_slot(s))))
+			sack |= 1 << i;
+	}
+	st[0] = stream_exp;
+	st[1] = sack;
+	st[2] = sack >> 8;
+	st[3] = stream_rd + STREAM_WINDOW;
+	// only the latest state is kept
+	rfm73_ack_payload_flush();
+	rfm73_ack_payload(stream_pipe, st, STREAM_STATUS_LEN);
+	stream_stat.acks++;
+}
+
+/* receiver part of stream_poll */
+static void stream_rx_poll() {
+	rfm73_packet_t pkt;
+	uint8_t s, b, i;
+	while (rfm73_rx_get(&pkt) == 0) {
+		if (pkt.len < STREAM_HEADER_LEN) continue;
+		stream_pipe = pkt.pipe;
+		stream_dirty = 1;
+		// empty probe only asks for state
+		if (pkt.len == STREAM_HEADER_LEN) continue;
+		s = pkt.data[0];
+		b = stream_slot(s);
+		if (((uint8_t)(s - stream_rd) >= STREAM_WINDOW) ||
+		    (stream_held & (1 << b))) {
+			stream_stat.retries++;
+			continue;
+		}
+		stream_len[b] = pkt.len - STREAM_HEADER_LEN;
+		for (i = 0; i < stream_len[b]; i++)
+			stream_buf[b][i] = pkt.data[STREAM_HEADER_LEN + i];
+		stream_held |= 1 << b;
+		stream_stat.packets++;
+		while (((uint8_t)(stream_exp - stream_rd) < STREAM_WINDOW) &&
+		       (stream_held & (1 << stream_slot(stream_exp))))
+			stream_exp++;
+	}
+	if (stream_dirty) {
+		stream_dirty = 0;
+		stream_load_status();
+	}
+}
+
+/*! \brief This function starts the stream: sequence numbers start from 0 at
+both sides, statistics are cleared.
+
+\param role - #STREAM_TX or #STREAM_RX.*/
+void stream_init(uint8_t role) {
+	stream_role = role;
+	stream_una = 0;
+	stream_snd = 0;
+	stream_nxt = 0;
+	stream_limit = STREAM_WINDOW;
+	stream_since_ack = 0;
+	stream_rd = 0;
+	stream_exp = 0;
+	stream_held = 0;
+	stream_pipe = 0;
+	stream_dirty = (role == STREAM_RX);
+	stream_stat.bytes = 0;
+	stream_stat.packets = 0;
+	stream_stat.retries = 0;
+	stream_stat.acks = 0;
+	stream_stat.ms = 0;
+	stream_last_ms = rfm73_millis();
+	stream_rto_ms = stream_last_ms;
+}
+
+/*! \brief This function does the work of the stream: transmitter takes
+states of receiver and puts packets to TX queue, receiver takes packets from
+RX queue and loads its state to acknowledge payload. It must be called from
+main loop as often as possible.*/
+void stream_poll() {
+	uint16_t now = rfm73_millis();
+	stream_stat.ms += (uint16_t)(now - stream_last_ms);
+	stream_last_ms = now;
+	if (stream_role == STREAM_TX) stream_tx_poll(now);
+	else stream_rx_poll();
+}
+
+/*! \brief This function puts packet to window of transmitter, it is sent by
+stream_poll.
+
+\param pbuf - pointer to data;
+\param len  - length of data (1-#STREAM_MAX_PAYLOAD).
+
+\return
+        - 0 - packet is put to window;
+        - 1 - window is full or length is 0, nothing done.*/
+uint8_t stream_write(const uint8_t* pbuf, uint8_t len) {
+	uint8_t i, b;
+	if ((len == 0) ||
+	    ((uint8_t)(stream_nxt - stream_una) >= STREAM_WINDOW))
+		return 1;
+	if (len > STREAM_MAX_PAYLOAD) len = STREAM_MAX_PAYLOAD;
+	b = stream_slot(stream_nxt);
+	stream_buf[b][0] = stream_nxt;
+	for (i = 0; i < len; i++) stream_buf[b][STREAM_HEADER_LEN + i] = pbuf[i];
+	stream_len[b] = STREAM_HEADER_LEN + len;
+	stream_nxt++;
+	return 0;
+}
+
+/*! \brief This function returns 1 if all packets put by stream_write are
+acknowledged by receiver.*/
+uint8_t stream_flushed() {
+	return stream_una == stream_nxt;
+}
+
+/*! \brief This function takes the next packet of receiver in order of
+sending. Buffer of the packet returns to window of receiver.
+
+\param data_buf - pointer to start of the input buffer (#STREAM_MAX_PAYLOAD
+                  bytes);
+\param len  - length of received data.
+
+\return
+        - 0 - some data received;
+        - 1 - no packets received.*/
+uint8_t stream_read(uint8_t* data_buf, uint8_t* len) {
+	uint8_t i, b;
+	if (stream_rd == stream_exp) return 1;
+	b = stream_slot(stream_rd);
+	*len = stream_len[b];
+	for (i = 0; i < *len; i++) data_buf[i] = stream_buf[b][i];
+	stream_held &= ~(1 << b);
+	stream_rd++;
+	stream_stat.bytes += *len;
+	// window is open again
+	stream_dirty = 1;
+	return 0;
+}
+
+/*! \brief This function returns statistics of the stream since
+stream_init.*/
+const stream_stats_t* stream_stats() {
+	return &stream_stat;
+}
+
+/*! \brief This function returns data rate of the stream since stream_init:
+acknowledged (transmitter) or read (receiver) data bytes per second.
+
+\return Rate, bytes per second (0 if no time is counted yet).*/
+uint32_t stream_rate() {
+	if (stream_stat.ms == 0) return 0;
+	return (uint64_t)stream_stat.bytes * 1000 / stream_stat.ms;
+}
@@ -0,0 +1,94 @@
+/*
+ * stream.h
+ *
+ * Sliding window reliable stream of packets over RFM73 library for bulk
+ * transfer between two modules. Transmitter keeps up to STREAM_WINDOW packets
+ * in flight: they are put to TX queue of the library (see rfm73_send_async),
+ * so TX FIFO of the module is kept filled, and sent without acknowledge.
+ * Every STREAM_ACK_EVERY-th packet is sent with acknowledge, and receiver
+ * returns its state in acknowledge payload (see rfm73_ack_payload): the next
+ * expected sequence number (cumulative acknowledge), bitmap of packets
+ * received after it (selective acknowledge) and the end of its window (flow
+ * control). Packets sent before one that is acknowledged but missing at
+ * receiver are sent again. If nothing is acknowledged for STREAM_RTO_MS,
+ * unacknowledged packets are sent again too (or an empty probe, if window of
+ * receiver is closed).
+ *
+ * Both sides call stream_poll from main loop. rfm73_tick must be called every
+ * millisecond. Receiver must be in RX mode and it must not use acknowledge
+ * payloads for anything else.
+ */
+
+
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <inttypes.h>
+#include "RFM73.h"
+
+/*! \brief Number of packets in flight, also number of packet buffers of
+transmitter and receiver (2, 4, 8 or 16).*/
+#ifndef STREAM_WINDOW
+	#define STREAM_WINDOW          16
+#endif
+/*! \brief Every this packet is sent with acknowledge to get state of
+receiver.*/
+#ifndef STREAM_ACK_EVERY
+	#define STREAM_ACK_EVERY       4
+#endif
+/*! \brief Time without acknowledge after which packets are sent again,
+ms.*/
+#ifndef STREAM_RTO_MS
+	#define STREAM_RTO_MS          10
+#endif
+
+#if (STREAM_WINDOW < 2) || (STREAM_WINDOW > 16) || \
+    (STREAM_WINDOW & (STREAM_WINDOW - 1))
+	#error "STREAM_WINDOW must be 2, 4, 8 or 16"
+#endif
+
+/*! \brief Bytes of header at the start of every packet: sequence number.*/
+#define STREAM_HEADER_LEN          1
+/*! \brief Maximum data size of one packet.*/
+#define STREAM_MAX_PAYLOAD         (RFM73_MAX_PACKET_LEN - STREAM_HEADER_LEN)
+/*! \brief Length of state of receiver sent in acknowledge payload: next
+expected sequence number, 16 bits of selective acknowledge and the end of
+window.*/
+#define STREAM_STATUS_LEN          4
+
+/*! \brief Role of the node: sends data.*/
+#define STREAM_TX                  0
+/*! \brief Role of the node: receives data.*/
+#define STREAM_RX                  1
+
+/*! \brief Statistics of the stream.*/
+typedef struct {
+	/*! \brief Data bytes acknowledged (transmitter) or read (receiver).*/
+	uint32_t bytes;
+	/*! \brief Packets sent (transmitter) or received (receiver).*/
+	uint32_t packets;
+	/*! \brief Packets sent again (transmitter) or duplicates dropped
+	(receiver).*/
+	uint16_t retries;
+	/*! \brief States of receiver got (transmitter) or loaded (receiver).*/
+	uint16_t acks;
+	/*! \brief Time since stream_init, ms (counted by stream_poll).*/
+	uint32_t ms;
+} stream_stats_t;
+
+/* starts stream in role STREAM_TX or STREAM_RX */
+void stream_init(uint8_t role);
+/* sends packets and processes acknowledges (both roles) */
+void stream_poll();
+/* puts packet to window of transmitter */
+uint8_t stream_write(const uint8_t* pbuf, uint8_t len);
+/* returns 1 if all written packets are acknowledged */
+uint8_t stream_flushed();
+/* takes the next packet of receiver in order */
+uint8_t stream_read(uint8_t* data_buf, uint8_t* len);
+/* returns statistics of the stream */
+const stream_stats_t* stream_stats();
+/* returns data rate of the stream, bytes per second */
+uint32_t stream_rate();
+
+#endif /* STREAM_H_ */
@@ -0,0 +1,118 @@
+/*
+ * cap2pcap.c
+ *
+ * Host decoder of packet capture recorded from UART (see cap.h): finds
+ * records in byte stream, checks their sums and writes pcap file with link
+ * type USER0 (147). Every pcap packet is:
+ *
+ *   ch, pipe, status, observe - the same bytes as in record;
+ *   data[]                    - payload.
+ *
+ * Time of records (ms since cap_init) is time of pcap packets. Broken
+ * records are skipped, records dropped by the target are reported.
+ *
+ *   gcc -std=gnu99 -Wall -o cap2pcap tools/cap2pcap.c
+ *   cat /dev/ttyUSB0 > capture.bin
+ *   ./cap2pcap capture.bin capture.pcap
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CAP_SYNC0         0xA5
+#define CAP_SYNC1         0x5A
+#define CAP_HEADER_LEN    12
+#define CAP_MAX_PAYLOAD   32
+/* bytes of record put to pcap packet before payload */
+#define PCAP_PSEUDO_LEN   4
+#define PCAP_LINKTYPE     147
+
+/* writes little-endian value of n bytes */
+static void put_le(FILE* f, uint32_t v, int n) {
+	while (n--) {
+		fputc(v & 0xFF, f);
+		v >>= 8;
+	}
+}
+
+static void pcap_header(FILE* f) {
+	put_le(f, 0xA1B2C3D4, 4);
+	put_le(f, 2, 2);
+	put_le(f, 4, 2);
+	put_le(f, 0, 4);
+	put_le(f, 0, 4);
+	put_le(f, PCAP_PSEUDO_LEN + CAP_MAX_PAYLOAD, 4);
+	put_le(f, PCAP_LINKTYPE, 4);
+}
+
+static void pcap_packet(FILE* f, const uint8_t* rec) {
+	uint32_t ms = rec[2] | (rec[3] << 8) | (rec[4] << 16) |
+	              ((uint32_t)rec[5] << 24);
+	uint32_t len = PCAP_PSEUDO_LEN + rec[11];
+	put_le(f, ms / 1000, 4);
+	put_le(f, (ms % 1000) * 1000, 4);
+	put_le(f, len, 4);
+	put_le(f, len, 4);
+	fwrite(rec + 6, 1, PCAP_PSEUDO_LEN, f);
+	fwrite(rec + CAP_HEADER_LEN, 1, rec[11], f);
+}
+
+int main(int argc, char** argv) {
+	uint8_t rec[CAP_HEADER_LEN + CAP_MAX_PAYLOAD + 1], sum;
+	unsigned long records = 0, broken = 0, dropped = 0;
+	int c, n = 0, i, need = CAP_HEADER_LEN;
+	FILE* in = stdin;
+	FILE* out = stdout;
+
+	if (argc > 3) {
+		fprintf(stderr, "usage: %s [capture.bin [capture.pcap]]\n", argv[0]);
+		return 2;
+	}
+	if ((argc > 1) && !(in = fopen(argv[1], "rb"))) {
+		perror(argv[1]);
+		return 1;
+	}
+	if ((argc > 2) && !(out = fopen(argv[2], "wb"))) {
+		perror(argv[2]);
+		return 1;
+	}
+	pcap_header(out);
+	while ((c = fgetc(in)) != EOF) {
+		rec[n++] = c;
+		// looking for sync
+		if ((n == 1) && (rec[0] != CAP_SYNC0)) {
+			n = 0;
+			continue;
+		}
+		if ((n == 2) && (rec[1] != CAP_SYNC1)) {
+			n = (rec[1] == CAP_SYNC0) ? 1 : 0;
+			rec[0] = rec[1];
+			continue;
+		}
+		if (n == CAP_HEADER_LEN) {
+			if (rec[11] > CAP_MAX_PAYLOAD) {
+				// false sync, it is searched again after it
+				broken++;
+				n = 0;
+				continue;
+			}
+			need = CAP_HEADER_LEN + rec[11] + 1;
+		}
+		if ((n < CAP_HEADER_LEN) || (n < need)) continue;
+		sum = 0;
+		for (i = 2; i < n - 1; i++) sum += rec[i];
+		if (sum == rec[n - 1]) {
+			pcap_packet(out, rec);
+			records++;
+			dropped += rec[10];
+		}
+		else broken++;
+		n = 0;
+		need = CAP_HEADER_LEN;
+	}
+	fprintf(stderr, "%lu records, %lu broken, %lu dropped by target\n",
+	        records, broken, dropped);
+	if (in != stdin) fclose(in);
+	if (out != stdout) fclose(out);
+	return 0;
+}
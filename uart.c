@@ -5,6 +5,20 @@
  *  Author: d-wsky
  */ 
 #include "uart.h"
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#define UART_TX_MASK  (UART_TX_BUF_SIZE-1)
+
+/* transmit ring buffer: head is taken by interrupt, tail is filled by
+   uart_putchar_buf */
+static uint8_t uart_tx_buf[UART_TX_BUF_SIZE];
+static volatile uint8_t uart_tx_head = 0, uart_tx_tail = 0;
+static uint8_t uart_tx_policy = UART_OVF_BLOCK;
+static volatile uint16_t uart_tx_lost = 0;
+
+FILE uart_stdout = FDEV_SETUP_STREAM(uart_putchar_buf, NULL,
+                                     _FDEV_SETUP_WRITE);
 
 int uart_putchar(char c, FILE *stream) {
     if (c == '\n')
@@ -14,6 +28,100 @@ int uart_putchar(char c, FILE *stream) {
     return 0;
 }
 
+/* moves one character from buffer to UDR0, interrupt is disabled when
+   buffer is empty; called with interrupts disabled */
+static void uart_tx_move() {
+	if (uart_tx_head == uart_tx_tail) {
+		UCSR0B &= ~(1<<UDRIE0);
+		return;
+	}
+	if (!(UCSR0A & (1<<UDRE0))) return;
+	UDR0 = uart_tx_buf[uart_tx_head];
+	uart_tx_head = (uart_tx_head + 1) & UART_TX_MASK;
+}
+
+ISR(USART0_UDRE_vect) {
+	uart_tx_move();
+}
+
+/* puts character to buffer, returns 1 if it is dropped */
+static uint8_t uart_tx_put(uint8_t c, uint8_t block) {
+	uint8_t next = (uart_tx_tail + 1) & UART_TX_MASK;
+	while (next == uart_tx_head) {
+		if (!block) {
+			// 16-bit counter is updated atomically, as in uart_try_write
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				uart_tx_lost++;
+			}
+			return 1;
+		}
+		// interrupts could be disabled (e.g. output from ISR), so buffer is
+		// emptied here too
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			uart_tx_move();
+		}
+	}
+	uart_tx_buf[uart_tx_tail] = c;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uart_tx_tail = next;
+		UCSR0B |= (1<<UDRIE0);
+	}
+	return 0;
+}
+
+int uart_putchar_buf(char c, FILE *stream) {
+	uint8_t block = (uart_tx_policy == UART_OVF_BLOCK);
+	if (c == '\n') {
+		// line end is put whole or dropped whole, so '\n' never comes
+		// without '\r'
+		if (!block) return uart_try_write((const uint8_t*)"\r\n", 2) ? EOF : 0;
+		uart_tx_put('\r', 1);
+	}
+	return uart_tx_put(c, block) ? EOF : 0;
+}
+
+/* binary data is never dropped: it goes through buffer with blocking */
+void uart_write(const uint8_t* buf, uint16_t len) {
+    while (len--)
+        uart_tx_put(*buf++, 1);
+}
+
+/* frame is put to buffer whole or dropped whole, returns 1 if dropped */
+uint8_t uart_try_write(const uint8_t* buf, uint8_t len) {
+	// interrupt only frees space, so it can't get less than this
+	uint8_t room = (uart_tx_head - uart_tx_tail - 1) & UART_TX_MASK;
+	if (len > room) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			uart_tx_lost += len;
+		}
+		return 1;
+	}
+	while (len--)
+		uart_tx_put(*buf++, 1);
+	return 0;
+}
+
+void uart_set_overflow(uint8_t policy) {
+	uart_tx_policy = policy;
+}
+
+uint16_t uart_tx_dropped() {
+	uint16_t n;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		n = uart_tx_lost;
+	}
+	return n;
+}
+
+/* waits until buffer is sent */
+void uart_flush() {
+	while (uart_tx_head != uart_tx_tail) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			uart_tx_move();
+		}
+	}
+}
+
 void uart_init(unsigned char port, unsigned int baudrate) {
 	uint16_t ubrr = F_CPU/16/baudrate-1;
 	if (port==1) {
@@ -12,13 +12,34 @@
 
 #include <avr/io.h>
 #include <stdio.h>
+#include <inttypes.h>
 
 #ifndef F_CPU
 	#define F_CPU  14835100UL
 #endif
 
+/* size of transmit ring buffer of port 0 (power of 2, up to 256) */
+#ifndef UART_TX_BUF_SIZE
+	#define UART_TX_BUF_SIZE  128
+#endif
+
+/* overflow policy of transmit buffer: characters that don't fit are lost */
+#define UART_OVF_DROP   0
+/* overflow policy of transmit buffer: wait until buffer has free space */
+#define UART_OVF_BLOCK  1
+
 int uart_putchar(char c, FILE *stream);
+void uart_write(const uint8_t* buf, uint16_t len);
+uint8_t uart_try_write(const uint8_t* buf, uint8_t len);
 void uart_init(unsigned char port, unsigned int baudrate);
+/* buffered output of port 0, sent by USART data register empty interrupt */
+int uart_putchar_buf(char c, FILE *stream);
+void uart_set_overflow(uint8_t policy);
+uint16_t uart_tx_dropped();
+void uart_flush();
+
+/* stdio stream of buffered output */
+extern FILE uart_stdout;
 
 
 #endif /* UART_H_ */
\ No newline at end of file
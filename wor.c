@@ -0,0 +1,200 @@
+/*
+ * wor.c
+ *
+ * Duty-cycled receiver (wake-on-radio) over RFM73 library (see wor.h).
+ */
+
+#include "wor.h"
+
+/* state of duty cycle */
+static volatile uint8_t wor_st = WOR_OFF;
+/* schedule */
+static uint16_t wor_period;
+static uint8_t wor_window;
+/* milliseconds since the start of period */
+static volatile uint16_t wor_phase;
+/* set by wor_tick at the start of period */
+static volatile uint8_t wor_due;
+/* milliseconds to the end of window or hold time */
+static volatile uint16_t wor_timer;
+/* statistics */
+static wor_stats_t wor_stat;
+
+/* powers module down */
+static void wor_sleep() {
+	RFM73_CE_LOW;
+	rfm73_power_down();
+	wor_st = WOR_SLEEP;
+}
+
+/* sets timer of window or hold time */
+static void wor_set_timer(uint16_t ms) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		wor_timer = ms;
+	}
+}
+
+/* returns 1 if window or hold time is over */
+static uint8_t wor_expired() {
+	uint8_t res;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		res = (wor_timer == 0);
+	}
+	return res;
+}
+
+/*! \brief This function starts duty cycle of receiver: module is powered down
+and every period_ms it listens for window_ms. The first window starts at
+once. Statistics are cleared.
+
+\param period_ms - period of windows, ms. It is the worst wake latency;
+\param window_ms - time of listening, ms. It must be longer than one attempt
+                   of wor_send of transmitter.*/
+void wor_start(uint16_t period_ms, uint8_t window_ms) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		wor_period = period_ms;
+		wor_window = window_ms;
+		wor_phase = 0;
+		wor_due = 1;
+		wor_timer = 0;
+		wor_stat.ms_pd = 0;
+		wor_stat.ms_stby = 0;
+		wor_stat.ms_rx = 0;
+		wor_stat.windows = 0;
+		wor_stat.wakeups = 0;
+	}
+	wor_sleep();
+}
+
+/*! \brief This function stops duty cycle. Module is powered up and left in RX
+mode.*/
+void wor_stop() {
+	wor_st = WOR_OFF;
+	rfm73_power_up();
+	rfm73_rx_mode();
+}
+
+/*! \brief Time base of duty cycle. This function must be called every
+millisecond (e.g. from timer interrupt). It doesn't use SPI.*/
+void wor_tick() {
+	switch (wor_st) {
+		case WOR_SLEEP:
+			wor_stat.ms_pd++;
+			break;
+		case WOR_SETTLE:
+			wor_stat.ms_stby++;
+			break;
+		case WOR_LISTEN:
+		case WOR_AWAKE:
+			wor_stat.ms_rx++;
+			break;
+		default:
+			return;
+	}
+	if (wor_timer) wor_timer--;
+	if (++wor_phase >= wor_period) {
+		wor_phase = 0;
+		wor_due = 1;
+	}
+}
+
+/*! \brief This function changes mode of the module according to schedule and
+received packets. It must be called from main loop after every wake up of MCU,
+before packets are taken from RX queue.
+
+\return State of duty cycle: #WOR_OFF, #WOR_SLEEP, #WOR_SETTLE,
+        #WOR_LISTEN or #WOR_AWAKE.*/
+uint8_t wor_poll() {
+	switch (wor_st) {
+		case WOR_SLEEP:
+			if (!wor_due) break;
+			wor_due = 0;
+			wor_stat.windows++;
+			// settling is waited by rfm73_poll, MCU could sleep meanwhile
+			rfm73_power_up_async();
+			rfm73_rx_mode();
+			wor_st = WOR_SETTLE;
+			break;
+		case WOR_SETTLE:
+			// packet could be received before settling is over, it must be
+			// seen before application takes it from RX queue
+			if ((rfm73_poll() < RFM73_STATE_RX_LOCK) && !rfm73_rx_available())
+				break;
+			wor_set_timer(wor_window);
+			wor_st = WOR_LISTEN;
+			// fall through
+		case WOR_LISTEN:
+			if (rfm73_rx_available()) {
+				wor_stat.wakeups++;
+				wor_set_timer(WOR_HOLD_MS);
+				wor_st = WOR_AWAKE;
+			}
+			else if (wor_expired()) wor_sleep();
+			break;
+		case WOR_AWAKE:
+			// windows are not needed while awake
+			wor_due = 0;
+			if (rfm73_rx_available()) wor_set_timer(WOR_HOLD_MS);
+			else if (wor_expired()) wor_sleep();
+			break;
+	}
+	return wor_st;
+}
+
+/*! \brief This function sends packet to duty-cycled receiver: packet is sent
+with acknowledge and short retransmits (250 us, 3 times) again and again
+until it is acknowledged or period_ms+window_ms have passed. Time is counted
+by rfm73_tick. Retransmit settings are left as set by this function.
+
+\param pbuf - pointer to data;
+\param len  - length of data, mustn't exceed 32;
+\param period_ms - period of receiver windows, ms;
+\param window_ms - window of receiver, ms.
+
+\return
+        - 0 - packet acknowledged;
+        - 1 - no acknowledge during a whole period.*/
+uint8_t wor_send(const uint8_t* pbuf, uint8_t len, uint16_t period_ms,
+                 uint8_t window_ms) {
+	uint16_t t0 = rfm73_millis();
+	rfm73_set_autort(250, 3);
+	do {
+		if (rfm73_send_packet(RFM73_TX_WITH_ACK, (uint8_t*)pbuf, len) == 0)
+			return 0;
+	} while ((uint16_t)(rfm73_millis() - t0) <= period_ms + window_ms);
+	return 1;
+}
+
+/*! \brief This function returns statistics of duty cycle since wor_start.*/
+const wor_stats_t* wor_stats() {
+	return &wor_stat;
+}
+
+/*! \brief This function returns average current of the module since
+wor_start, calculated from time spent in every mode (see wor_stats).
+
+\return Current, uA (0 if nothing is counted yet).*/
+uint16_t wor_current_ua() {
+	uint32_t pd, stby, rx, total;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		pd = wor_stat.ms_pd;
+		stby = wor_stat.ms_stby;
+		rx = wor_stat.ms_rx;
+	}
+	total = pd + stby + rx;
+	if (total == 0) return 0;
+	return ((uint64_t)pd*WOR_I_PD_UA + (uint64_t)stby*WOR_I_STBY_UA +
+	        (uint64_t)rx*WOR_I_RX_UA) / total;
+}
+
+/*! \brief This function returns estimated average current of the module for
+schedule without received packets: #WOR_SETTLE_MS of standby and window_ms of
+RX mode every period_ms.
+
+\return Current, uA.*/
+uint16_t wor_estimate_ua(uint16_t period_ms, uint8_t window_ms) {
+	uint32_t rx = window_ms, stby = WOR_SETTLE_MS, pd;
+	if (period_ms <= rx + stby) return WOR_I_RX_UA;
+	pd = period_ms - rx - stby;
+	return (pd*WOR_I_PD_UA + stby*WOR_I_STBY_UA + rx*WOR_I_RX_UA) / period_ms;
+}
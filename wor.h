@@ -0,0 +1,85 @@
+/*
+ * wor.h
+ *
+ * Duty-cycled receiver (wake-on-radio) over RFM73 library. Module is kept in
+ * power down mode and every period_ms it is powered up and listens for
+ * window_ms. If a packet is received, module stays in RX mode until no packet
+ * comes for #WOR_HOLD_MS. Transmitter repeats packet with wor_send until it
+ * is acknowledged or a whole period has passed, so it hits one of the
+ * windows.
+ *
+ * wor_tick and rfm73_tick must be called every millisecond from timer
+ * interrupt, they don't use SPI. Mode changes are done by wor_poll from main
+ * loop, MCU could sleep between calls (timer and IRQ interrupts wake it up),
+ * also while module is settling after power up. RX_DR must be dispatched by
+ * IRQ (see rfm73_irq_enable), so received packets are seen in RX queue.
+ *
+ * Average current is estimated from time spent in every mode and currents of
+ * RFM73 datasheet (WOR_I_*_UA), worst wake latency is period_ms.
+ */
+
+
+#ifndef WOR_H_
+#define WOR_H_
+
+#include <inttypes.h>
+#include "RFM73.h"
+
+/*! \brief Time in RX mode after the last received packet, ms.*/
+#ifndef WOR_HOLD_MS
+	#define WOR_HOLD_MS            50
+#endif
+
+/*! \brief Current of module in power down mode, uA.*/
+#define WOR_I_PD_UA                3
+/*! \brief Current of module in standby mode (power up settling), uA.*/
+#define WOR_I_STBY_UA              50
+/*! \brief Current of module in RX mode, uA.*/
+#define WOR_I_RX_UA                23000
+/*! \brief Power up settling time (see rfm73_power_up), ms.*/
+#define WOR_SETTLE_MS              3
+
+/*! \brief State of duty cycle: stopped, module is not touched.*/
+#define WOR_OFF                    0
+/*! \brief State of duty cycle: module is powered down.*/
+#define WOR_SLEEP                  1
+/*! \brief State of duty cycle: module is powering up.*/
+#define WOR_SETTLE                 2
+/*! \brief State of duty cycle: module listens in the window.*/
+#define WOR_LISTEN                 3
+/*! \brief State of duty cycle: packet received, module stays in RX mode.*/
+#define WOR_AWAKE                  4
+
+/*! \brief Statistics of duty cycle.*/
+typedef struct {
+	/*! \brief Milliseconds in power down mode.*/
+	uint32_t ms_pd;
+	/*! \brief Milliseconds of power up settling.*/
+	uint32_t ms_stby;
+	/*! \brief Milliseconds in RX mode.*/
+	uint32_t ms_rx;
+	/*! \brief Number of windows.*/
+	uint16_t windows;
+	/*! \brief Number of windows where packet was received.*/
+	uint16_t wakeups;
+} wor_stats_t;
+
+/* starts duty cycle: listen window_ms every period_ms */
+void wor_start(uint16_t period_ms, uint8_t window_ms);
+/* stops duty cycle, module is left in RX mode */
+void wor_stop();
+/* time base of duty cycle, must be called every millisecond */
+void wor_tick();
+/* changes mode of module, returns state of duty cycle */
+uint8_t wor_poll();
+/* sends packet repeatedly until it is acknowledged or period is over */
+uint8_t wor_send(const uint8_t* pbuf, uint8_t len, uint16_t period_ms,
+                 uint8_t window_ms);
+/* returns statistics of duty cycle */
+const wor_stats_t* wor_stats();
+/* returns average current of module measured by statistics, uA */
+uint16_t wor_current_ua();
+/* returns estimated average current of module for schedule, uA */
+uint16_t wor_estimate_ua(uint16_t period_ms, uint8_t window_ms);
+
+#endif /* WOR_H_ */